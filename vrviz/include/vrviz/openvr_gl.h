@@ -18,7 +18,11 @@
 #include <stdio.h>
 #include <string>
 #include <cstdlib>
+#include <unordered_map>
 #include "mesh.h"
+#include "marker_registry.h"
+#include "streaming_buffer.h"
+#include "point_chunks.h"
 
 #include <openvr.h>
 
@@ -104,8 +108,10 @@ public:
 	void SetupCameras();
 
 	void RenderStereoTargets();
+	void CullPointChunks();
 	void RenderCompanionWindow();
 	void RenderScene( vr::Hmd_Eye nEye );
+	void RenderMeshes( const std::vector<Mesh*> &meshes, vr::Hmd_Eye nEye );
 
 	Matrix4 GetHMDMatrixProjectionEye( vr::Hmd_Eye nEye );
 	Matrix4 GetHMDMatrixPoseEye( vr::Hmd_Eye nEye );
@@ -118,14 +124,74 @@ public:
 	GLuint CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader );
 	bool CreateAllShaders();
 
+	// How points that carry a scalar instead of a color are colored by the shader, see PointCloudDecoder::HasScalars()
+	struct PointColorState
+	{
+		PointColorState() : m_bScalars( false ), m_fScalarMin( 0.0f ), m_fScalarMax( 1.0f ), m_unColormapTexture( 0 ) {}
+		bool m_bScalars;
+		float m_fScalarMin;
+		float m_fScalarMax;
+		std::vector<uint32_t> m_vecColormap; // RGBA8 texels currently in m_unColormapTexture
+		GLuint m_unColormapTexture;
+	};
+	void BindPointProgram( const PointColorState & colorState, const Matrix4 & matMVP );
+
 	void SetupRenderModelForTrackedDevice( vr::TrackedDeviceIndex_t unTrackedDeviceIndex );
 	CGLRenderModel *FindOrLoadRenderModel( const char *pchRenderModelName );
 
 	unsigned int m_unPointSize;
 	std::string m_strTextPath;
 	std::string m_strActionManifestPath;
-	std::vector<Mesh*> robot_meshes;
-	std::string m_strPointCloudFrame;
+	std::vector<Mesh*> robot_meshes; // Robot links and models loaded at startup
+	MarkerRegistry marker_registry;
+	std::vector<Mesh*> m_vecMarkerDrawList; // Copy of the registry meshes, so they are drawn without holding its lock
+
+	// The latest cloud of one point cloud topic, drawn in its own frame
+	struct PointCloudLayer
+	{
+		PointCloudLayer() : m_stream( sizeof( PointVertex ) ), m_nFirstVert( 0 ), m_unVAO( 0 ), m_uiVertcount( 0 ), m_unPointSize( 1 ) {}
+		StreamingBuffer m_stream;
+		GLint m_nFirstVert;
+		GLuint m_unVAO;
+		unsigned int m_uiVertcount;
+		unsigned int m_unPointSize;
+		std::string m_strFrame;
+		std::vector<PointChunk> m_vecChunks;
+		// Chunks that either eye can see this frame, for glMultiDrawArrays
+		std::vector<GLint> m_vecVisibleFirsts;
+		std::vector<GLsizei> m_vecVisibleCounts;
+		PointColorState m_colorState;
+	};
+	std::vector<PointCloudLayer*> m_vecPointCloudLayers;
+
+	// One piece of the accumulated point map, drawn in m_strPointMapFrame
+	struct PointMapChunk
+	{
+		PointMapChunk() : m_unVAO( 0 ), m_glVertBuffer( 0 ), m_uiVertcount( 0 ), m_bVisible( true ) {}
+		GLuint m_unVAO;
+		GLuint m_glVertBuffer;
+		unsigned int m_uiVertcount;
+		Vector3 m_vMin;
+		Vector3 m_vMax;
+		bool m_bVisible;
+	};
+	std::unordered_map<uint64_t,PointMapChunk> m_mapPointMapChunks;
+	std::string m_strPointMapFrame;
+	PointColorState m_pointMapColorState;
+
+	// Depth image that is turned into points by the depth shader, drawn in m_strDepthFrame
+	GLuint m_unDepthTexture;
+	GLuint m_unDepthColorTexture;
+	GLuint m_unDepthVAO; // Holds no attributes, the points come from gl_VertexID
+	unsigned int m_uiDepthWidth;
+	unsigned int m_uiDepthHeight;
+	GLint m_iDepthInternalFormat; // GL_R16 or GL_R32F, the texture is reallocated when it changes
+	unsigned int m_uiDepthColorWidth; // Size the color texture was allocated with
+	unsigned int m_uiDepthColorHeight;
+	Vector4 m_vDepthIntrinsics; // fx, fy, cx, cy in pixels
+	float m_fDepthScale; // Texture value to VR units
+	bool m_bDepthHasColor;
+	std::string m_strDepthFrame;
 protected:
 	bool m_bDebugOpenGL;
 	bool m_bVerbose;
@@ -202,9 +268,11 @@ protected:
 	GLuint m_unControllerVAO;
 	unsigned int m_uiControllerVertcount;
 
-	GLuint m_glPointCloudVertBuffer;
-	GLuint m_unPointCloudVAO;
-	unsigned int m_uiPointCloudVertcount;
+	// Buffers for data that changes often, and the vertex their latest data starts at
+	StreamingBuffer m_sceneStream;
+	GLint m_nSceneFirstVert;
+	StreamingBuffer m_controllerStream;
+	GLint m_nControllerFirstVert;
 
 	GLuint m_glColorTrisVertBuffer;
 	GLuint m_unColorTrisVAO;
@@ -213,7 +281,6 @@ protected:
 	Matrix4 m_mat4HMDPose;
 	Matrix4 m_mat4eyePosLeft;
 	Matrix4 m_mat4eyePosRight;
-	vr::HmdMatrix34_t OverlayTransform;
 
 	Matrix4 m_mat4ProjectionCenter;
 	Matrix4 m_mat4ProjectionLeft;
@@ -237,11 +304,21 @@ protected:
 	GLuint m_unCompanionWindowProgramID;
 	GLuint m_unControllerTransformProgramID;
 	GLuint m_unRenderModelProgramID;
+	GLuint m_unPointCloudProgramID;
+	GLuint m_unPointScalarProgramID;
+	GLuint m_unDepthProgramID;
 	GLuint m_unLitRGBModelProgramID;
 	GLuint m_unLitModelProgramID;
 
 	GLint m_nSceneMatrixLocation;
 	GLint m_nControllerMatrixLocation;
+	GLint m_nPointCloudMatrixLocation;
+	GLint m_nPointScalarMatrixLocation;
+	GLint m_nPointScalarRangeLocation;
+	GLint m_nDepthMatrixLocation;
+	GLint m_nDepthIntrinsicsLocation;
+	GLint m_nDepthScaleLocation;
+	GLint m_nDepthHasColorLocation;
 	GLint m_nRenderModelMatrixLocation;
 	GLint m_nLitRGBModelMatrixLocation;
 	GLint m_nLitModelMatrixLocation;
@@ -254,6 +331,9 @@ protected:
     GLuint m_matSpecularPowerRGBLocation;
     GLuint m_numPointLightsRGBLocation;
     GLuint m_numSpotLightsRGBLocation;
+    GLuint m_instancedRGBLocation;
+    GLuint m_scaleRGBLocation;
+    GLuint m_colorRGBLocation;
 
     GLuint m_WVPLocation;
     GLuint m_WorldMatrixLocation;
@@ -308,8 +388,6 @@ protected:
 	FramebufferDesc leftEyeDesc;
 	FramebufferDesc rightEyeDesc;
 
-	vr::VROverlayHandle_t m_ulOverlayHandle;
-
 	bool CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc );
 	
 	uint32_t m_nRenderWidth;
@@ -0,0 +1,160 @@
+#include <ros/ros.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include "compressed_image.h"
+#include "image_kernels.h"
+
+#ifdef VRVIZ_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+namespace
+{
+
+bool isJpeg(const std::vector<uint8_t>& data)
+{
+    return data.size()>=3 && data[0]==0xFF && data[1]==0xD8 && data[2]==0xFF;
+}
+
+}
+
+/*!
+ * \param begin Asked for the destination of every image, from the decode thread
+ * \param end Told when the image is done, from the decode thread
+ */
+CompressedImageDecoder::CompressedImageDecoder(const BeginFunction& begin, const EndFunction& end)
+    : m_begin(begin)
+    , m_end(end)
+    , m_jpeg(NULL)
+    , m_stop(false)
+{
+#ifdef VRVIZ_HAVE_TURBOJPEG
+    m_jpeg = tjInitDecompress();
+#endif
+    m_thread = new boost::thread(boost::bind(&CompressedImageDecoder::DecodeLoop,this));
+}
+
+CompressedImageDecoder::~CompressedImageDecoder()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    m_thread->join();
+    delete m_thread;
+#ifdef VRVIZ_HAVE_TURBOJPEG
+    if(m_jpeg){
+        tjDestroy(m_jpeg);
+    }
+#endif
+}
+
+/*!
+ * \brief Queue a message for decoding, replacing one that is still waiting
+ *
+ * \return true if a waiting message was replaced, so it will never be decoded
+ */
+bool CompressedImageDecoder::Push(const sensor_msgs::CompressedImageConstPtr& msg)
+{
+    bool replaced;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        replaced = bool(m_pending);
+        m_pending = msg;
+    }
+    m_condition.notify_one();
+    return replaced;
+}
+
+void CompressedImageDecoder::DecodeLoop()
+{
+    while(true)
+    {
+        sensor_msgs::CompressedImageConstPtr msg;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while(!m_stop && !m_pending){
+                m_condition.wait(lock);
+            }
+            if(m_stop){
+                return;
+            }
+            msg.swap(m_pending);
+        }
+        Decode(*msg);
+    }
+}
+
+/// Decode a JPEG straight into RGBA with TurboJPEG. Returns false if that is not possible, so cv::imdecode has to do it.
+bool CompressedImageDecoder::DecodeJpeg(const sensor_msgs::CompressedImage& msg, bool& decoded)
+{
+#ifdef VRVIZ_HAVE_TURBOJPEG
+    if(!m_jpeg || !isJpeg(msg.data)){
+        return false;
+    }
+    int width, height, subsampling, colorspace;
+    if(tjDecompressHeader3(m_jpeg,msg.data.data(),msg.data.size(),&width,&height,&subsampling,&colorspace)!=0){
+        ROS_ERROR_THROTTLE(5.0,"Could not read JPEG header: %s",tjGetErrorStr2(m_jpeg));
+        decoded = false;
+        return true;
+    }
+    uint8_t* dst = m_begin(width,height,msg);
+    if(dst){
+        decoded = tjDecompress2(m_jpeg,msg.data.data(),msg.data.size(),dst,width,width*4,height,TJPF_RGBA,TJFLAG_FASTDCT)==0;
+        if(!decoded){
+            ROS_ERROR_THROTTLE(5.0,"Could not decode JPEG: %s",tjGetErrorStr2(m_jpeg));
+        }
+        m_end(decoded,width,height,msg);
+    }else{
+        decoded = false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// Decode one message into wherever m_begin points
+bool CompressedImageDecoder::Decode(const sensor_msgs::CompressedImage& msg)
+{
+    bool decoded = false;
+    if(DecodeJpeg(msg,decoded)){
+        return decoded;
+    }
+
+    cv::Mat image = cv::imdecode(cv::Mat(1,msg.data.size(),CV_8UC1,const_cast<uint8_t*>(msg.data.data())),cv::IMREAD_UNCHANGED);
+    if(image.empty()){
+        ROS_ERROR_THROTTLE(5.0,"Could not decode compressed image (format '%s')",msg.format.c_str());
+        return false;
+    }
+    const int channels = image.channels();
+    const bool wide = image.depth()==CV_16U;
+    if(!(image.depth()==CV_8U || (wide && channels==1)) || !(channels==1 || channels==3 || channels==4)){
+        ROS_ERROR_THROTTLE(5.0,"Compressed image (format '%s') decoded to an unsupported type",msg.format.c_str());
+        return false;
+    }
+
+    uint8_t* dst = m_begin(image.cols,image.rows,msg);
+    if(!dst){
+        return false;
+    }
+    /// OpenCV decodes to BGR(A), and 16 bit gray in host order, so little endian with the high byte second
+    const ImageKernels& kernels = GetImageKernels();
+    for(int y=0;y<image.rows;y++)
+    {
+        const uint8_t* src = image.ptr<uint8_t>(y);
+        uint8_t* row = dst+size_t(y)*image.cols*4;
+        if(channels==3){
+            kernels.bgr8(src,image.cols,255,row);
+        }else if(channels==4){
+            kernels.bgra8(src,image.cols,255,row);
+        }else if(wide){
+            kernels.mono8(src+1,image.cols,2,255,row);
+        }else{
+            kernels.mono8(src,image.cols,1,255,row);
+        }
+    }
+    m_end(true,image.cols,image.rows,msg);
+    return true;
+}
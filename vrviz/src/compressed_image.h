@@ -0,0 +1,51 @@
+#ifndef COMPRESSED_IMAGE_H
+#define	COMPRESSED_IMAGE_H
+
+#include <stdint.h>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <sensor_msgs/CompressedImage.h>
+
+/*!
+ * \brief Decodes sensor_msgs::CompressedImage messages (JPEG or PNG) on their own thread, newest first
+ *
+ * Push() only stores the message, so the ROS callback returns right away. The decode thread always
+ * takes the newest message, and any older one that it did not get to yet is dropped.
+ *
+ * The output is RGBA8 with rows of width*4 bytes, written wherever the begin function says, so it
+ * can go straight into a mapped pixel buffer. JPEG is decoded by TurboJPEG directly into RGBA when
+ * vrviz is built with it, everything else by cv::imdecode followed by the image_kernels.h row kernels.
+ */
+class CompressedImageDecoder
+{
+public:
+    /// Returns where to write a width x height RGBA8 image, or NULL to drop the image
+    typedef boost::function<uint8_t*(int width, int height, const sensor_msgs::CompressedImage& msg)> BeginFunction;
+    /// Called after every non-NULL BeginFunction, with whether the image was decoded
+    typedef boost::function<void(bool decoded, int width, int height, const sensor_msgs::CompressedImage& msg)> EndFunction;
+
+    CompressedImageDecoder(const BeginFunction& begin, const EndFunction& end);
+    ~CompressedImageDecoder();
+
+    bool Push(const sensor_msgs::CompressedImageConstPtr& msg);
+
+private:
+    void DecodeLoop();
+    bool Decode(const sensor_msgs::CompressedImage& msg);
+    bool DecodeJpeg(const sensor_msgs::CompressedImage& msg, bool& decoded);
+
+    BeginFunction m_begin;
+    EndFunction m_end;
+    void* m_jpeg;///!< TurboJPEG handle, only used by the decode thread
+
+    boost::thread* m_thread;
+    boost::mutex m_mutex;///!< Protects everything below
+    boost::condition_variable m_condition;
+    sensor_msgs::CompressedImageConstPtr m_pending;
+    bool m_stop;
+};
+
+
+#endif	/* COMPRESSED_IMAGE_H */
@@ -0,0 +1,38 @@
+#include "frustum.h"
+
+/*!
+ * \brief Extract the planes of the frustum
+ *
+ * \param mvp Column major model-view-projection matrix, as handed to the shaders
+ */
+void Frustum::SetFromMatrix(const Matrix4& mvp)
+{
+    const float* m = mvp.get();
+    /// Row ii of the matrix is (m[ii], m[4+ii], m[8+ii], m[12+ii])
+    for(int ii=0;ii<3;ii++)
+    {
+        m_planes[2*ii]   = Vector4(m[3]+m[ii], m[7]+m[4+ii], m[11]+m[8+ii], m[15]+m[12+ii]);
+        m_planes[2*ii+1] = Vector4(m[3]-m[ii], m[7]-m[4+ii], m[11]-m[8+ii], m[15]-m[12+ii]);
+    }
+}
+
+/*!
+ * \brief Conservative box test
+ *
+ * \return false only if the box is entirely outside one of the planes
+ */
+bool Frustum::IntersectsBox(const Vector3& min, const Vector3& max) const
+{
+    for(int ii=0;ii<6;ii++)
+    {
+        const Vector4& plane = m_planes[ii];
+        /// The corner that is furthest along the plane normal
+        float x = plane.x>=0 ? max.x : min.x;
+        float y = plane.y>=0 ? max.y : min.y;
+        float z = plane.z>=0 ? max.z : min.z;
+        if(plane.x*x + plane.y*y + plane.z*z + plane.w < 0){
+            return false;
+        }
+    }
+    return true;
+}
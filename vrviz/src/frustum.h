@@ -0,0 +1,23 @@
+#ifndef FRUSTUM_H
+#define	FRUSTUM_H
+
+#include "shared/Matrices.h"
+
+/*!
+ * \brief View frustum as six planes, for throwing away boxes that can't be seen
+ *
+ * The planes are pulled straight out of a model-view-projection matrix, so the boxes
+ * are tested in model space without transforming them.
+ */
+class Frustum
+{
+public:
+    void SetFromMatrix(const Matrix4& mvp);
+    bool IntersectsBox(const Vector3& min, const Vector3& max) const;
+
+private:
+    Vector4 m_planes[6];
+};
+
+
+#endif	/* FRUSTUM_H */
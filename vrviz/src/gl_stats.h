@@ -0,0 +1,33 @@
+#ifndef GL_STATS_H
+#define	GL_STATS_H
+
+#include <atomic>
+
+/*!
+ * \brief Live GL objects that vrviz creates while it runs
+ *
+ * Everything that can be created or freed after startup (marker meshes, textures, streamed
+ * vertex buffers) is counted here, so a leak shows up as a count that keeps growing over a
+ * long session. The counts are changed by the render thread and published from the ROS thread.
+ */
+struct GLObjectCounts
+{
+    GLObjectCounts()
+        : buffers(0)
+        , vertex_arrays(0)
+        , textures(0)
+        , stream_bytes(0)
+    {
+    }
+
+    std::atomic<int> buffers;
+    std::atomic<int> vertex_arrays;
+    std::atomic<int> textures;
+    std::atomic<long long> stream_bytes;///!< Storage held by all StreamingBuffer objects
+};
+
+/// Defined in vrviz_gl.cpp
+extern GLObjectCounts gl_object_counts;
+
+
+#endif	/* GL_STATS_H */
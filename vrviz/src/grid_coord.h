@@ -0,0 +1,34 @@
+#ifndef GRID_COORD_H
+#define	GRID_COORD_H
+
+#include <stdint.h>
+
+/// Cell coordinates of the point grids (voxels, render chunks, point map nodes) are stored as 21 bit unsigned values
+const int GRID_BITS = 21;
+const int64_t GRID_OFFSET = int64_t(1)<<(GRID_BITS-1);///!< Added to a cell index so cell 0 sits in the middle
+const int64_t GRID_MAX = (int64_t(1)<<GRID_BITS)-1;
+
+/*!
+ * \brief Turn a cell index along one axis into its 21 bit grid coordinate
+ *
+ * The clamping is done on the float, because converting a float that is out of the range of the integer
+ * type is undefined behavior, and a finite but huge coordinate (or a big tf translation) easily gets there.
+ * Cells beyond the grid end up in its outermost cells. NAN fails both comparisons and ends up in cell 0.
+ *
+ * \param cell The cell index as a float, usually std::floor(v*inv_size)
+ * \return Coordinate in [0, GRID_MAX]
+ */
+inline uint64_t gridCoord(float cell)
+{
+    const float v = cell+float(GRID_OFFSET);
+    if(!(v>0.0f)){
+        return 0;
+    }
+    if(v>float(GRID_MAX)){
+        return GRID_MAX;
+    }
+    return uint64_t(v);
+}
+
+
+#endif	/* GRID_COORD_H */
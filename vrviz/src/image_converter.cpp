@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <ros/ros.h>
+#include <sensor_msgs/image_encodings.h>
+#include "image_converter.h"
+#include "image_kernels.h"
+
+namespace
+{
+
+enum Format {
+    FORMAT_UNKNOWN,
+    FORMAT_RGB8,
+    FORMAT_BGR8,
+    FORMAT_RGBA8,
+    FORMAT_BGRA8,
+    FORMAT_MONO8,
+    FORMAT_MONO16,
+    FORMAT_YUV422,
+    FORMAT_BAYER
+};
+
+/// Work out the format of an encoding, and for Bayer images where the red and blue samples sit in each 2x2 cell
+Format parseEncoding(const std::string& encoding, int* red, int* blue)
+{
+    namespace enc = sensor_msgs::image_encodings;
+    if(encoding == enc::RGB8){
+        return FORMAT_RGB8;
+    }else if(encoding == enc::BGR8){
+        return FORMAT_BGR8;
+    }else if(encoding == enc::RGBA8){
+        return FORMAT_RGBA8;
+    }else if(encoding == enc::BGRA8){
+        return FORMAT_BGRA8;
+    }else if(encoding == enc::MONO8){
+        return FORMAT_MONO8;
+    }else if(encoding == enc::MONO16){
+        return FORMAT_MONO16;
+    }else if(encoding == enc::YUV422){
+        return FORMAT_YUV422;
+    }
+    int r, b;
+    if(encoding == enc::BAYER_RGGB8){
+        r = 0; b = 3;
+    }else if(encoding == enc::BAYER_BGGR8){
+        r = 3; b = 0;
+    }else if(encoding == enc::BAYER_GBRG8){
+        r = 2; b = 1;
+    }else if(encoding == enc::BAYER_GRBG8){
+        r = 1; b = 2;
+    }else{
+        return FORMAT_UNKNOWN;
+    }
+    if(red){
+        *red = r;
+    }
+    if(blue){
+        *blue = b;
+    }
+    return FORMAT_BAYER;
+}
+
+/// Bytes per pixel of the message data
+size_t pixelBytes(Format format)
+{
+    switch(format)
+    {
+        case FORMAT_RGB8:
+        case FORMAT_BGR8:
+            return 3;
+        case FORMAT_RGBA8:
+        case FORMAT_BGRA8:
+            return 4;
+        case FORMAT_MONO16:
+        case FORMAT_YUV422:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+/// Number of row bands handed to each thread, so an uneven thread doesn't hold up the batch
+const size_t BANDS_PER_THREAD = 2;
+
+}
+
+ImageConverter::ImageConverter()
+    : worker_pool(NULL)
+{
+}
+
+/*!
+ * \brief Whether Convert() handles this encoding
+ */
+bool ImageConverter::IsSupported(const std::string& encoding)
+{
+    return parseEncoding(encoding,NULL,NULL) != FORMAT_UNKNOWN;
+}
+
+/*!
+ * \brief Convert an image message into an RGBA8 image
+ *
+ * \param msg The image to convert
+ * \param alpha The alpha given to every pixel
+ * \param image Output, reallocated as CV_8UC4 if it does not have the size of msg already
+ * \return False if the encoding is not supported or the message is malformed, in which case image is untouched
+ */
+bool ImageConverter::Convert(const sensor_msgs::Image& msg, uint8_t alpha, cv::Mat& image)
+{
+    int red = 0, blue = 0;
+    const Format format = parseEncoding(msg.encoding,&red,&blue);
+    if(format == FORMAT_UNKNOWN){
+        return false;
+    }
+
+    const size_t width = msg.width;
+    const size_t height = msg.height;
+    if(width == 0 || height == 0){
+        return false;
+    }
+    if(msg.step < width*pixelBytes(format) || msg.data.size() < size_t(msg.step)*height){
+        ROS_ERROR_THROTTLE(5.0,"Image data is smaller than its header claims (%d bytes for %dx%d %s, step %d)",
+                           int(msg.data.size()),int(width),int(height),msg.encoding.c_str(),int(msg.step));
+        return false;
+    }
+    if((format == FORMAT_YUV422 || format == FORMAT_BAYER) && width%2 != 0){
+        ROS_ERROR_THROTTLE(5.0,"%s images need an even width, got %d",msg.encoding.c_str(),int(width));
+        return false;
+    }
+    if(format == FORMAT_BAYER && height%2 != 0){
+        ROS_ERROR_THROTTLE(5.0,"%s images need an even height, got %d",msg.encoding.c_str(),int(height));
+        return false;
+    }
+
+    if(image.rows != int(height) || image.cols != int(width) || image.type() != CV_8UC4){
+        image.create(height,width,CV_8UC4);
+    }
+
+    const ImageKernels& kernels = GetImageKernels();
+    const uint8_t* data = msg.data.data();
+    const size_t step = msg.step;
+
+    /// The high byte of a mono16 pixel comes first in big endian data
+    const size_t mono16_offset = msg.is_bigendian ? 0 : 1;
+
+    /// Bayer images are converted a pair of rows at a time, so those are the units that get split
+    const size_t units = format == FORMAT_BAYER ? height/2 : height;
+    size_t num_bands = 1;
+    if(worker_pool){
+        num_bands = std::min(units,size_t(worker_pool->GetNumThreads())*BANDS_PER_THREAD);
+    }
+    const size_t band_size = (units+num_bands-1)/num_bands;
+
+    boost::function<void(size_t)> convert_band = [&](size_t band){
+        const size_t begin = band*band_size;
+        const size_t end = std::min(begin+band_size,units);
+        for(size_t unit=begin;unit<end;unit++)
+        {
+            if(format == FORMAT_BAYER){
+                const uint8_t* src = data+2*unit*step;
+                kernels.bayer(src,src+step,width,red,blue,alpha,
+                              image.ptr<uint8_t>(2*unit),image.ptr<uint8_t>(2*unit+1));
+                continue;
+            }
+            const uint8_t* src = data+unit*step;
+            uint8_t* dst = image.ptr<uint8_t>(unit);
+            switch(format)
+            {
+                case FORMAT_RGB8:
+                    kernels.rgb8(src,width,alpha,dst);
+                    break;
+                case FORMAT_BGR8:
+                    kernels.bgr8(src,width,alpha,dst);
+                    break;
+                case FORMAT_RGBA8:
+                    kernels.rgba8(src,width,alpha,dst);
+                    break;
+                case FORMAT_BGRA8:
+                    kernels.bgra8(src,width,alpha,dst);
+                    break;
+                case FORMAT_MONO8:
+                    kernels.mono8(src,width,1,alpha,dst);
+                    break;
+                case FORMAT_MONO16:
+                    kernels.mono8(src+mono16_offset,width,2,alpha,dst);
+                    break;
+                case FORMAT_YUV422:
+                    kernels.yuv422(src,width,alpha,dst);
+                    break;
+                default:
+                    break;
+            }
+        }
+    };
+    if(worker_pool && num_bands>1){
+        worker_pool->ParallelFor(num_bands,convert_band);
+    }else{
+        for(size_t band=0;band<num_bands;band++){
+            convert_band(band);
+        }
+    }
+    return true;
+}
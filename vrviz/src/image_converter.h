@@ -0,0 +1,34 @@
+#ifndef IMAGE_CONVERTER_H
+#define	IMAGE_CONVERTER_H
+
+#include <string>
+#include <stdint.h>
+#include <sensor_msgs/Image.h>
+#include <opencv2/core/core.hpp>
+#include "worker_pool.h"
+
+/*!
+ * \brief Converts sensor_msgs::Image messages straight into the RGBA8 layout of the overlay texture
+ *
+ * Each row of the message is converted by the kernels in image_kernels.h, so the message data is
+ * only read once. The rows keep their order; the overlay texture bounds flip the image.
+ * The rows are split into bands over the worker pool when one is set.
+ *
+ * Supported encodings are rgb8, bgr8, rgba8, bgra8, mono8, mono16, yuv422 and the 8 bit Bayer
+ * patterns (which are demosaiced by simply giving each 2x2 cell a single color).
+ * Anything else has to go through cv_bridge.
+ */
+class ImageConverter
+{
+public:
+    ImageConverter();
+
+    static bool IsSupported(const std::string& encoding);
+
+    bool Convert(const sensor_msgs::Image& msg, uint8_t alpha, cv::Mat& image);
+
+    WorkerPool* worker_pool;///!< Splits the rows over these threads when set, otherwise they are all converted inline
+};
+
+
+#endif	/* IMAGE_CONVERTER_H */
@@ -0,0 +1,658 @@
+#include <string.h>
+#include "image_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/// The SIMD versions below only vectorize the bulk of each row, and call these for the tail,
+/// so any change here needs to be mirrored in the SIMD code to keep the results identical.
+namespace
+{
+
+inline uint8_t clampByte(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : uint8_t(v));
+}
+
+inline void writePixel(uint8_t* dst, uint8_t r, uint8_t g, uint8_t b, uint8_t alpha)
+{
+    dst[0] = r;
+    dst[1] = g;
+    dst[2] = b;
+    dst[3] = alpha;
+}
+
+/// Fixed point BT.601 coefficients, scaled by 64
+const int YUV_R_V = 90;
+const int YUV_G_U = 22;
+const int YUV_G_V = 46;
+const int YUV_B_U = 113;
+
+void rgb8Scalar(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    for(size_t i=0;i<width;i++)
+    {
+        writePixel(dst+4*i,src[3*i],src[3*i+1],src[3*i+2],alpha);
+    }
+}
+
+void bgr8Scalar(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    for(size_t i=0;i<width;i++)
+    {
+        writePixel(dst+4*i,src[3*i+2],src[3*i+1],src[3*i],alpha);
+    }
+}
+
+void rgba8Scalar(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    for(size_t i=0;i<width;i++)
+    {
+        writePixel(dst+4*i,src[4*i],src[4*i+1],src[4*i+2],alpha);
+    }
+}
+
+void bgra8Scalar(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    for(size_t i=0;i<width;i++)
+    {
+        writePixel(dst+4*i,src[4*i+2],src[4*i+1],src[4*i],alpha);
+    }
+}
+
+void mono8Scalar(const uint8_t* src, size_t width, size_t stride, uint8_t alpha, uint8_t* dst)
+{
+    for(size_t i=0;i<width;i++)
+    {
+        uint8_t gray = src[i*stride];
+        writePixel(dst+4*i,gray,gray,gray,alpha);
+    }
+}
+
+void yuv422Scalar(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    for(size_t i=0;i+1<width;i+=2)
+    {
+        const uint8_t* uyvy = src+2*i;
+        int d = int(uyvy[0])-128;
+        int e = int(uyvy[2])-128;
+        for(int k=0;k<2;k++)
+        {
+            int y = int(uyvy[1+2*k])*64+32;
+            writePixel(dst+4*(i+k),
+                       clampByte((y+YUV_R_V*e)>>6),
+                       clampByte((y-YUV_G_U*d-YUV_G_V*e)>>6),
+                       clampByte((y+YUV_B_U*d)>>6),
+                       alpha);
+        }
+    }
+}
+
+/// The two cell positions that are neither red nor blue
+inline void greenPositions(int red, int blue, int* green)
+{
+    int n = 0;
+    for(int i=0;i<4;i++)
+    {
+        if(i != red && i != blue){
+            green[n++] = i;
+        }
+    }
+}
+
+void bayerScalar(const uint8_t* src0, const uint8_t* src1, size_t width, int red, int blue,
+                 uint8_t alpha, uint8_t* dst0, uint8_t* dst1)
+{
+    int green[2];
+    greenPositions(red,blue,green);
+    for(size_t i=0;i+1<width;i+=2)
+    {
+        uint8_t cell[4] = {src0[i],src0[i+1],src1[i],src1[i+1]};
+        uint8_t g = uint8_t((int(cell[green[0]])+int(cell[green[1]])+1)>>1);
+        writePixel(dst0+4*i,cell[red],g,cell[blue],alpha);
+        memcpy(dst0+4*i+4,dst0+4*i,4);
+        memcpy(dst1+4*i,dst0+4*i,4);
+        memcpy(dst1+4*i+4,dst0+4*i,4);
+    }
+}
+
+const ImageKernels scalar_kernels = {
+    "scalar",
+    rgb8Scalar,
+    bgr8Scalar,
+    rgba8Scalar,
+    bgra8Scalar,
+    mono8Scalar,
+    yuv422Scalar,
+    bayerScalar
+};
+
+#ifdef IMAGE_KERNELS_X86
+
+/// Shuffles 4 packed 3 byte pixels into the low 3 bytes of 4 RGBA pixels
+#define RGB_SHUFFLE 0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1
+#define BGR_SHUFFLE 2,1,0,-1, 5,4,3,-1, 8,7,6,-1, 11,10,9,-1
+#define BGRA_SHUFFLE 2,1,0,-1, 6,5,4,-1, 10,9,8,-1, 14,13,12,-1
+
+__attribute__((target("ssse3")))
+inline __m128i alphaBits(uint8_t alpha)
+{
+    return _mm_set1_epi32(int(uint32_t(alpha)<<24));
+}
+
+/// 16 pixels of 3 bytes, without reading past the 48 bytes they take
+__attribute__((target("ssse3")))
+inline void threeByte16Ssse3(const uint8_t* src, __m128i shuffle, __m128i alpha, uint8_t* dst)
+{
+    __m128i p0 = _mm_loadu_si128((const __m128i*)(src));
+    __m128i p1 = _mm_loadu_si128((const __m128i*)(src+12));
+    __m128i p2 = _mm_loadu_si128((const __m128i*)(src+24));
+    __m128i p3 = _mm_srli_si128(_mm_loadu_si128((const __m128i*)(src+32)),4);
+    _mm_storeu_si128((__m128i*)(dst),_mm_or_si128(_mm_shuffle_epi8(p0,shuffle),alpha));
+    _mm_storeu_si128((__m128i*)(dst+16),_mm_or_si128(_mm_shuffle_epi8(p1,shuffle),alpha));
+    _mm_storeu_si128((__m128i*)(dst+32),_mm_or_si128(_mm_shuffle_epi8(p2,shuffle),alpha));
+    _mm_storeu_si128((__m128i*)(dst+48),_mm_or_si128(_mm_shuffle_epi8(p3,shuffle),alpha));
+}
+
+__attribute__((target("ssse3")))
+void rgb8Ssse3(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m128i shuffle = _mm_setr_epi8(RGB_SHUFFLE);
+    const __m128i alpha_bits = alphaBits(alpha);
+    size_t i = 0;
+    for(;i+16<=width;i+=16)
+    {
+        threeByte16Ssse3(src+3*i,shuffle,alpha_bits,dst+4*i);
+    }
+    rgb8Scalar(src+3*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("ssse3")))
+void bgr8Ssse3(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m128i shuffle = _mm_setr_epi8(BGR_SHUFFLE);
+    const __m128i alpha_bits = alphaBits(alpha);
+    size_t i = 0;
+    for(;i+16<=width;i+=16)
+    {
+        threeByte16Ssse3(src+3*i,shuffle,alpha_bits,dst+4*i);
+    }
+    bgr8Scalar(src+3*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("ssse3")))
+void rgba8Ssse3(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m128i color = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i alpha_bits = alphaBits(alpha);
+    size_t i = 0;
+    for(;i+4<=width;i+=4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src+4*i));
+        _mm_storeu_si128((__m128i*)(dst+4*i),_mm_or_si128(_mm_and_si128(p,color),alpha_bits));
+    }
+    rgba8Scalar(src+4*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("ssse3")))
+void bgra8Ssse3(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m128i shuffle = _mm_setr_epi8(BGRA_SHUFFLE);
+    const __m128i alpha_bits = alphaBits(alpha);
+    size_t i = 0;
+    for(;i+4<=width;i+=4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src+4*i));
+        _mm_storeu_si128((__m128i*)(dst+4*i),_mm_or_si128(_mm_shuffle_epi8(p,shuffle),alpha_bits));
+    }
+    bgra8Scalar(src+4*i,width-i,alpha,dst+4*i);
+}
+
+/// Spread 16 gray bytes into 16 RGBA pixels
+__attribute__((target("ssse3")))
+inline void gray16Ssse3(__m128i gray, __m128i alpha, uint8_t* dst)
+{
+    const __m128i s0 = _mm_setr_epi8(0,0,0,-1, 1,1,1,-1, 2,2,2,-1, 3,3,3,-1);
+    const __m128i s1 = _mm_setr_epi8(4,4,4,-1, 5,5,5,-1, 6,6,6,-1, 7,7,7,-1);
+    const __m128i s2 = _mm_setr_epi8(8,8,8,-1, 9,9,9,-1, 10,10,10,-1, 11,11,11,-1);
+    const __m128i s3 = _mm_setr_epi8(12,12,12,-1, 13,13,13,-1, 14,14,14,-1, 15,15,15,-1);
+    _mm_storeu_si128((__m128i*)(dst),_mm_or_si128(_mm_shuffle_epi8(gray,s0),alpha));
+    _mm_storeu_si128((__m128i*)(dst+16),_mm_or_si128(_mm_shuffle_epi8(gray,s1),alpha));
+    _mm_storeu_si128((__m128i*)(dst+32),_mm_or_si128(_mm_shuffle_epi8(gray,s2),alpha));
+    _mm_storeu_si128((__m128i*)(dst+48),_mm_or_si128(_mm_shuffle_epi8(gray,s3),alpha));
+}
+
+__attribute__((target("ssse3")))
+void mono8Ssse3(const uint8_t* src, size_t width, size_t stride, uint8_t alpha, uint8_t* dst)
+{
+    const __m128i alpha_bits = alphaBits(alpha);
+    size_t i = 0;
+    if(stride == 1)
+    {
+        for(;i+16<=width;i+=16)
+        {
+            gray16Ssse3(_mm_loadu_si128((const __m128i*)(src+i)),alpha_bits,dst+4*i);
+        }
+    }
+    else if(stride == 2)
+    {
+        // src may point at the second byte of each pixel, so stop a pixel early to stay inside the row
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        for(;i+16<width;i+=16)
+        {
+            __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src+2*i)),low);
+            __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src+2*i+16)),low);
+            gray16Ssse3(_mm_packus_epi16(a,b),alpha_bits,dst+4*i);
+        }
+    }
+    mono8Scalar(src+i*stride,width-i,stride,alpha,dst+4*i);
+}
+
+/// Interleave 8 bytes each of r,g,b,a (in the low half of each register) into 8 RGBA pixels
+__attribute__((target("ssse3")))
+inline void interleave8Ssse3(__m128i r, __m128i g, __m128i b, __m128i a, uint8_t* dst)
+{
+    __m128i rg = _mm_unpacklo_epi8(r,g);
+    __m128i ba = _mm_unpacklo_epi8(b,a);
+    _mm_storeu_si128((__m128i*)(dst),_mm_unpacklo_epi16(rg,ba));
+    _mm_storeu_si128((__m128i*)(dst+16),_mm_unpackhi_epi16(rg,ba));
+}
+
+__attribute__((target("ssse3")))
+void yuv422Ssse3(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m128i y_shuffle = _mm_setr_epi8(1,-1, 3,-1, 5,-1, 7,-1, 9,-1, 11,-1, 13,-1, 15,-1);
+    const __m128i u_shuffle = _mm_setr_epi8(0,-1, 0,-1, 4,-1, 4,-1, 8,-1, 8,-1, 12,-1, 12,-1);
+    const __m128i v_shuffle = _mm_setr_epi8(2,-1, 2,-1, 6,-1, 6,-1, 10,-1, 10,-1, 14,-1, 14,-1);
+    const __m128i offset = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi16(32);
+    const __m128i r_v = _mm_set1_epi16(YUV_R_V);
+    const __m128i g_u = _mm_set1_epi16(YUV_G_U);
+    const __m128i g_v = _mm_set1_epi16(YUV_G_V);
+    const __m128i b_u = _mm_set1_epi16(YUV_B_U);
+    const __m128i a = _mm_set1_epi8(char(alpha));
+    size_t i = 0;
+    for(;i+8<=width;i+=8)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src+2*i));
+        __m128i y = _mm_add_epi16(_mm_slli_epi16(_mm_shuffle_epi8(p,y_shuffle),6),round);
+        __m128i d = _mm_sub_epi16(_mm_shuffle_epi8(p,u_shuffle),offset);
+        __m128i e = _mm_sub_epi16(_mm_shuffle_epi8(p,v_shuffle),offset);
+        __m128i r = _mm_srai_epi16(_mm_add_epi16(y,_mm_mullo_epi16(e,r_v)),6);
+        __m128i g = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(y,_mm_mullo_epi16(d,g_u)),_mm_mullo_epi16(e,g_v)),6);
+        __m128i b = _mm_srai_epi16(_mm_add_epi16(y,_mm_mullo_epi16(d,b_u)),6);
+        interleave8Ssse3(_mm_packus_epi16(r,r),_mm_packus_epi16(g,g),_mm_packus_epi16(b,b),a,dst+4*i);
+    }
+    yuv422Scalar(src+2*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("ssse3")))
+void bayerSsse3(const uint8_t* src0, const uint8_t* src1, size_t width, int red, int blue,
+                uint8_t alpha, uint8_t* dst0, uint8_t* dst1)
+{
+    int green[2];
+    greenPositions(red,blue,green);
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    const __m128i a = _mm_set1_epi8(char(alpha));
+    size_t i = 0;
+    for(;i+16<=width;i+=16)
+    {
+        __m128i row0 = _mm_loadu_si128((const __m128i*)(src0+i));
+        __m128i row1 = _mm_loadu_si128((const __m128i*)(src1+i));
+        __m128i cell[4] = {
+            _mm_and_si128(row0,low),
+            _mm_srli_epi16(row0,8),
+            _mm_and_si128(row1,low),
+            _mm_srli_epi16(row1,8)
+        };
+        __m128i g = _mm_avg_epu16(cell[green[0]],cell[green[1]]);
+        __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(cell[red],cell[red]),_mm_packus_epi16(g,g));
+        __m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(cell[blue],cell[blue]),a);
+        __m128i lo = _mm_unpacklo_epi16(rg,ba);
+        __m128i hi = _mm_unpackhi_epi16(rg,ba);
+        __m128i q0 = _mm_unpacklo_epi32(lo,lo);
+        __m128i q1 = _mm_unpackhi_epi32(lo,lo);
+        __m128i q2 = _mm_unpacklo_epi32(hi,hi);
+        __m128i q3 = _mm_unpackhi_epi32(hi,hi);
+        _mm_storeu_si128((__m128i*)(dst0+4*i),q0);
+        _mm_storeu_si128((__m128i*)(dst0+4*i+16),q1);
+        _mm_storeu_si128((__m128i*)(dst0+4*i+32),q2);
+        _mm_storeu_si128((__m128i*)(dst0+4*i+48),q3);
+        _mm_storeu_si128((__m128i*)(dst1+4*i),q0);
+        _mm_storeu_si128((__m128i*)(dst1+4*i+16),q1);
+        _mm_storeu_si128((__m128i*)(dst1+4*i+32),q2);
+        _mm_storeu_si128((__m128i*)(dst1+4*i+48),q3);
+    }
+    bayerScalar(src0+i,src1+i,width-i,red,blue,alpha,dst0+4*i,dst1+4*i);
+}
+
+const ImageKernels ssse3_kernels = {
+    "ssse3",
+    rgb8Ssse3,
+    bgr8Ssse3,
+    rgba8Ssse3,
+    bgra8Ssse3,
+    mono8Ssse3,
+    yuv422Ssse3,
+    bayerSsse3
+};
+
+__attribute__((target("avx2")))
+inline __m256i alphaBits8(uint8_t alpha)
+{
+    return _mm256_set1_epi32(int(uint32_t(alpha)<<24));
+}
+
+/// Two 128 bit loads side by side, so the in-lane shuffle sees 4 pixels per lane
+__attribute__((target("avx2")))
+inline __m256i loadPair(__m128i lo, __m128i hi)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo),hi,1);
+}
+
+/// The converted frame is only read again by the texture upload, so rows that are 32 byte aligned,
+/// as cv::Mat rows of even width are, get streaming stores that do not pull the frame into the cache
+inline bool canStream(const uint8_t* dst)
+{
+    return (uintptr_t(dst)&31) == 0;
+}
+
+__attribute__((target("avx2")))
+inline void store8Avx2(uint8_t* dst, __m256i pixels, bool stream)
+{
+    if(stream){
+        _mm256_stream_si256((__m256i*)(dst),pixels);
+    }else{
+        _mm256_storeu_si256((__m256i*)(dst),pixels);
+    }
+}
+
+/// Streaming stores are weakly ordered, so they have to be fenced before another thread reads the row
+__attribute__((target("avx2")))
+inline void endStream(bool stream)
+{
+    if(stream){
+        _mm_sfence();
+    }
+}
+
+/// 16 pixels of 3 bytes, without reading past the 48 bytes they take
+__attribute__((target("avx2")))
+inline void threeByte16Avx2(const uint8_t* src, __m256i shuffle, __m256i alpha, uint8_t* dst, bool stream)
+{
+    __m256i p01 = loadPair(_mm_loadu_si128((const __m128i*)(src)),
+                           _mm_loadu_si128((const __m128i*)(src+12)));
+    __m256i p23 = loadPair(_mm_loadu_si128((const __m128i*)(src+24)),
+                           _mm_srli_si128(_mm_loadu_si128((const __m128i*)(src+32)),4));
+    store8Avx2(dst,_mm256_or_si256(_mm256_shuffle_epi8(p01,shuffle),alpha),stream);
+    store8Avx2(dst+32,_mm256_or_si256(_mm256_shuffle_epi8(p23,shuffle),alpha),stream);
+}
+
+__attribute__((target("avx2")))
+void rgb8Avx2(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m256i shuffle = _mm256_setr_epi8(RGB_SHUFFLE,RGB_SHUFFLE);
+    const __m256i alpha_bits = alphaBits8(alpha);
+    const bool stream = canStream(dst);
+    size_t i = 0;
+    for(;i+16<=width;i+=16)
+    {
+        threeByte16Avx2(src+3*i,shuffle,alpha_bits,dst+4*i,stream);
+    }
+    endStream(stream);
+    rgb8Scalar(src+3*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("avx2")))
+void bgr8Avx2(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m256i shuffle = _mm256_setr_epi8(BGR_SHUFFLE,BGR_SHUFFLE);
+    const __m256i alpha_bits = alphaBits8(alpha);
+    const bool stream = canStream(dst);
+    size_t i = 0;
+    for(;i+16<=width;i+=16)
+    {
+        threeByte16Avx2(src+3*i,shuffle,alpha_bits,dst+4*i,stream);
+    }
+    endStream(stream);
+    bgr8Scalar(src+3*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("avx2")))
+void rgba8Avx2(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m256i color = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i alpha_bits = alphaBits8(alpha);
+    const bool stream = canStream(dst);
+    size_t i = 0;
+    for(;i+8<=width;i+=8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src+4*i));
+        store8Avx2(dst+4*i,_mm256_or_si256(_mm256_and_si256(p,color),alpha_bits),stream);
+    }
+    endStream(stream);
+    rgba8Scalar(src+4*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("avx2")))
+void bgra8Avx2(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m256i shuffle = _mm256_setr_epi8(BGRA_SHUFFLE,BGRA_SHUFFLE);
+    const __m256i alpha_bits = alphaBits8(alpha);
+    const bool stream = canStream(dst);
+    size_t i = 0;
+    for(;i+8<=width;i+=8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src+4*i));
+        store8Avx2(dst+4*i,_mm256_or_si256(_mm256_shuffle_epi8(p,shuffle),alpha_bits),stream);
+    }
+    endStream(stream);
+    bgra8Scalar(src+4*i,width-i,alpha,dst+4*i);
+}
+
+/// Spread 8 gray bytes (in the low half of gray) into 8 RGBA pixels
+__attribute__((target("avx2")))
+inline __m256i gray8Avx2(__m128i gray, __m256i alpha)
+{
+    __m256i wide = _mm256_cvtepu8_epi32(gray);
+    __m256i rgb = _mm256_or_si256(wide,_mm256_or_si256(_mm256_slli_epi32(wide,8),_mm256_slli_epi32(wide,16)));
+    return _mm256_or_si256(rgb,alpha);
+}
+
+/// Strides other than 1 and 2 are left to the SSSE3 version
+__attribute__((target("avx2")))
+void mono8Avx2(const uint8_t* src, size_t width, size_t stride, uint8_t alpha, uint8_t* dst)
+{
+    if(stride != 1 && stride != 2){
+        mono8Ssse3(src,width,stride,alpha,dst);
+        return;
+    }
+    const __m256i alpha_bits = alphaBits8(alpha);
+    const bool stream = canStream(dst);
+    size_t i = 0;
+    if(stride == 1)
+    {
+        for(;i+8<=width;i+=8)
+        {
+            store8Avx2(dst+4*i,gray8Avx2(_mm_loadl_epi64((const __m128i*)(src+i)),alpha_bits),stream);
+        }
+    }
+    else
+    {
+        // src may point at the second byte of each pixel, so stop a pixel early to stay inside the row
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        for(;i+16<width;i+=16)
+        {
+            __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src+2*i)),low);
+            __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src+2*i+16)),low);
+            __m128i gray = _mm_packus_epi16(a,b);
+            store8Avx2(dst+4*i,gray8Avx2(gray,alpha_bits),stream);
+            store8Avx2(dst+4*i+32,gray8Avx2(_mm_srli_si128(gray,8),alpha_bits),stream);
+        }
+    }
+    endStream(stream);
+    mono8Scalar(src+i*stride,width-i,stride,alpha,dst+4*i);
+}
+
+/*!
+ * \brief Interleave 8 bytes each of r,g,b,a per lane into 16 RGBA pixels
+ *
+ * Each lane holds its 8 values in its low half, the first 8 pixels in the low lane.
+ */
+__attribute__((target("avx2")))
+inline void interleave16Avx2(__m256i r, __m256i g, __m256i b, __m256i a, uint8_t* dst, bool stream)
+{
+    __m256i rg = _mm256_unpacklo_epi8(r,g);
+    __m256i ba = _mm256_unpacklo_epi8(b,a);
+    __m256i lo = _mm256_unpacklo_epi16(rg,ba);
+    __m256i hi = _mm256_unpackhi_epi16(rg,ba);
+    store8Avx2(dst,_mm256_permute2x128_si256(lo,hi,0x20),stream);
+    store8Avx2(dst+32,_mm256_permute2x128_si256(lo,hi,0x31),stream);
+}
+
+__attribute__((target("avx2")))
+void yuv422Avx2(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst)
+{
+    const __m256i y_shuffle = _mm256_setr_epi8(1,-1, 3,-1, 5,-1, 7,-1, 9,-1, 11,-1, 13,-1, 15,-1,
+                                               1,-1, 3,-1, 5,-1, 7,-1, 9,-1, 11,-1, 13,-1, 15,-1);
+    const __m256i u_shuffle = _mm256_setr_epi8(0,-1, 0,-1, 4,-1, 4,-1, 8,-1, 8,-1, 12,-1, 12,-1,
+                                               0,-1, 0,-1, 4,-1, 4,-1, 8,-1, 8,-1, 12,-1, 12,-1);
+    const __m256i v_shuffle = _mm256_setr_epi8(2,-1, 2,-1, 6,-1, 6,-1, 10,-1, 10,-1, 14,-1, 14,-1,
+                                               2,-1, 2,-1, 6,-1, 6,-1, 10,-1, 10,-1, 14,-1, 14,-1);
+    const __m256i offset = _mm256_set1_epi16(128);
+    const __m256i round = _mm256_set1_epi16(32);
+    const __m256i r_v = _mm256_set1_epi16(YUV_R_V);
+    const __m256i g_u = _mm256_set1_epi16(YUV_G_U);
+    const __m256i g_v = _mm256_set1_epi16(YUV_G_V);
+    const __m256i b_u = _mm256_set1_epi16(YUV_B_U);
+    const __m256i a = _mm256_set1_epi8(char(alpha));
+    const bool stream = canStream(dst);
+    size_t i = 0;
+    for(;i+16<=width;i+=16)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src+2*i));
+        __m256i y = _mm256_add_epi16(_mm256_slli_epi16(_mm256_shuffle_epi8(p,y_shuffle),6),round);
+        __m256i d = _mm256_sub_epi16(_mm256_shuffle_epi8(p,u_shuffle),offset);
+        __m256i e = _mm256_sub_epi16(_mm256_shuffle_epi8(p,v_shuffle),offset);
+        __m256i r = _mm256_srai_epi16(_mm256_add_epi16(y,_mm256_mullo_epi16(e,r_v)),6);
+        __m256i g = _mm256_srai_epi16(_mm256_sub_epi16(_mm256_sub_epi16(y,_mm256_mullo_epi16(d,g_u)),
+                                                       _mm256_mullo_epi16(e,g_v)),6);
+        __m256i b = _mm256_srai_epi16(_mm256_add_epi16(y,_mm256_mullo_epi16(d,b_u)),6);
+        interleave16Avx2(_mm256_packus_epi16(r,r),_mm256_packus_epi16(g,g),_mm256_packus_epi16(b,b),a,
+                         dst+4*i,stream);
+    }
+    endStream(stream);
+    yuv422Scalar(src+2*i,width-i,alpha,dst+4*i);
+}
+
+__attribute__((target("avx2")))
+void bayerAvx2(const uint8_t* src0, const uint8_t* src1, size_t width, int red, int blue,
+               uint8_t alpha, uint8_t* dst0, uint8_t* dst1)
+{
+    int green[2];
+    greenPositions(red,blue,green);
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    const __m256i a = _mm256_set1_epi8(char(alpha));
+    const bool stream = canStream(dst0) && canStream(dst1);
+    size_t i = 0;
+    for(;i+32<=width;i+=32)
+    {
+        __m256i row0 = _mm256_loadu_si256((const __m256i*)(src0+i));
+        __m256i row1 = _mm256_loadu_si256((const __m256i*)(src1+i));
+        __m256i cell[4] = {
+            _mm256_and_si256(row0,low),
+            _mm256_srli_epi16(row0,8),
+            _mm256_and_si256(row1,low),
+            _mm256_srli_epi16(row1,8)
+        };
+        __m256i g = _mm256_avg_epu16(cell[green[0]],cell[green[1]]);
+        __m256i rg = _mm256_unpacklo_epi8(_mm256_packus_epi16(cell[red],cell[red]),_mm256_packus_epi16(g,g));
+        __m256i ba = _mm256_unpacklo_epi8(_mm256_packus_epi16(cell[blue],cell[blue]),a);
+        __m256i lo = _mm256_unpacklo_epi16(rg,ba);
+        __m256i hi = _mm256_unpackhi_epi16(rg,ba);
+        __m256i q0 = _mm256_unpacklo_epi32(lo,lo);
+        __m256i q1 = _mm256_unpackhi_epi32(lo,lo);
+        __m256i q2 = _mm256_unpacklo_epi32(hi,hi);
+        __m256i q3 = _mm256_unpackhi_epi32(hi,hi);
+        // Each lane did 8 cells, so the low lanes hold the first 16 pixels and the high lanes the next 16
+        __m256i out[4] = {
+            _mm256_permute2x128_si256(q0,q1,0x20),
+            _mm256_permute2x128_si256(q2,q3,0x20),
+            _mm256_permute2x128_si256(q0,q1,0x31),
+            _mm256_permute2x128_si256(q2,q3,0x31)
+        };
+        for(int k=0;k<4;k++)
+        {
+            store8Avx2(dst0+4*i+32*k,out[k],stream);
+            store8Avx2(dst1+4*i+32*k,out[k],stream);
+        }
+    }
+    endStream(stream);
+    bayerScalar(src0+i,src1+i,width-i,red,blue,alpha,dst0+4*i,dst1+4*i);
+}
+
+const ImageKernels avx2_kernels = {
+    "avx2",
+    rgb8Avx2,
+    bgr8Avx2,
+    rgba8Avx2,
+    bgra8Avx2,
+    mono8Avx2,
+    yuv422Avx2,
+    bayerAvx2
+};
+
+#endif
+
+const ImageKernels& selectImageKernels()
+{
+#ifdef IMAGE_KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        return avx2_kernels;
+    }
+    if(__builtin_cpu_supports("ssse3")){
+        return ssse3_kernels;
+    }
+#endif
+    return scalar_kernels;
+}
+
+}
+
+/*!
+ * \brief The fastest kernels this CPU supports, picked the first time this is called
+ */
+const ImageKernels& GetImageKernels()
+{
+    static const ImageKernels& kernels = selectImageKernels();
+    return kernels;
+}
+
+/*!
+ * \brief The plain C++ kernels, which every other table must match exactly
+ */
+const ImageKernels& GetScalarImageKernels()
+{
+    return scalar_kernels;
+}
+
+/*!
+ * \brief Every table this CPU can run, scalar first, so tests and benchmarks can compare them
+ */
+std::vector<const ImageKernels*> GetSupportedImageKernels()
+{
+    std::vector<const ImageKernels*> kernels(1,&scalar_kernels);
+#ifdef IMAGE_KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")){
+        kernels.push_back(&ssse3_kernels);
+    }
+    if(__builtin_cpu_supports("avx2")){
+        kernels.push_back(&avx2_kernels);
+    }
+#endif
+    return kernels;
+}
@@ -0,0 +1,54 @@
+#ifndef IMAGE_KERNELS_H
+#define	IMAGE_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*!
+ * \brief Table of the per-row pixel conversions used to turn sensor_msgs::Image data into RGBA8
+ *
+ * Every kernel converts one row of width pixels (or a pair of rows for Bayer images) and writes
+ * RGBA8 as laid out in memory, with the alpha byte set to alpha. The rows may be anywhere, so
+ * the caller can flip the image by simply handing them over bottom up.
+ *
+ * Like PointKernels, the SSSE3 and AVX2 versions produce exactly the same bytes as the scalar
+ * version, and GetImageKernels() picks the widest version the CPU supports at runtime.
+ */
+struct ImageKernels
+{
+    const char* name;
+
+    /// 3 bytes per pixel, in r,g,b order
+    void (*rgb8)(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst);
+
+    /// 3 bytes per pixel, in b,g,r order
+    void (*bgr8)(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst);
+
+    /// 4 bytes per pixel, in r,g,b,a order; the alpha of the source is replaced
+    void (*rgba8)(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst);
+
+    /// 4 bytes per pixel, in b,g,r,a order; the alpha of the source is replaced
+    void (*bgra8)(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst);
+
+    /// One gray byte per pixel, read every stride bytes; a stride of 2 reads one byte of mono16 pixels
+    void (*mono8)(const uint8_t* src, size_t width, size_t stride, uint8_t alpha, uint8_t* dst);
+
+    /// UYVY, 4 bytes per 2 pixels; full range BT.601 in 6 bit fixed point
+    void (*yuv422)(const uint8_t* src, size_t width, uint8_t alpha, uint8_t* dst);
+
+    /*!
+     * Two rows of a Bayer mosaic. Each 2x2 cell turns into 4 pixels of the same color, with green
+     * being the rounded up average of the two green samples. red and blue give the position of the
+     * red and blue sample in the cell (0 top left, 1 top right, 2 bottom left, 3 bottom right).
+     */
+    void (*bayer)(const uint8_t* src0, const uint8_t* src1, size_t width, int red, int blue,
+                  uint8_t alpha, uint8_t* dst0, uint8_t* dst1);
+};
+
+const ImageKernels& GetImageKernels();
+const ImageKernels& GetScalarImageKernels();
+std::vector<const ImageKernels*> GetSupportedImageKernels();
+
+
+#endif	/* IMAGE_KERNELS_H */
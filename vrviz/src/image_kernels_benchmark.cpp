@@ -0,0 +1,118 @@
+/*!
+ * \brief Times every row kernel of image_kernels.h on a side by side 2x1080p frame
+ *
+ * This is the frame size the overlay conversion is meant to handle in under 3 ms. With more than one
+ * thread, the frame is split into bands over a WorkerPool the way ImageConverter does it. Prints the
+ * best of a number of runs per kernel and table.
+ *
+ * Usage: image_kernels_benchmark [runs] [threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "image_kernels.h"
+#include "worker_pool.h"
+
+namespace
+{
+
+const size_t WIDTH = 2*1920;
+const size_t HEIGHT = 1080;
+const uint8_t ALPHA = 255;
+
+/// Same as in ImageConverter
+const size_t BANDS_PER_THREAD = 2;
+
+enum Encoding { RGB8, BGR8, RGBA8, BGRA8, MONO8, MONO16, YUV422, BAYER, NUM_ENCODINGS };
+const char* ENCODING_NAMES[NUM_ENCODINGS] = {"rgb8","bgr8","rgba8","bgra8","mono8","mono16","yuv422","bayer_rggb8"};
+const size_t PIXEL_BYTES[NUM_ENCODINGS] = {3,3,4,4,1,2,2,1};
+
+/// Convert rows begin to end of a frame bottom up, the way the overlay used to be flipped
+void convertRows(const ImageKernels& table, Encoding encoding, const uint8_t* src, uint8_t* dst,
+                 size_t begin, size_t end)
+{
+    const size_t step = WIDTH*PIXEL_BYTES[encoding];
+    const size_t dst_step = 4*WIDTH;
+    if(encoding==BAYER){
+        for(size_t y=begin;y<end;y+=2){
+            const uint8_t* row = src+(HEIGHT-2-y)*step;
+            table.bayer(row+step,row,WIDTH,0,3,ALPHA,dst+y*dst_step,dst+(y+1)*dst_step);
+        }
+        return;
+    }
+    for(size_t y=begin;y<end;y++)
+    {
+        const uint8_t* row = src+(HEIGHT-1-y)*step;
+        uint8_t* out = dst+y*dst_step;
+        switch(encoding)
+        {
+            case RGB8: table.rgb8(row,WIDTH,ALPHA,out); break;
+            case BGR8: table.bgr8(row,WIDTH,ALPHA,out); break;
+            case RGBA8: table.rgba8(row,WIDTH,ALPHA,out); break;
+            case BGRA8: table.bgra8(row,WIDTH,ALPHA,out); break;
+            case MONO8: table.mono8(row,WIDTH,1,ALPHA,out); break;
+            case MONO16: table.mono8(row+1,WIDTH,2,ALPHA,out); break;
+            case YUV422: table.yuv422(row,WIDTH,ALPHA,out); break;
+            default: break;
+        }
+    }
+}
+
+/// One band of the frame; Bayer bands are made of whole pairs of rows
+void convertBand(const ImageKernels& table, Encoding encoding, const uint8_t* src, uint8_t* dst,
+                 size_t num_bands, size_t band)
+{
+    const size_t rows_per_unit = encoding==BAYER ? 2 : 1;
+    const size_t units = HEIGHT/rows_per_unit;
+    const size_t band_size = (units+num_bands-1)/num_bands;
+    const size_t begin = std::min(band*band_size,units);
+    const size_t end = std::min(begin+band_size,units);
+    convertRows(table,encoding,src,dst,begin*rows_per_unit,end*rows_per_unit);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const int runs = argc>1 ? atoi(argv[1]) : 20;
+    const unsigned int threads = argc>2 ? std::max(atoi(argv[2]),1) : 1;
+    WorkerPool pool(threads-1);
+    const size_t num_bands = threads>1 ? pool.GetNumThreads()*BANDS_PER_THREAD : 1;
+    std::vector<uint8_t> src(WIDTH*HEIGHT*4), dst_buffer(WIDTH*HEIGHT*4+64);
+    for(size_t i=0;i<src.size();i++){
+        src[i] = uint8_t(i*2654435761u>>13);
+    }
+    /// Aligned like the data of a cv::Mat, which decides whether the AVX2 kernels stream their stores
+    uint8_t* dst = &dst_buffer[64-(uintptr_t(&dst_buffer[0])&63)];
+
+    std::vector<const ImageKernels*> tables = GetSupportedImageKernels();
+    printf("%zux%zu on %u threads, best of %d runs, ms per frame\n%-12s",WIDTH,HEIGHT,threads,runs,"");
+    for(size_t t=0;t<tables.size();t++){
+        printf("%10s",tables[t]->name);
+    }
+    printf("\n");
+    for(int e=0;e<NUM_ENCODINGS;e++)
+    {
+        printf("%-12s",ENCODING_NAMES[e]);
+        for(size_t t=0;t<tables.size();t++)
+        {
+            boost::function<void(size_t)> convert_band = [&](size_t band){
+                convertBand(*tables[t],Encoding(e),&src[0],dst,num_bands,band);
+            };
+            double best = 1e9;
+            for(int run=0;run<runs;run++)
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                pool.ParallelFor(num_bands,convert_band);
+                std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now()-start;
+                best = std::min(best,elapsed.count());
+            }
+            printf("%10.2f",best);
+        }
+        printf("\n");
+    }
+    return 0;
+}
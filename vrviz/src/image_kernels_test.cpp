@@ -0,0 +1,287 @@
+/*!
+ * \brief Checks the row kernels of image_kernels.h against golden pixels, and every SIMD table against the scalar one
+ *
+ * The golden rows are short patterns with hand worked RGBA results (primary colors through the BT.601
+ * math, every Bayer layout, both byte orders of mono16), repeated far enough to reach the vector loops.
+ * Random rows of every length up to a few vectors then have to come out of each table byte for byte
+ * the same as out of the scalar kernels. Returns non-zero if anything differs.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+#include "image_kernels.h"
+
+namespace
+{
+
+const uint8_t ALPHA = 200;
+
+/// Pattern repeats; 1 only runs the scalar tail, 37 gets well into the AVX2 loops
+const size_t REPEATS[] = {1, 2, 5, 37};
+
+int failures = 0;
+
+void check(bool ok, const char* kernel, const ImageKernels& table, size_t width, const char* detail="")
+{
+    if(!ok){
+        fprintf(stderr,"FAIL %s %s width=%zu %s\n",table.name,kernel,width,detail);
+        failures++;
+    }
+}
+
+std::vector<uint8_t> repeat(const uint8_t* pattern, size_t size, size_t times)
+{
+    std::vector<uint8_t> row;
+    for(size_t t=0;t<times;t++){
+        row.insert(row.end(),pattern,pattern+size);
+    }
+    return row;
+}
+
+/// Expected output of a pattern of RGB pixels, each given the test alpha
+std::vector<uint8_t> expectRgba(const uint8_t* rgb, size_t pixels, size_t times)
+{
+    std::vector<uint8_t> rgba;
+    for(size_t t=0;t<times;t++){
+        for(size_t i=0;i<pixels;i++){
+            rgba.push_back(rgb[3*i]);
+            rgba.push_back(rgb[3*i+1]);
+            rgba.push_back(rgb[3*i+2]);
+            rgba.push_back(ALPHA);
+        }
+    }
+    return rgba;
+}
+
+/// Five colors that every packed format below encodes in its own byte order
+const uint8_t COLORS[] = {
+    255,0,0,  0,255,0,  0,0,255,  12,34,56,  255,255,255
+};
+const size_t NUM_COLORS = sizeof(COLORS)/3;
+
+void goldenPacked(const ImageKernels& table)
+{
+    uint8_t rgb[3*NUM_COLORS], bgr[3*NUM_COLORS], rgba[4*NUM_COLORS], bgra[4*NUM_COLORS];
+    for(size_t i=0;i<NUM_COLORS;i++){
+        const uint8_t* c = COLORS+3*i;
+        const uint8_t px_rgb[3] = {c[0],c[1],c[2]};
+        const uint8_t px_bgr[3] = {c[2],c[1],c[0]};
+        /// The source alpha must never make it through
+        const uint8_t px_rgba[4] = {c[0],c[1],c[2],uint8_t(i*50)};
+        const uint8_t px_bgra[4] = {c[2],c[1],c[0],uint8_t(i*50)};
+        memcpy(rgb+3*i,px_rgb,3);
+        memcpy(bgr+3*i,px_bgr,3);
+        memcpy(rgba+4*i,px_rgba,4);
+        memcpy(bgra+4*i,px_bgra,4);
+    }
+    for(size_t r=0;r<sizeof(REPEATS)/sizeof(REPEATS[0]);r++)
+    {
+        const size_t width = NUM_COLORS*REPEATS[r];
+        const std::vector<uint8_t> expected = expectRgba(COLORS,NUM_COLORS,REPEATS[r]);
+        std::vector<uint8_t> src, dst(4*width);
+
+        src = repeat(rgb,sizeof(rgb),REPEATS[r]);
+        table.rgb8(&src[0],width,ALPHA,&dst[0]);
+        check(dst==expected,"rgb8 golden",table,width);
+
+        src = repeat(bgr,sizeof(bgr),REPEATS[r]);
+        table.bgr8(&src[0],width,ALPHA,&dst[0]);
+        check(dst==expected,"bgr8 golden",table,width);
+
+        src = repeat(rgba,sizeof(rgba),REPEATS[r]);
+        table.rgba8(&src[0],width,ALPHA,&dst[0]);
+        check(dst==expected,"rgba8 golden",table,width);
+
+        src = repeat(bgra,sizeof(bgra),REPEATS[r]);
+        table.bgra8(&src[0],width,ALPHA,&dst[0]);
+        check(dst==expected,"bgra8 golden",table,width);
+    }
+}
+
+void goldenMono(const ImageKernels& table)
+{
+    const uint8_t gray[] = {0, 1, 127, 128, 254, 255, 77};
+    /// mono16 is read one byte per pixel; the high byte sits first in big endian data
+    const uint8_t mono16_le[] = {0xff,0, 0x00,1, 0x80,127, 0x01,128, 0x7f,254, 0xff,255, 0x12,77};
+    const uint8_t mono16_be[] = {0,0xff, 1,0x00, 127,0x80, 128,0x01, 254,0x7f, 255,0xff, 77,0x12};
+    const size_t pixels = sizeof(gray);
+    uint8_t gray_rgb[3*sizeof(gray)];
+    for(size_t i=0;i<pixels;i++){
+        memset(gray_rgb+3*i,gray[i],3);
+    }
+    for(size_t r=0;r<sizeof(REPEATS)/sizeof(REPEATS[0]);r++)
+    {
+        const size_t width = pixels*REPEATS[r];
+        const std::vector<uint8_t> expected = expectRgba(gray_rgb,pixels,REPEATS[r]);
+        std::vector<uint8_t> src, dst(4*width);
+
+        src = repeat(gray,sizeof(gray),REPEATS[r]);
+        table.mono8(&src[0],width,1,ALPHA,&dst[0]);
+        check(dst==expected,"mono8 golden",table,width);
+
+        src = repeat(mono16_le,sizeof(mono16_le),REPEATS[r]);
+        table.mono8(&src[1],width,2,ALPHA,&dst[0]);
+        check(dst==expected,"mono16 little endian golden",table,width);
+
+        src = repeat(mono16_be,sizeof(mono16_be),REPEATS[r]);
+        table.mono8(&src[0],width,2,ALPHA,&dst[0]);
+        check(dst==expected,"mono16 big endian golden",table,width);
+    }
+}
+
+void goldenYuv(const ImageKernels& table)
+{
+    /// u, y0, v, y1, worked through the 6 bit BT.601 coefficients by hand
+    const uint8_t uyvy[] = {
+        85,76,255,76,     /// red
+        44,150,21,150,    /// green, with blue just above 0
+        255,29,107,29,    /// blue, with blue just below 255
+        128,255,128,0,    /// white, then black
+        0,128,0,128,      /// green clamped from both sides
+        255,200,255,200   /// magenta-ish, green not clamped
+    };
+    const uint8_t rgb[] = {
+        255,0,0,    255,0,0,
+        0,255,2,    0,255,2,
+        0,0,253,    0,0,253,
+        255,255,255, 0,0,0,
+        0,255,0,    0,255,0,
+        255,65,255, 255,65,255
+    };
+    const size_t pixels = sizeof(uyvy)/2;
+    for(size_t r=0;r<sizeof(REPEATS)/sizeof(REPEATS[0]);r++)
+    {
+        const size_t width = pixels*REPEATS[r];
+        const std::vector<uint8_t> src = repeat(uyvy,sizeof(uyvy),REPEATS[r]);
+        std::vector<uint8_t> dst(4*width);
+        table.yuv422(&src[0],width,ALPHA,&dst[0]);
+        check(dst==expectRgba(rgb,pixels,REPEATS[r]),"yuv422 golden",table,width);
+    }
+}
+
+void goldenBayer(const ImageKernels& table)
+{
+    /// Cells of 10, 20, 30, 41: wherever red and blue sit, the greens are the other two, rounded up
+    const uint8_t top[] = {10,20, 50,60, 0,255};
+    const uint8_t bottom[] = {30,41, 70,81, 255,0};
+    struct Layout { const char* name; int red, blue; };
+    const Layout layouts[] = {{"rggb",0,3}, {"bggr",3,0}, {"gbrg",2,1}, {"grbg",1,2}};
+    for(size_t l=0;l<sizeof(layouts)/sizeof(layouts[0]);l++)
+    {
+        const Layout& layout = layouts[l];
+        uint8_t rgb[3*3];
+        for(size_t c=0;c<3;c++){
+            const uint8_t cell[4] = {top[2*c],top[2*c+1],bottom[2*c],bottom[2*c+1]};
+            int green = 0;
+            for(int i=0;i<4;i++){
+                if(i!=layout.red && i!=layout.blue){
+                    green += cell[i];
+                }
+            }
+            rgb[3*c] = cell[layout.red];
+            rgb[3*c+1] = uint8_t((green+1)/2);
+            rgb[3*c+2] = cell[layout.blue];
+        }
+        /// Each cell color covers two pixels of both rows
+        uint8_t pixels[3*6];
+        for(size_t c=0;c<3;c++){
+            memcpy(pixels+6*c,rgb+3*c,3);
+            memcpy(pixels+6*c+3,rgb+3*c,3);
+        }
+        for(size_t r=0;r<sizeof(REPEATS)/sizeof(REPEATS[0]);r++)
+        {
+            const size_t width = 6*REPEATS[r];
+            const std::vector<uint8_t> src0 = repeat(top,sizeof(top),REPEATS[r]);
+            const std::vector<uint8_t> src1 = repeat(bottom,sizeof(bottom),REPEATS[r]);
+            std::vector<uint8_t> dst0(4*width), dst1(4*width);
+            table.bayer(&src0[0],&src1[0],width,layout.red,layout.blue,ALPHA,&dst0[0],&dst1[0]);
+            const std::vector<uint8_t> expected = expectRgba(pixels,6,REPEATS[r]);
+            check(dst0==expected && dst1==expected,"bayer golden",table,width,layout.name);
+        }
+    }
+}
+
+/*!
+ * Random rows, with the source at an odd address and the output surrounded by bytes that must stay untouched.
+ * The output starts 32 byte aligned or not, since the AVX2 kernels only use streaming stores on aligned rows.
+ */
+void compareAt(const ImageKernels& ref, const ImageKernels& test, std::mt19937& rng, size_t width, bool aligned)
+{
+    const size_t PAD = 64;
+    std::uniform_int_distribution<int> byte(0,255);
+    std::vector<uint8_t> src(2*4*width+2*PAD+1);
+    for(size_t i=0;i<src.size();i++){
+        src[i] = uint8_t(byte(rng));
+    }
+    const uint8_t* s0 = &src[1];
+    const uint8_t* s1 = &src[1+4*width+PAD];
+    std::vector<uint8_t> a0(4*width+2*PAD,0x5a), a1(a0), b0(a0), b1(a0);
+    const size_t at0 = PAD-(uintptr_t(&b0[PAD])&31)+(aligned ? 0 : 4);
+    const size_t at1 = PAD-(uintptr_t(&b1[PAD])&31)+(aligned ? 0 : 4);
+    const uint8_t alpha = uint8_t(byte(rng));
+
+#define COMPARE_ROW(kernel, ...) \
+    { \
+        a0.assign(a0.size(),0x5a); b0.assign(b0.size(),0x5a); \
+        ref.kernel(__VA_ARGS__,&a0[at0]); \
+        test.kernel(__VA_ARGS__,&b0[at0]); \
+        check(a0==b0,#kernel,test,width,aligned ? "aligned" : "unaligned"); \
+    }
+    COMPARE_ROW(rgb8,s0,width,alpha)
+    COMPARE_ROW(bgr8,s0,width,alpha)
+    COMPARE_ROW(rgba8,s0,width,alpha)
+    COMPARE_ROW(bgra8,s0,width,alpha)
+    COMPARE_ROW(mono8,s0,width,1,alpha)
+    COMPARE_ROW(mono8,s0,width,2,alpha)
+    COMPARE_ROW(mono8,s0+1,width,2,alpha)
+    if(width%2==0){
+        COMPARE_ROW(yuv422,s0,width,alpha)
+    }
+#undef COMPARE_ROW
+
+    if(width%2!=0){
+        return;
+    }
+    for(int layout=0;layout<4;layout++)
+    {
+        static const int red[] = {0,3,2,1};
+        static const int blue[] = {3,0,1,2};
+        a0.assign(a0.size(),0x5a); a1.assign(a1.size(),0x5a);
+        b0.assign(b0.size(),0x5a); b1.assign(b1.size(),0x5a);
+        ref.bayer(s0,s1,width,red[layout],blue[layout],alpha,&a0[at0],&a1[at1]);
+        test.bayer(s0,s1,width,red[layout],blue[layout],alpha,&b0[at0],&b1[at1]);
+        check(a0==b0 && a1==b1,"bayer",test,width,aligned ? "aligned" : "unaligned");
+    }
+}
+
+void compare(const ImageKernels& ref, const ImageKernels& test, std::mt19937& rng, size_t width)
+{
+    compareAt(ref,test,rng,width,true);
+    compareAt(ref,test,rng,width,false);
+}
+
+}
+
+int main()
+{
+    std::vector<const ImageKernels*> tables = GetSupportedImageKernels();
+    const ImageKernels& ref = GetScalarImageKernels();
+    for(size_t t=0;t<tables.size();t++)
+    {
+        const int before = failures;
+        goldenPacked(*tables[t]);
+        goldenMono(*tables[t]);
+        goldenYuv(*tables[t]);
+        goldenBayer(*tables[t]);
+        std::mt19937 rng(1234);
+        for(int round=0;round<4;round++){
+            for(size_t width=0;width<=130;width++){
+                compare(ref,*tables[t],rng,width);
+            }
+            compare(ref,*tables[t],rng,1920);
+        }
+        printf("%s: %s\n",tables[t]->name,failures>before ? "FAILED" : "matches golden and scalar");
+    }
+    return failures ? 1 : 0;
+}
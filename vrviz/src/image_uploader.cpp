@@ -0,0 +1,349 @@
+#include <algorithm>
+#include "image_uploader.h"
+#include "gl_stats.h"
+
+ImageUploader::ImageUploader()
+    : mipmaps(false)
+    , m_writing(-1)
+    , m_shown(-1)
+    , m_requested(0)
+    , m_maxAnisotropy(-1.0f)
+{
+    for(int ii=0;ii<SLOTS;ii++){
+        Slot& slot = m_slots[ii];
+        slot.pbo = 0;
+        slot.texture = 0;
+        slot.capacity = 0;
+        slot.mapped = NULL;
+        slot.state = SLOT_IDLE;
+        slot.fence = 0;
+        slot.width = 0;
+        slot.height = 0;
+        slot.step = 0;
+        slot.texture_width = 0;
+        slot.texture_height = 0;
+        slot.texture_format = 0;
+    }
+}
+
+/// \note GL objects are only freed by Release(), since there may be no context left by the time this runs
+ImageUploader::~ImageUploader()
+{
+}
+
+/*!
+ * \brief Whether BeginWrite() would find a buffer right now. Called from the ROS thread.
+ *
+ * Lets a producer that can only learn the size of an image by doing work on it (like decoding it)
+ * skip the image up front. It does not reserve anything, so BeginWrite() may still return NULL.
+ */
+bool ImageUploader::CanWrite()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if(m_writing>=0){
+        return false;
+    }
+    for(int ii=0;ii<SLOTS;ii++){
+        if(m_slots[ii].state==SLOT_WRITABLE){
+            return true;
+        }
+    }
+    /// Nothing is mapped yet before the first image, so let that one through to request a size
+    return m_requested==0;
+}
+
+/*!
+ * \brief Claim a mapped buffer to write the next image into. Called from the ROS thread.
+ *
+ * \param bytes Size of the image, from its first row to the end of its last row
+ * \return Where to write the image, or NULL if no buffer is free or big enough yet. EndWrite() has to follow a non-NULL return.
+ */
+uint8_t* ImageUploader::BeginWrite(size_t bytes)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stats.received++;
+    /// Remember the size, so the render thread maps a big enough buffer for the next image
+    m_requested = bytes;
+    if(m_writing<0){
+        for(int ii=0;ii<SLOTS;ii++){
+            Slot& slot = m_slots[ii];
+            if(slot.state==SLOT_WRITABLE && slot.capacity>=bytes){
+                slot.state = SLOT_WRITING;
+                m_writing = ii;
+                return slot.mapped;
+            }
+        }
+    }
+    m_stats.dropped++;
+    return NULL;
+}
+
+/*!
+ * \brief Hand the image written after BeginWrite() to the render thread. Called from the ROS thread.
+ *
+ * \param written False if writing the image failed, in which case the buffer is simply given back
+ * \param upload Format of the data
+ * \param width
+ * \param height
+ * \param step Bytes from one row to the next
+ * \param stamp When the image was taken, for the latency in the stats. May be zero if unknown.
+ */
+void ImageUploader::EndWrite(bool written, const ImageUploadFormat& upload, int width, int height, size_t step, const ros::Time& stamp)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if(m_writing<0){
+        return;
+    }
+    Slot& slot = m_slots[m_writing];
+    m_writing = -1;
+    m_writeDone.notify_all();
+    if(!written){
+        m_stats.dropped++;
+        slot.state = SLOT_WRITABLE;
+        return;
+    }
+    m_stats.converted++;
+    slot.upload = upload;
+    slot.width = width;
+    slot.height = height;
+    slot.step = step;
+    slot.stamp = stamp;
+    slot.state = SLOT_FILLED;
+}
+
+/// Count an image that the producer dropped without calling BeginWrite(), e.g. after CanWrite() said no
+void ImageUploader::Drop()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stats.received++;
+    m_stats.dropped++;
+}
+
+/// The counts so far, and the latencies since the last call. Called from the ROS thread.
+ImageUploadStats ImageUploader::TakeStats()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    ImageUploadStats stats = m_stats;
+    m_stats.latency_count = 0;
+    m_stats.latency_sum = 0.0;
+    m_stats.latency_max = 0.0;
+    return stats;
+}
+
+/*!
+ * \brief Move the slots along. Called every frame from the render thread.
+ *
+ * Finished uploads are shown, filled buffers are uploaded, and free buffers are mapped for the
+ * ROS thread. None of this waits on the GPU.
+ *
+ * \return true if GetTexture() has a new image to show
+ */
+bool ImageUploader::Update()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    bool shown_changed = false;
+
+    for(int ii=0;ii<SLOTS;ii++){
+        Slot& slot = m_slots[ii];
+        if(slot.state!=SLOT_UPLOADING){
+            continue;
+        }
+        GLenum result = glClientWaitSync(slot.fence,GL_SYNC_FLUSH_COMMANDS_BIT,0);
+        if(result==GL_ALREADY_SIGNALED || result==GL_CONDITION_SATISFIED || result==GL_WAIT_FAILED){
+            glDeleteSync(slot.fence);
+            slot.fence = 0;
+            if(m_shown>=0){
+                /// The old texture is off the overlay now, so its slot can take the next image
+                m_slots[m_shown].state = SLOT_IDLE;
+            }
+            slot.state = SLOT_SHOWN;
+            m_shown = ii;
+            shown_changed = true;
+            m_stats.displayed++;
+            if(!slot.stamp.isZero()){
+                const double latency = (ros::Time::now()-slot.stamp).toSec();
+                m_stats.latency_count++;
+                m_stats.latency_sum += latency;
+                m_stats.latency_max = std::max(m_stats.latency_max,latency);
+            }
+        }
+    }
+
+    for(int ii=0;ii<SLOTS;ii++){
+        Slot& slot = m_slots[ii];
+        if(slot.state==SLOT_FILLED){
+            StartUpload(slot);
+        }
+        if(slot.state==SLOT_WRITABLE && slot.capacity<m_requested){
+            /// The images got bigger, so this mapping is no use anymore
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            slot.mapped = NULL;
+            slot.state = SLOT_IDLE;
+        }
+        if(slot.state==SLOT_IDLE && m_requested>0){
+            if(MapSlot(slot)){
+                slot.state = SLOT_WRITABLE;
+            }
+        }
+    }
+    return shown_changed;
+}
+
+/// Unmap a filled buffer and start copying it into the texture of its slot
+void ImageUploader::StartUpload(Slot& slot)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+    GLboolean intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    slot.mapped = NULL;
+    if(!intact){
+        /// The contents were lost (e.g. on a mode switch), so drop this image
+        m_stats.dropped++;
+        slot.state = SLOT_IDLE;
+        return;
+    }
+
+    const ImageUploadFormat& upload = slot.upload;
+    if(slot.texture==0 || slot.texture_width!=slot.width || slot.texture_height!=slot.height || slot.texture_format!=upload.internal_format){
+        AllocateTexture(slot);
+    }
+    glBindTexture(GL_TEXTURE_2D, slot.texture);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, slot.step/upload.pixel_bytes);
+    glPixelStorei(GL_UNPACK_SWAP_BYTES, upload.swap_bytes);
+    /// With the unpack buffer bound this only queues a copy from it, and returns right away
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, slot.width, slot.height, upload.format, upload.type, 0);
+    glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if(mipmaps){
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+    slot.state = SLOT_UPLOADING;
+}
+
+/*!
+ * \brief Give a slot texture storage for the size and format of its image
+ *
+ * With GL_ARB_texture_storage the storage is immutable, so a new size means a new texture. Either way
+ * this only happens when the camera changes resolution or encoding, and all of the texture state is set
+ * here rather than on every upload.
+ */
+void ImageUploader::AllocateTexture(Slot& slot)
+{
+    const ImageUploadFormat& upload = slot.upload;
+    const bool immutable = GLEW_ARB_texture_storage || GLEW_VERSION_4_2;
+    if(slot.texture!=0 && immutable){
+        glDeleteTextures(1, &slot.texture);
+        slot.texture = 0;
+        gl_object_counts.textures--;
+    }
+    if(slot.texture==0){
+        glGenTextures(1, &slot.texture);
+        gl_object_counts.textures++;
+    }
+    glBindTexture(GL_TEXTURE_2D, slot.texture);
+
+    GLsizei levels = 1;
+    if(mipmaps){
+        for(int size=std::max(slot.width,slot.height);size>1;size/=2){
+            levels++;
+        }
+    }
+    if(immutable){
+        glTexStorage2D(GL_TEXTURE_2D, levels, upload.internal_format, slot.width, slot.height);
+    }else{
+        /// Allocate without data; the unpack buffer is not bound here, so NULL really means no data
+        glTexImage2D(GL_TEXTURE_2D, 0, upload.internal_format, slot.width, slot.height, 0, upload.format, upload.type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels-1);
+    }
+    slot.texture_width = slot.width;
+    slot.texture_height = slot.height;
+    slot.texture_format = upload.internal_format;
+
+    /// Gray images keep a single channel on the GPU, and the alpha of the source is ignored like the converter does
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, upload.gray ? GL_RED : GL_GREEN);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, upload.gray ? GL_RED : GL_BLUE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+
+    if(mipmaps){
+        if(m_maxAnisotropy<0.0f){
+            glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &m_maxAnisotropy );
+        }
+        glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, m_maxAnisotropy );
+    }
+}
+
+/// Map the buffer of a slot for writing, growing it to the last requested size first if needed
+bool ImageUploader::MapSlot(Slot& slot)
+{
+    if(slot.pbo==0){
+        glGenBuffers(1, &slot.pbo);
+        gl_object_counts.buffers++;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+    if(slot.capacity<m_requested){
+        slot.capacity = m_requested;
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.capacity, NULL, GL_STREAM_DRAW);
+    }
+    /// The old contents were uploaded long ago, so let the driver hand out fresh storage instead of waiting
+    slot.mapped = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot.capacity,
+                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return slot.mapped!=NULL;
+}
+
+/// Free the buffers, textures and fences. Needs the GL context.
+void ImageUploader::Release()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    /// The ROS thread may still be writing into a mapping
+    while(m_writing>=0){
+        m_writeDone.wait(lock);
+    }
+    for(int ii=0;ii<SLOTS;ii++){
+        Slot& slot = m_slots[ii];
+        if(slot.fence){
+            glDeleteSync(slot.fence);
+            slot.fence = 0;
+        }
+        if(slot.mapped){
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            slot.mapped = NULL;
+        }
+        if(slot.pbo){
+            glDeleteBuffers(1, &slot.pbo);
+            gl_object_counts.buffers--;
+            slot.pbo = 0;
+        }
+        if(slot.texture){
+            glDeleteTextures(1, &slot.texture);
+            gl_object_counts.textures--;
+            slot.texture = 0;
+        }
+        slot.capacity = 0;
+        slot.texture_width = 0;
+        slot.texture_height = 0;
+        slot.texture_format = 0;
+        slot.state = SLOT_IDLE;
+    }
+    m_writing = -1;
+    m_shown = -1;
+    m_requested = 0;
+}
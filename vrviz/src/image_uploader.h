@@ -0,0 +1,126 @@
+#ifndef IMAGE_UPLOADER_H
+#define	IMAGE_UPLOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GL/glew.h>
+#include <ros/time.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/// How an image is handed to glTexSubImage2D
+struct ImageUploadFormat
+{
+    GLenum internal_format;
+    GLenum format;
+    GLenum type;
+    size_t pixel_bytes;
+    bool gray;///!< Single channel, spread over r,g,b by the texture swizzle
+    bool swap_bytes;///!< 16 bit data in the other byte order
+};
+
+/*!
+ * \brief Where the images of a stream went, for the diagnostics
+ *
+ * Every image is counted as received, and then either as dropped or converted. Converted images are
+ * counted as displayed once their upload has finished, or as dropped in the rare case the driver lost
+ * the buffer contents.
+ */
+struct ImageUploadStats
+{
+    ImageUploadStats()
+        : received(0), converted(0), dropped(0), displayed(0)
+        , latency_count(0), latency_sum(0.0), latency_max(0.0) {}
+    long long received;
+    long long converted;
+    long long dropped;
+    long long displayed;
+    /// Seconds from the stamp of an image to it being shown, since the last TakeStats()
+    int latency_count;
+    double latency_sum;
+    double latency_max;
+};
+
+/*!
+ * \brief Streams images from a ROS thread into the overlay texture through pixel unpack buffers
+ *
+ * There are two slots, each a PBO with its own texture. The render thread maps the PBO of a free
+ * slot, and the ROS thread writes the next image straight into that mapping between BeginWrite()
+ * and EndWrite(). On the next Update() the render thread unmaps it and starts the copy into the
+ * texture, which the driver can do asynchronously since the data is already in a buffer object.
+ * A fence placed after the copy is polled on the following frames, and only once it has passed
+ * does GetTexture() switch to the new texture, so the frame never waits on the upload and the
+ * compositor never sees a half written texture.
+ *
+ * The texture that is being shown is not written again until the other slot has replaced it.
+ * If the ROS thread has an image while no slot is free, BeginWrite() returns NULL and the image
+ * is dropped before any work is done on it. CanWrite() allows the same check even earlier, before
+ * the size of the image is known.
+ */
+class ImageUploader
+{
+public:
+    ImageUploader();
+    ~ImageUploader();
+
+    bool CanWrite();
+    uint8_t* BeginWrite(size_t bytes);
+    void EndWrite(bool written, const ImageUploadFormat& upload, int width, int height, size_t step, const ros::Time& stamp);
+    void Drop();
+
+    bool Update();
+    void Release();
+
+    ImageUploadStats TakeStats();
+
+    /// Texture holding the newest completely uploaded image, or 0 if there is none yet
+    GLuint GetTexture() const { return m_shown>=0 ? m_slots[m_shown].texture : 0; }
+
+    static const int SLOTS = 2;
+
+    bool mipmaps;///!< Build mipmaps after each upload. Off by default, since the overlay is rarely minified much
+
+private:
+    enum SlotState {
+        SLOT_IDLE,      ///!< Not mapped, waiting for the render thread
+        SLOT_WRITABLE,  ///!< Mapped, the ROS thread may claim it
+        SLOT_WRITING,   ///!< The ROS thread is writing the mapping
+        SLOT_FILLED,    ///!< Holds a complete image, waiting for the render thread to upload it
+        SLOT_UPLOADING, ///!< The copy into the texture has been issued, fence not passed yet
+        SLOT_SHOWN      ///!< The texture is the one on the overlay
+    };
+
+    struct Slot
+    {
+        GLuint pbo;
+        GLuint texture;
+        size_t capacity;///!< Bytes allocated for pbo
+        uint8_t* mapped;
+        SlotState state;
+        GLsync fence;
+        ImageUploadFormat upload;
+        int width;
+        int height;
+        size_t step;
+        ros::Time stamp;
+        int texture_width;
+        int texture_height;
+        GLenum texture_format;
+    };
+
+    void StartUpload(Slot& slot);
+    void AllocateTexture(Slot& slot);
+    bool MapSlot(Slot& slot);
+
+    boost::mutex m_mutex;///!< Protects the slot states, m_requested and m_stats
+    boost::condition_variable m_writeDone;///!< Lets Release() wait for a write that is still going on
+    Slot m_slots[SLOTS];
+    int m_writing;///!< Slot owned by the ROS thread, or -1
+    int m_shown;///!< Slot on the overlay, or -1
+    size_t m_requested;///!< Size of the last image BeginWrite() was asked for
+    GLfloat m_maxAnisotropy;///!< Queried the first time it is needed
+    ImageUploadStats m_stats;
+};
+
+
+#endif	/* IMAGE_UPLOADER_H */
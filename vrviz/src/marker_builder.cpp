@@ -0,0 +1,138 @@
+#include <utility>
+#include "marker_builder.h"
+
+/*!
+ * \param worker_pool Shared with the point cloud and image conversion, or NULL
+ * \param upload_budget Bytes of geometry that Upload() sends to the GPU per call
+ */
+MarkerBuilder::MarkerBuilder(WorkerPool* worker_pool, size_t upload_budget)
+    : m_workerPool(worker_pool)
+    , m_uploadBudget(upload_budget)
+    , m_nextTicket(0)
+    , m_stop(false)
+{
+    m_thread = new boost::thread(boost::bind(&MarkerBuilder::BuildLoop,this));
+}
+
+/// Geometry that was not uploaded yet is thrown away
+MarkerBuilder::~MarkerBuilder()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    m_thread->join();
+    delete m_thread;
+}
+
+/*!
+ * \brief Queue the marker of a mesh for building. Any geometry of the mesh that is still on its way is dropped.
+ *
+ * Called with the marker registry locked, since the marker is copied.
+ */
+void MarkerBuilder::Submit(Mesh* mesh, float scaling_factor)
+{
+    /// Copying is the only work per point left on the render thread, so it is done before locking the workers out
+    Job job;
+    job.mesh = mesh;
+    job.scaling_factor = scaling_factor;
+    job.marker = mesh->marker;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        job.ticket = m_nextTicket++;
+        m_newest[mesh] = job.ticket;
+        m_jobs.push_back(std::move(job));
+    }
+    m_condition.notify_one();
+}
+
+/// Drop the geometry of a mesh that is on its way, because the mesh is deleted or set up some other way
+void MarkerBuilder::Forget(Mesh* mesh)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_newest.erase(mesh);
+}
+
+/*!
+ * \brief Send built geometry to the GPU, oldest first, until the budget is used up. Needs the GL context.
+ *
+ * \return Bytes uploaded
+ */
+size_t MarkerBuilder::Upload()
+{
+    size_t uploaded = 0;
+    while(uploaded<m_uploadBudget)
+    {
+        Built built;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            /// Skip geometry that was replaced or forgotten while it was built
+            while(!m_built.empty() && !IsNewest(m_built.front().mesh,m_built.front().ticket)){
+                m_built.pop_front();
+            }
+            if(m_built.empty()){
+                break;
+            }
+            built = std::move(m_built.front());
+            m_built.pop_front();
+            m_newest.erase(built.mesh);
+        }
+        /// Only the render thread deletes meshes, and it forgets them first, so this one is still there
+        built.mesh->UploadMarker(built.geometry);
+        uploaded += built.geometry.Bytes();
+    }
+    return uploaded;
+}
+
+/// Called with m_mutex locked
+bool MarkerBuilder::IsNewest(Mesh* mesh, uint64_t ticket) const
+{
+    std::unordered_map<Mesh*,uint64_t>::const_iterator it = m_newest.find(mesh);
+    return it!=m_newest.end() && it->second==ticket;
+}
+
+void MarkerBuilder::BuildLoop()
+{
+    while(true)
+    {
+        std::vector<Job> jobs;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while(!m_stop && m_jobs.empty()){
+                m_condition.wait(lock);
+            }
+            if(m_stop){
+                return;
+            }
+            /// Markers that changed again before we got to them are only built in their newest state
+            for(size_t ii=0;ii<m_jobs.size();ii++){
+                if(IsNewest(m_jobs[ii].mesh,m_jobs[ii].ticket)){
+                    jobs.push_back(std::move(m_jobs[ii]));
+                }
+            }
+            m_jobs.clear();
+        }
+
+        std::vector<Built> built(jobs.size());
+        boost::function<void(size_t)> build = [&](size_t ii){
+            built[ii].mesh = jobs[ii].mesh;
+            built[ii].ticket = jobs[ii].ticket;
+            Mesh::BuildMarker(jobs[ii].marker,jobs[ii].scaling_factor,built[ii].geometry);
+        };
+        if(m_workerPool){
+            m_workerPool->ParallelFor(jobs.size(),build);
+        }else{
+            for(size_t ii=0;ii<jobs.size();ii++){
+                build(ii);
+            }
+        }
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        for(size_t ii=0;ii<built.size();ii++){
+            if(IsNewest(built[ii].mesh,built[ii].ticket)){
+                m_built.push_back(std::move(built[ii]));
+            }
+        }
+    }
+}
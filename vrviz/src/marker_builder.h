@@ -0,0 +1,71 @@
+#ifndef MARKER_BUILDER_H
+#define	MARKER_BUILDER_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "mesh.h"
+#include "worker_pool.h"
+
+/*!
+ * \brief Builds the geometry of markers on worker threads, and uploads it on the render thread within a budget
+ *
+ * Tessellating a big LINE_LIST or TRIANGLE_LIST, or filling the instances of a CUBE_LIST, used to happen
+ * in Mesh::InitMarker() on the render thread, inside the frame. Submit() now only copies the marker. The
+ * build thread takes everything submitted so far as one batch, and runs Mesh::BuildMarker() on the copies
+ * in parallel on the worker pool. Upload() sends finished geometry to the GPU, in the order
+ * it finished, until a byte budget for the frame is used up. The rest waits for the next frame, so a burst
+ * of changes is spread over several frames, and a mesh keeps its old geometry until the new one is uploaded.
+ *
+ * Workers never touch a Mesh. Every submission gets a ticket, and geometry is only uploaded if its ticket
+ * is still the newest one of its mesh. A marker that changes again before its geometry is built is only
+ * built once more, and Forget() makes sure nothing is uploaded to a mesh that is about to be deleted.
+ *
+ * Submit(), Upload() and Forget() are for the render thread.
+ */
+class MarkerBuilder
+{
+public:
+    MarkerBuilder(WorkerPool* worker_pool, size_t upload_budget);
+    ~MarkerBuilder();
+
+    void Submit(Mesh* mesh, float scaling_factor);
+    void Forget(Mesh* mesh);
+    size_t Upload();
+
+private:
+    struct Job
+    {
+        Mesh* mesh;
+        uint64_t ticket;
+        float scaling_factor;
+        visualization_msgs::Marker marker;
+    };
+    struct Built
+    {
+        Mesh* mesh;
+        uint64_t ticket;
+        MarkerGeometry geometry;
+    };
+
+    void BuildLoop();
+    bool IsNewest(Mesh* mesh, uint64_t ticket) const;
+
+    WorkerPool* m_workerPool;///!< NULL builds every batch on the build thread alone
+    size_t m_uploadBudget;///!< Bytes per frame; at least one marker is uploaded regardless
+    boost::thread* m_thread;
+    boost::mutex m_mutex;///!< Protects everything below
+    boost::condition_variable m_condition;
+    std::deque<Job> m_jobs;
+    std::deque<Built> m_built;
+    std::unordered_map<Mesh*,uint64_t> m_newest;///!< Newest ticket of every mesh that has geometry on its way
+    uint64_t m_nextTicket;
+    bool m_stop;
+};
+
+
+#endif	/* MARKER_BUILDER_H */
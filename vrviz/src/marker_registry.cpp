@@ -0,0 +1,145 @@
+#include "marker_registry.h"
+
+/// Combine the id into the string hash, the way boost::hash_combine does
+size_t MarkerRegistry::KeyHash::operator()(const Key& key) const
+{
+    size_t seed = std::hash<std::string>()(key.ns);
+    seed ^= std::hash<int>()(key.id) + 0x9e3779b9 + (seed<<6) + (seed>>2);
+    return seed;
+}
+
+MarkerRegistry::MarkerRegistry()
+    : m_freeSlot(INVALID_MARKER_HANDLE)
+{
+}
+
+/// \note The meshes are not deleted here, since their GL objects can only be freed on the render thread
+MarkerRegistry::~MarkerRegistry()
+{
+}
+
+/*!
+ * \brief Look up a marker
+ *
+ * \return Its handle, or INVALID_MARKER_HANDLE if it is not in the registry
+ */
+MarkerHandle MarkerRegistry::Find(const std::string& ns, int id) const
+{
+    Key key;
+    key.ns = ns;
+    key.id = id;
+    std::unordered_map<Key,MarkerHandle,KeyHash>::const_iterator it = m_index.find(key);
+    if(it==m_index.end()){
+        return INVALID_MARKER_HANDLE;
+    }
+    return it->second;
+}
+
+/*!
+ * \brief Add the mesh of a marker that is not in the registry yet
+ *
+ * \return Handle of the marker, or the existing one if (ns, id) is already there, in which case mesh is not added
+ */
+MarkerHandle MarkerRegistry::Add(const std::string& ns, int id, Mesh* mesh)
+{
+    Key key;
+    key.ns = ns;
+    key.id = id;
+    std::pair<std::unordered_map<Key,MarkerHandle,KeyHash>::iterator,bool> inserted = m_index.insert(std::make_pair(key,INVALID_MARKER_HANDLE));
+    if(!inserted.second){
+        return inserted.first->second;
+    }
+
+    MarkerHandle handle = m_freeSlot;
+    if(handle!=INVALID_MARKER_HANDLE){
+        m_freeSlot = m_slots[handle].next_free;
+    }else{
+        handle = m_slots.size();
+        m_slots.push_back(Slot());
+    }
+    m_slots[handle].dense = m_meshes.size();
+    m_slots[handle].next_free = INVALID_MARKER_HANDLE;
+    inserted.first->second = handle;
+
+    m_meshes.push_back(mesh);
+    m_handles.push_back(handle);
+    m_keys.push_back(key);
+    m_expiry.push_back(0.0);
+    return handle;
+}
+
+/*!
+ * \brief Take a marker out of the registry. Its handle is invalid afterwards.
+ *
+ * \return The mesh of the marker, which the caller now owns
+ */
+Mesh* MarkerRegistry::Remove(MarkerHandle handle)
+{
+    const uint32_t dense = m_slots[handle].dense;
+    Mesh* mesh = m_meshes[dense];
+    m_index.erase(m_keys[dense]);
+
+    /// Move the last marker into the hole, so the arrays stay dense
+    const uint32_t last = m_meshes.size()-1;
+    if(dense!=last){
+        m_meshes[dense] = m_meshes[last];
+        m_handles[dense] = m_handles[last];
+        m_keys[dense].ns.swap(m_keys[last].ns);
+        m_keys[dense].id = m_keys[last].id;
+        m_expiry[dense] = m_expiry[last];
+        m_slots[m_handles[dense]].dense = dense;
+    }
+    m_meshes.pop_back();
+    m_handles.pop_back();
+    m_keys.pop_back();
+    m_expiry.pop_back();
+
+    m_slots[handle].next_free = m_freeSlot;
+    m_freeSlot = handle;
+    return mesh;
+}
+
+/// Remove a marker, and keep its mesh for the render thread to free
+void MarkerRegistry::Retire(MarkerHandle handle)
+{
+    m_retired.push_back(Remove(handle));
+}
+
+/// Retire every marker, for Marker::DELETEALL
+void MarkerRegistry::RetireAll()
+{
+    m_retired.insert(m_retired.end(),m_meshes.begin(),m_meshes.end());
+    m_index.clear();
+    m_slots.clear();
+    m_freeSlot = INVALID_MARKER_HANDLE;
+    m_meshes.clear();
+    m_handles.clear();
+    m_keys.clear();
+    m_expiry.clear();
+}
+
+/*!
+ * \brief Retire the markers whose lifetime has run out
+ *
+ * \param now Current time in seconds
+ * \return How many markers expired
+ */
+size_t MarkerRegistry::Expire(double now)
+{
+    size_t expired = 0;
+    /// Going backwards, the marker that Remove() moves into a hole has been checked already
+    for(size_t ii=m_meshes.size();ii-->0;){
+        if(m_expiry[ii]>0.0 && m_expiry[ii]<=now){
+            Retire(m_handles[ii]);
+            expired++;
+        }
+    }
+    return expired;
+}
+
+/// Hand the retired meshes to the render thread, which now owns them
+void MarkerRegistry::TakeRetired(std::vector<Mesh*>& meshes)
+{
+    meshes.insert(meshes.end(),m_retired.begin(),m_retired.end());
+    m_retired.clear();
+}
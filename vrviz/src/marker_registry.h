@@ -0,0 +1,92 @@
+#ifndef MARKER_REGISTRY_H
+#define	MARKER_REGISTRY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/thread/mutex.hpp>
+
+/// The registry only stores and hands back meshes, it never looks inside them
+class Mesh;
+
+/// Identifies a marker in the registry for as long as it is there, even when others are removed
+typedef uint32_t MarkerHandle;
+const MarkerHandle INVALID_MARKER_HANDLE = 0xFFFFFFFF;
+
+/*!
+ * \brief The meshes of all visualization markers, looked up by their (namespace, id)
+ *
+ * Markers used to share robot_meshes with the robot links, and every marker of every MarkerArray was
+ * found by a linear scan comparing ids and namespace strings. Here the lookup is a hash map, and the
+ * meshes themselves are kept in a dense array, so the render thread can still walk them in one go.
+ *
+ * Removing a marker moves the last one into its place, so the position of a mesh in GetMeshes() can
+ * change. Handles go through an indirection table and stay valid until their own marker is removed;
+ * freed handles are reused.
+ *
+ * Deleted and expired markers are retired rather than freed, since their GL objects belong to the
+ * render thread. It picks them up with TakeRetired().
+ *
+ * The registry itself is not thread safe. The ROS thread changes it and the render thread walks it,
+ * both holding GetMutex().
+ */
+class MarkerRegistry
+{
+public:
+    MarkerRegistry();
+    ~MarkerRegistry();
+
+    MarkerHandle Find(const std::string& ns, int id) const;
+    MarkerHandle Add(const std::string& ns, int id, Mesh* mesh);
+    Mesh* Remove(MarkerHandle handle);
+
+    void Retire(MarkerHandle handle);
+    void RetireAll();
+    size_t Expire(double now);
+    void TakeRetired(std::vector<Mesh*>& meshes);
+
+    /// When a marker expires, in seconds like Expire() gets them, or 0 to keep it until it is deleted
+    void SetExpiry(MarkerHandle handle, double expiry) { m_expiry[m_slots[handle].dense] = expiry; }
+
+    /// The mesh of a handle that Find() or Add() returned
+    Mesh* Get(MarkerHandle handle) const { return m_meshes[m_slots[handle].dense]; }
+
+    /// All meshes, in no particular order
+    const std::vector<Mesh*>& GetMeshes() const { return m_meshes; }
+    size_t Size() const { return m_meshes.size(); }
+
+    boost::mutex& GetMutex() { return m_mutex; }
+
+private:
+    struct Key
+    {
+        std::string ns;
+        int id;
+        bool operator==(const Key& other) const { return id==other.id && ns==other.ns; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+    /// Where a handle points in the dense arrays, or the next free handle if it is not in use
+    struct Slot
+    {
+        uint32_t dense;
+        MarkerHandle next_free;
+    };
+
+    std::unordered_map<Key,MarkerHandle,KeyHash> m_index;
+    std::vector<Slot> m_slots;
+    MarkerHandle m_freeSlot;///!< Head of the list of unused handles
+    /// Dense arrays, all the same size: the meshes, and the handle and key of each
+    std::vector<Mesh*> m_meshes;
+    std::vector<MarkerHandle> m_handles;
+    std::vector<Key> m_keys;
+    std::vector<double> m_expiry;
+    std::vector<Mesh*> m_retired;///!< Removed, but not freed by the render thread yet
+    boost::mutex m_mutex;
+};
+
+
+#endif	/* MARKER_REGISTRY_H */
@@ -0,0 +1,144 @@
+/*!
+ * \brief Times the marker registry for 100 to 100k markers, against the linear scan it replaced
+ *
+ * For each marker count, a MarkerArray with that many markers in a handful of namespaces is applied the
+ * way update_marker() does it: the first time every marker is added, after that every one is looked up.
+ * Then a quarter of them are deleted and added again, and the rest expire. The old lookup compared
+ * the id and namespace of every mesh until it found a match, which is timed on a sample of the markers
+ * only, since it is quadratic. Prints nanoseconds per marker.
+ *
+ * Usage: marker_registry_benchmark [repeats]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "marker_registry.h"
+
+namespace
+{
+
+const size_t COUNTS[] = {100, 1000, 10000, 100000};
+const char* NAMESPACES[] = {"markers", "robot/footprint", "planner/path", "objects", "labels"};
+const size_t NUM_NAMESPACES = sizeof(NAMESPACES)/sizeof(NAMESPACES[0]);
+
+/// How many markers the old linear scan looks up per marker count, since all of them would take minutes at 100k
+const size_t LINEAR_SAMPLES = 1000;
+
+struct MarkerKey
+{
+    std::string ns;
+    int id;
+};
+
+/// The registry never dereferences its meshes, so any distinct pointer will do
+Mesh* fakeMesh(size_t ii)
+{
+    return reinterpret_cast<Mesh*>(uintptr_t(ii+1)*16);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double nanosPer(Clock::time_point start, size_t count)
+{
+    std::chrono::duration<double,std::nano> elapsed = Clock::now()-start;
+    return count ? elapsed.count()/count : 0.0;
+}
+
+/// Keep the compiler from dropping lookups whose results are otherwise unused
+volatile size_t sink;
+
+}
+
+int main(int argc, char** argv)
+{
+    const int repeats = argc>1 ? atoi(argv[1]) : 5;
+    printf("ns per marker, best of %d\n",repeats);
+    printf("%8s %10s %10s %10s %10s %14s\n","markers","add","lookup","re-add","expire","linear lookup");
+    for(size_t c=0;c<sizeof(COUNTS)/sizeof(COUNTS[0]);c++)
+    {
+        const size_t count = COUNTS[c];
+        std::vector<MarkerKey> keys(count);
+        for(size_t ii=0;ii<count;ii++){
+            keys[ii].ns = NAMESPACES[ii%NUM_NAMESPACES];
+            keys[ii].id = int(ii/NUM_NAMESPACES);
+        }
+        /// Looked up in a different order than they were added; 7919 is prime, so every marker comes up once
+        std::vector<size_t> order(count);
+        for(size_t ii=0;ii<count;ii++){
+            order[ii] = (ii*7919)%count;
+        }
+
+        double best_add = 1e30, best_lookup = 1e30, best_readd = 1e30, best_expire = 1e30, best_linear = 1e30;
+        for(int run=0;run<repeats;run++)
+        {
+            MarkerRegistry registry;
+            std::vector<Mesh*> retired;
+
+            Clock::time_point start = Clock::now();
+            for(size_t ii=0;ii<count;ii++){
+                const MarkerKey& key = keys[order[ii]];
+                if(registry.Find(key.ns,key.id)==INVALID_MARKER_HANDLE){
+                    registry.SetExpiry(registry.Add(key.ns,key.id,fakeMesh(order[ii])),1.0);
+                }
+            }
+            best_add = std::min(best_add,nanosPer(start,count));
+
+            start = Clock::now();
+            size_t found = 0;
+            for(size_t ii=0;ii<count;ii++){
+                const MarkerKey& key = keys[order[ii]];
+                MarkerHandle handle = registry.Find(key.ns,key.id);
+                if(handle!=INVALID_MARKER_HANDLE){
+                    registry.SetExpiry(handle,1.0);
+                    found++;
+                }
+            }
+            sink = found;
+            best_lookup = std::min(best_lookup,nanosPer(start,count));
+
+            start = Clock::now();
+            for(size_t ii=0;ii<count;ii+=4){
+                const MarkerKey& key = keys[order[ii]];
+                registry.Retire(registry.Find(key.ns,key.id));
+            }
+            for(size_t ii=0;ii<count;ii+=4){
+                const MarkerKey& key = keys[order[ii]];
+                registry.SetExpiry(registry.Add(key.ns,key.id,fakeMesh(order[ii])),2.0);
+            }
+            registry.TakeRetired(retired);
+            best_readd = std::min(best_readd,nanosPer(start,(count+3)/4));
+
+            start = Clock::now();
+            sink = registry.Expire(1.5);
+            registry.TakeRetired(retired);
+            best_expire = std::min(best_expire,nanosPer(start,count));
+
+            if(registry.Size()!=(count+3)/4){
+                fprintf(stderr,"%zu markers should be left, not %zu\n",(count+3)/4,registry.Size());
+                return 1;
+            }
+
+            /// The old lookup: walk every mesh, comparing the id first and the namespace string after
+            const size_t samples = std::min(count,LINEAR_SAMPLES);
+            start = Clock::now();
+            found = 0;
+            for(size_t ii=0;ii<samples;ii++){
+                const MarkerKey& key = keys[order[ii*count/samples]];
+                for(size_t jj=0;jj<count;jj++){
+                    if(keys[jj].id==key.id && keys[jj].ns==key.ns){
+                        found++;
+                        break;
+                    }
+                }
+            }
+            sink = found;
+            best_linear = std::min(best_linear,nanosPer(start,samples));
+        }
+        printf("%8zu %10.1f %10.1f %10.1f %10.1f %14.1f\n",count,best_add,best_lookup,best_readd,best_expire,best_linear);
+    }
+    return 0;
+}
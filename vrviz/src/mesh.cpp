@@ -18,41 +18,261 @@
 
 
 
+#include <algorithm>
 #include "mesh.h"
+#include "gl_stats.h"
 #include <tf/transform_broadcaster.h>
 
+namespace
+{
+
+/// The VAO and buffers of a mesh entry that is no longer used
+struct PooledObjects
+{
+    GLuint VA;
+    GLuint VB;
+    GLuint IB;
+};
+
+/// Objects of deleted markers, handed to new ones instead of making more. Only used by the render thread.
+std::vector<PooledObjects> object_pool;
+
+/// Beyond this the objects are deleted, so a burst of deletions doesn't hold on to them for ever
+const size_t MAX_POOLED_OBJECTS = 1024;
+
+/// Geometry shared by all markers of one shape, colored white. Cubes and spheres span -1 to 1, cylinders have
+/// radius 1 and run from z=-1 to 1, and arrows have radius 1 and run from x=0 to 1.
+struct UnitPrimitive
+{
+    GLuint VA;
+    GLuint VB;
+    GLuint IB;
+    unsigned int NumIndices;
+};
+
+enum PrimitiveShape {
+    PRIMITIVE_CUBE,
+    PRIMITIVE_SPHERE,
+    PRIMITIVE_CYLINDER,
+    PRIMITIVE_ARROW,
+    NUM_PRIMITIVE_SHAPES
+};
+
+/// Levels of detail of the round shapes, from coarse to fine. Cubes only have the first.
+const int NUM_PRIMITIVE_LODS = 3;
+const int SPHERE_LATITUDES[NUM_PRIMITIVE_LODS] = {4, 8, 16};
+const int ROUND_FACETS[NUM_PRIMITIVE_LODS] = {8, 16, 32};
+/// VR meters; shapes whose largest half extent is above these get the next finer level
+const float LOD_SIZES[NUM_PRIMITIVE_LODS-1] = {0.05f, 0.5f};
+
+/// Built by Mesh::InitPrimitiveLibrary(). Only used by the render thread.
+UnitPrimitive primitive_library[NUM_PRIMITIVE_SHAPES][NUM_PRIMITIVE_LODS] = {};
+bool primitive_library_built = false;
+
+void createUnitPrimitive(UnitPrimitive& primitive, const std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                         const std::vector<u_int32_t>& Indices)
+{
+    glGenVertexArrays( 1, &primitive.VA );
+    glBindVertexArray( primitive.VA );
+
+    glGenBuffers( 1, &primitive.VB );
+    glBindBuffer( GL_ARRAY_BUFFER, primitive.VB );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( vr::RenderModel_Vertex_t_rgb ) * Vertices.size(), &Vertices[0], GL_STATIC_DRAW );
+
+    glEnableVertexAttribArray( 0 );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vPosition ) );
+    glEnableVertexAttribArray( 1 );
+    glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vNormal ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vColor ) );
+
+    glGenBuffers( 1, &primitive.IB );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, primitive.IB );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( u_int32_t ) * Indices.size(), &Indices[0], GL_STATIC_DRAW );
+
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+    primitive.NumIndices = Indices.size();
+    gl_object_counts.vertex_arrays++;
+    gl_object_counts.buffers+=2;
+}
+
+/// The level of detail for a round shape of this size
+int primitiveLod(const Vector3& radius)
+{
+    const float size = std::max(std::max(std::fabs(radius.x),std::fabs(radius.y)),std::fabs(radius.z));
+    int lod = 0;
+    while(lod<NUM_PRIMITIVE_LODS-1 && size>LOD_SIZES[lod]){
+        lod++;
+    }
+    return lod;
+}
+
+/// Keep the shader from dividing normals by zero for flat shapes
+float nonZero(float value)
+{
+    return std::fabs(value)<1e-6f ? 1e-6f : value;
+}
+
+}
+
 Mesh::MeshEntry::MeshEntry()
 {
     VB = INVALID_OGL_VALUE;
+    VA = INVALID_OGL_VALUE;
     IB = INVALID_OGL_VALUE;
     NumIndices  = 0;
     MaterialIndex = INVALID_MATERIAL;
+    InstanceBuffer = INVALID_OGL_VALUE;
+    NumInstances = 0;
+    Shared = false;
 };
 
 Mesh::MeshEntry::~MeshEntry()
 {
+    Release();
+}
+
+/// Free the GL objects, so the entry can be initialized again without leaking them
+void Mesh::MeshEntry::Release()
+{
+    if (Shared)
+    {
+        /// Everything belongs to the primitive library
+        VA = INVALID_OGL_VALUE;
+        VB = INVALID_OGL_VALUE;
+        IB = INVALID_OGL_VALUE;
+        NumIndices = 0;
+        Shared = false;
+        return;
+    }
+
+    if (InstanceBuffer != INVALID_OGL_VALUE)
+    {
+        glDeleteBuffers(1, &InstanceBuffer);
+        gl_object_counts.buffers--;
+        InstanceBuffer = INVALID_OGL_VALUE;
+        /// The primitive buffers are shared, so only forget them
+        VB = INVALID_OGL_VALUE;
+        IB = INVALID_OGL_VALUE;
+        NumInstances = 0;
+    }
+
+    if (VA != INVALID_OGL_VALUE)
+    {
+        glDeleteVertexArrays(1, &VA);
+        gl_object_counts.vertex_arrays--;
+        VA = INVALID_OGL_VALUE;
+    }
+
     if (VB != INVALID_OGL_VALUE)
     {
         glDeleteBuffers(1, &VB);
+        gl_object_counts.buffers--;
+        VB = INVALID_OGL_VALUE;
     }
 
     if (IB != INVALID_OGL_VALUE)
     {
         glDeleteBuffers(1, &IB);
+        gl_object_counts.buffers--;
+        IB = INVALID_OGL_VALUE;
+    }
+    NumIndices = 0;
+}
+
+/// Give the GL objects to the pool for the next entry that is initialized, rather than deleting them
+void Mesh::MeshEntry::Recycle()
+{
+    if (VA != INVALID_OGL_VALUE && InstanceBuffer == INVALID_OGL_VALUE && !Shared && object_pool.size() < MAX_POOLED_OBJECTS)
+    {
+        PooledObjects objects;
+        objects.VA = VA;
+        objects.VB = VB;
+        objects.IB = IB;
+        object_pool.push_back(objects);
+        VA = INVALID_OGL_VALUE;
+        VB = INVALID_OGL_VALUE;
+        IB = INVALID_OGL_VALUE;
+    }
+    Release();
+}
+
+/// Delete the pooled objects and the primitive library. Needs the GL context.
+void Mesh::MeshEntry::ReleasePool()
+{
+    for (int shape = 0 ; shape < NUM_PRIMITIVE_SHAPES ; shape++)
+    {
+        for (int lod = 0 ; lod < NUM_PRIMITIVE_LODS ; lod++)
+        {
+            UnitPrimitive& primitive = primitive_library[shape][lod];
+            if (primitive.NumIndices > 0)
+            {
+                glDeleteVertexArrays(1, &primitive.VA);
+                glDeleteBuffers(1, &primitive.VB);
+                glDeleteBuffers(1, &primitive.IB);
+                gl_object_counts.vertex_arrays--;
+                gl_object_counts.buffers-=2;
+                primitive.NumIndices = 0;
+            }
+        }
     }
+    primitive_library_built = false;
+    for (size_t i = 0 ; i < object_pool.size() ; i++)
+    {
+        glDeleteVertexArrays(1, &object_pool[i].VA);
+        glDeleteBuffers(1, &object_pool[i].VB);
+        glDeleteBuffers(1, &object_pool[i].IB);
+        gl_object_counts.vertex_arrays--;
+        gl_object_counts.buffers-=2;
+    }
+    object_pool.clear();
+}
+
+/*!
+ * \brief Get a VAO and buffers for Init
+ *
+ * An entry that is initialized again keeps its own, since glBufferData replaces the contents anyway.
+ * Otherwise they come from the pool, and only if that is empty are new ones made.
+ */
+void Mesh::MeshEntry::Acquire()
+{
+    if (InstanceBuffer != INVALID_OGL_VALUE || Shared)
+    {
+        /// It was instanced or a library primitive before, and shares its buffers
+        Release();
+    }
+    if (VA != INVALID_OGL_VALUE)
+    {
+        return;
+    }
+    if (!object_pool.empty())
+    {
+        VA = object_pool.back().VA;
+        VB = object_pool.back().VB;
+        IB = object_pool.back().IB;
+        object_pool.pop_back();
+        return;
+    }
+    glGenVertexArrays( 1, &VA );
+    glGenBuffers( 1, &VB );
+    glGenBuffers( 1, &IB );
+    gl_object_counts.vertex_arrays++;
+    gl_object_counts.buffers+=2;
 }
 
 void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t>& Vertices,
                           const std::vector<u_int32_t>& Indices)
 {
+    /// Markers are re-initialized whenever they change, so their objects are reused
+    Acquire();
     NumIndices = Indices.size();
 
-    // create and bind a VAO to hold state for this model
-    glGenVertexArrays( 1, &VA );
+    // bind a VAO to hold state for this model
     glBindVertexArray( VA );
 
     // Populate a vertex buffer
-    glGenBuffers( 1, &VB );
     glBindBuffer( GL_ARRAY_BUFFER, VB );
     glBufferData( GL_ARRAY_BUFFER, sizeof( vr::RenderModel_Vertex_t ) * Vertices.size(), &Vertices[0], GL_STATIC_DRAW );
 
@@ -64,8 +284,7 @@ void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t>& Vertices
     glEnableVertexAttribArray( 2 );
     glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t ), (void *)offsetof( vr::RenderModel_Vertex_t, rfTextureCoord ) );
 
-    // Create and populate the index buffer
-    glGenBuffers( 1, &IB );
+    // Populate the index buffer
     glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, IB );
     glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( u_int32_t ) * NumIndices, &Indices[0], GL_STATIC_DRAW );
 
@@ -77,14 +296,14 @@ void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t>& Vertices
 void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
                           const std::vector<u_int32_t>& Indices)
 {
+    /// Markers are re-initialized whenever they change, so their objects are reused
+    Acquire();
     NumIndices = Indices.size();
 
-    // create and bind a VAO to hold state for this model
-    glGenVertexArrays( 1, &VA );
+    // bind a VAO to hold state for this model
     glBindVertexArray( VA );
 
     // Populate a vertex buffer
-    glGenBuffers( 1, &VB );
     glBindBuffer( GL_ARRAY_BUFFER, VB );
     glBufferData( GL_ARRAY_BUFFER, sizeof( vr::RenderModel_Vertex_t_rgb ) * Vertices.size(), &Vertices[0], GL_STATIC_DRAW );
 
@@ -96,8 +315,7 @@ void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t_rgb>& Vert
     glEnableVertexAttribArray( 2 );
     glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vColor ) );
 
-    // Create and populate the index buffer
-    glGenBuffers( 1, &IB );
+    // Populate the index buffer
     glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, IB );
     glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( u_int32_t ) * NumIndices, &Indices[0], GL_STATIC_DRAW );
 
@@ -106,9 +324,123 @@ void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t_rgb>& Vert
 }
 
 
+/*!
+ * \brief Draw a unit primitive once for every instance
+ *
+ * The VAO reads the shared primitive buffers per vertex, and the instance buffer per instance, so
+ * changing the instances only rewrites 28 bytes each.
+ */
+void Mesh::MeshEntry::InitInstanced(GLuint PrimitiveVB, GLuint PrimitiveIB, unsigned int PrimitiveIndices,
+                                    const std::vector<MarkerInstance>& Instances)
+{
+    if (VA != INVALID_OGL_VALUE && InstanceBuffer == INVALID_OGL_VALUE)
+    {
+        /// It had geometry of its own, or a library primitive, before
+        Release();
+    }
+    if (VA == INVALID_OGL_VALUE)
+    {
+        glGenVertexArrays( 1, &VA );
+        glGenBuffers( 1, &InstanceBuffer );
+        gl_object_counts.vertex_arrays++;
+        gl_object_counts.buffers++;
+    }
+    VB = PrimitiveVB;
+    IB = PrimitiveIB;
+    NumIndices = PrimitiveIndices;
+    NumInstances = Instances.size();
+
+    glBindVertexArray( VA );
+
+    glBindBuffer( GL_ARRAY_BUFFER, VB );
+    glEnableVertexAttribArray( 0 );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vPosition ) );
+    glEnableVertexAttribArray( 1 );
+    glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vNormal ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vColor ) );
+
+    // Replace the instances, letting the driver orphan the old storage if it is still being drawn
+    glBindBuffer( GL_ARRAY_BUFFER, InstanceBuffer );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( MarkerInstance ) * Instances.size(), Instances.empty() ? NULL : &Instances[0], GL_DYNAMIC_DRAW );
+    glEnableVertexAttribArray( 3 );
+    glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof( MarkerInstance ), (void *)offsetof( MarkerInstance, position ) );
+    glVertexAttribDivisor( 3, 1 );
+    glEnableVertexAttribArray( 4 );
+    glVertexAttribPointer( 4, 3, GL_FLOAT, GL_FALSE, sizeof( MarkerInstance ), (void *)offsetof( MarkerInstance, scale ) );
+    glVertexAttribDivisor( 4, 1 );
+    glEnableVertexAttribArray( 5 );
+    glVertexAttribPointer( 5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof( MarkerInstance ), (void *)offsetof( MarkerInstance, color ) );
+    glVertexAttribDivisor( 5, 1 );
+
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, IB );
+
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+
+/*!
+ * \brief Draw a primitive of the library as it is, the shader applying the pose, scale and color of the marker
+ *
+ * Nothing is created or uploaded, so a marker that only moved costs a matrix write.
+ */
+void Mesh::MeshEntry::InitPrimitive(GLuint PrimitiveVA, GLuint PrimitiveVB, GLuint PrimitiveIB, unsigned int PrimitiveIndices)
+{
+    if (!Shared)
+    {
+        Release();
+    }
+    VA = PrimitiveVA;
+    VB = PrimitiveVB;
+    IB = PrimitiveIB;
+    NumIndices = PrimitiveIndices;
+    Shared = true;
+}
+
+
+/*!
+ * \brief Tessellate every shape of the primitive library and upload it once. Needs the GL context.
+ *
+ * Called at startup, and again by markers after ReleasePool() has freed the library.
+ */
+void Mesh::InitPrimitiveLibrary()
+{
+    if(primitive_library_built){
+        return;
+    }
+    const Vector3 white(1,1,1);
+    Matrix4 ident;
+    for(int lod=0;lod<NUM_PRIMITIVE_LODS;lod++){
+        std::vector<vr::RenderModel_Vertex_t_rgb> Vertices;
+        std::vector<u_int32_t> Indices;
+        if(lod==0){
+            InitCube(Vertices,Indices,Vector3(1,1,1),white,ident);
+            createUnitPrimitive(primitive_library[PRIMITIVE_CUBE][lod],Vertices,Indices);
+            Vertices.clear();
+            Indices.clear();
+        }
+        InitSphere(Vertices,Indices,1.0,white,Vector4(0,0,0,1),SPHERE_LATITUDES[lod]);
+        createUnitPrimitive(primitive_library[PRIMITIVE_SPHERE][lod],Vertices,Indices);
+        Vertices.clear();
+        Indices.clear();
+        InitCylinder(Vertices,Indices,ident,1.0,2.0,white,ROUND_FACETS[lod]);
+        createUnitPrimitive(primitive_library[PRIMITIVE_CYLINDER][lod],Vertices,Indices);
+        Vertices.clear();
+        Indices.clear();
+        InitArrow(Vertices,Indices,ident,1.0,1.0,1.0,white,ROUND_FACETS[lod]);
+        createUnitPrimitive(primitive_library[PRIMITIVE_ARROW][lod],Vertices,Indices);
+    }
+    primitive_library_built = true;
+}
+
+
 Mesh::Mesh()
 {
     trans=Matrix4().identity();
+    model=Matrix4().identity();
+    model_scale=Vector3(1,1,1);
+    model_color=Vector4(1,1,1,1);
     scale.x=1.0;
     scale.y=1.0;
     scale.z=1.0;
@@ -123,6 +455,15 @@ Mesh::~Mesh()
 }
 
 
+/// Recycle the GL objects of every entry, before the mesh is deleted on the render thread
+void Mesh::Recycle()
+{
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        m_Entries[i].Recycle();
+    }
+}
+
+
 void Mesh::Clear()
 {
     for (unsigned int i = 0 ; i < m_Textures.size() ; i++) {
@@ -274,8 +615,71 @@ void Mesh::InitMarker(float scaling_factor)
 {
     m_Entries.resize(1);
     m_Entries[0].MaterialIndex=NO_TEXTURE;
-    std::vector<vr::RenderModel_Vertex_t_rgb> Vertices;
-    std::vector<u_int32_t> Indices;
+    model.identity();
+    model_scale=Vector3(1,1,1);
+    model_color=Vector4(1,1,1,1);
+    if(marker.type==visualization_msgs::Marker::ARROW ||
+       marker.type==visualization_msgs::Marker::CUBE ||
+       marker.type==visualization_msgs::Marker::SPHERE ||
+       marker.type==visualization_msgs::Marker::CYLINDER){
+        InitShape(scaling_factor);
+        initialized=true;
+        needs_update=false;
+        return;
+    }
+    if(marker.type==visualization_msgs::Marker::MESH_RESOURCE){
+        /// This is a separate if, since we don't want to call Init for meshes, we want to call LoadMesh
+        /// \todo load_mesh and initialized are probably redundant, so they could probably be simplified.
+        /// \warning the mesh is only loaded once, so if the pose/orientation of a MESH_RESOURCE changes this won't detect that.
+        if(load_mesh){
+            if(LoadMesh(filename)){
+                initialized=true;
+                needs_update=false;
+            }else{
+                initialized=false;
+            }
+            /// I don't know why it would succeed on further attempts, so don't keep trying?
+            load_mesh=false;
+        }
+        return;
+    }
+    /// Everything else is built on the CPU, here rather than on a worker
+    MarkerGeometry geometry;
+    BuildMarker(marker,scaling_factor,geometry);
+    UploadMarker(geometry);
+    needs_update=false;
+}
+
+/// Whether the geometry of a marker of this type is built on the CPU by BuildMarker(), and could take a while
+bool Mesh::BuildsOnCpu(int32_t marker_type)
+{
+    return marker_type==visualization_msgs::Marker::LINE_STRIP ||
+           marker_type==visualization_msgs::Marker::LINE_LIST ||
+           marker_type==visualization_msgs::Marker::TRIANGLE_LIST ||
+           marker_type==visualization_msgs::Marker::CUBE_LIST ||
+           marker_type==visualization_msgs::Marker::SPHERE_LIST ||
+           marker_type==visualization_msgs::Marker::POINTS;
+}
+
+/*!
+ * \brief Build the vertices, indices or instances of a marker, without any GL calls, so on any thread
+ *
+ * \param marker
+ * \param scaling_factor
+ * \param geometry Filled in for UploadMarker(). Types that BuildsOnCpu() is false for leave it empty.
+ */
+void Mesh::BuildMarker(const visualization_msgs::Marker& marker, float scaling_factor, MarkerGeometry& geometry)
+{
+    geometry.model.identity();
+    if(marker.type==visualization_msgs::Marker::CUBE_LIST ||
+       marker.type==visualization_msgs::Marker::SPHERE_LIST ||
+       marker.type==visualization_msgs::Marker::POINTS){
+        BuildInstances(marker,scaling_factor,geometry);
+        return;
+    }
+    /// Everything else has the pose baked into its vertices
+    std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices = geometry.vertices;
+    std::vector<u_int32_t>& Indices = geometry.indices;
 
     Vector4 pt;
     /// We scale up from real world units to 'vr units'
@@ -297,22 +701,7 @@ void Mesh::InitMarker(float scaling_factor)
 
     Vector3 radius(marker.scale.x/2.0*scaling_factor,marker.scale.y/2.0*scaling_factor,marker.scale.z/2.0*scaling_factor);
 
-    if(marker.type==visualization_msgs::Marker::ARROW){
-        /// scale.x is length
-        /// \warning there's a custom arrow type in rviz where you can use points to define the shape. That isn't implemented here.
-        float length=marker.scale.x*scaling_factor; /// Use scale.x to specify the height.
-        InitArrow(Vertices,Indices,mat6,radius.y,radius.z,length,color);
-    }else if(marker.type==visualization_msgs::Marker::CUBE){
-        /// scale x,y,z all used
-        InitCube(Vertices,Indices,radius,color,mat6);
-    }else if(marker.type==visualization_msgs::Marker::SPHERE){
-        /// scale.x should be diameter, so radius.x is radius
-        InitSphere(Vertices,Indices,radius.x,color,pt);
-    }else if(marker.type==visualization_msgs::Marker::CYLINDER){
-        /// scale.x is diameter in x direction (currently don't support ellipse)
-        float length=marker.scale.z*scaling_factor; /// Use scale.z to specify the height.
-        InitCylinder(Vertices,Indices,mat6,radius.x,length,color);
-    }else if(marker.type==visualization_msgs::Marker::LINE_STRIP || marker.type==visualization_msgs::Marker::LINE_LIST){
+    if(marker.type==visualization_msgs::Marker::LINE_STRIP || marker.type==visualization_msgs::Marker::LINE_LIST){
         /// The only difference between them is that a strip goes 0->1->2->3, while a list goes 0->1  2->3
         /// \warning This is not properly implimented, but it may be functional.
         int increment = 1;
@@ -361,87 +750,123 @@ void Mesh::InitMarker(float scaling_factor)
             InitCube(Vertices,Indices,radius,color,mat9);
 
         }
-    }else if(marker.type==visualization_msgs::Marker::CUBE_LIST){
-        Matrix4 mat7,mat8;
-        for(int idx=0;idx<marker.points.size();idx++)
-        {
-            /// Make simple translation matrix
-            mat7.identity();
-            mat7.translate(marker.points[idx].x*scaling_factor,
-                           marker.points[idx].y*scaling_factor,
-                           marker.points[idx].z*scaling_factor);
-            mat8 = mat6*mat7;
-            if(idx<marker.colors.size()){
-                /// If there are per-cube colors, use those
-                color.x = marker.colors[idx].r;
-                color.y = marker.colors[idx].g;
-                color.z = marker.colors[idx].b;
-            }
-            InitCube(Vertices,Indices,radius,color,mat8);
-        }
-    }else if(marker.type==visualization_msgs::Marker::SPHERE_LIST){
-        for(int idx=0;idx<marker.points.size();idx++)
-        {
-            /// Only bother getting the position, it's a sphere so who cares about orientation
-            Vector4 pos(marker.points[idx].x*scaling_factor,
-                        marker.points[idx].y*scaling_factor,
-                        marker.points[idx].z*scaling_factor,1);
-            Vector4 gpos = mat6*pos;
-            if(idx<marker.colors.size()){
-                /// If there are per-sphere colors, use those
-                color.x = marker.colors[idx].r;
-                color.y = marker.colors[idx].g;
-                color.z = marker.colors[idx].b;
-            }
-            /// scale.x should be diameter, so radius.x is radius
-            InitSphere(Vertices,Indices,radius.x,color,gpos);
-        }
-    }else if(marker.type==visualization_msgs::Marker::POINTS){
-        Matrix4 mat7,mat8;
-        for(int idx=0;idx<marker.points.size();idx++)
-        {
-            /// Make simple translation matrix
-            mat7.identity();
-            mat7.translate(marker.points[idx].x*scaling_factor,
-                           marker.points[idx].y*scaling_factor,
-                           marker.points[idx].z*scaling_factor);
-            mat8 = mat6*mat7;
-            if(idx<marker.colors.size()){
-                /// If there are per-point colors, use those
-                color.x = marker.colors[idx].r;
-                color.y = marker.colors[idx].g;
-                color.z = marker.colors[idx].b;
-            }
-            /// scale.x should be diameter, so radius.x is radius
-            /// We use a reduced number of facets, since in rviz this is just 1 quad facing the camera anyways.
-            /// We could use a cube too if we wanted.
-            InitCube(Vertices,Indices,Vector3(radius.x,radius.x,radius.x),color,mat8);
-        }
     }else if(marker.type==visualization_msgs::Marker::TEXT_VIEW_FACING){
         /// Implimented in the main loop, since it uses the textured pipeline
     }else if(marker.type==visualization_msgs::Marker::TRIANGLE_LIST){
         InitTriangles(Vertices,Indices,mat6,radius,marker.points,marker.colors,color);
     }
+}
 
-    if(marker.type==visualization_msgs::Marker::MESH_RESOURCE){
-        /// This is a separate if, since we don't want to call Init for meshes, we want to call LoadMesh
-        /// \todo load_mesh and initialized are probably redundant, so they could probably be simplified.
-        /// \warning the mesh is only loaded once, so if the pose/orientation of a MESH_RESOURCE changes this won't detect that.
-        if(load_mesh){
-            if(LoadMesh(filename)){
-                initialized=true;
-                needs_update=false;
-            }else{
-                initialized=false;
-            }
-            /// I don't know why it would succeed on further attempts, so don't keep trying?
-            load_mesh=false;
-        }
+/*!
+ * \brief Send geometry from BuildMarker() to the GPU. Needs the GL context.
+ *
+ * \note needs_update is left alone, since the marker may have changed again while this was built
+ */
+void Mesh::UploadMarker(const MarkerGeometry& geometry)
+{
+    m_Entries.resize(1);
+    m_Entries[0].MaterialIndex=NO_TEXTURE;
+    model=geometry.model;
+    model_scale=Vector3(1,1,1);
+    model_color=Vector4(1,1,1,1);
+    if(geometry.instanced){
+        InitPrimitiveLibrary();
+        /// Lists can be huge, so spheres stay at the middle level of detail like they always were
+        const UnitPrimitive& primitive = geometry.sphere ? primitive_library[PRIMITIVE_SPHERE][1] : primitive_library[PRIMITIVE_CUBE][0];
+        m_Entries[0].InitInstanced(primitive.VB,primitive.IB,primitive.NumIndices,geometry.instances);
     }else{
-        m_Entries[0].Init(Vertices,Indices);
-        initialized=true;
-        needs_update=false;
+        m_Entries[0].Init(geometry.vertices,geometry.indices);
+    }
+    initialized=true;
+}
+
+/*!
+ * \brief Build a CUBE_LIST, SPHERE_LIST or POINTS marker as instances of a shared unit cube or sphere
+ *
+ * Expanding every element into triangles on the CPU made a 50k voxel cube list 1.8M vertices. Now each
+ * element is one MarkerInstance, and the marker pose goes into model for the shader to apply.
+ */
+void Mesh::BuildInstances(const visualization_msgs::Marker& marker, float scaling_factor, MarkerGeometry& geometry)
+{
+    geometry.instanced = true;
+    geometry.sphere = marker.type==visualization_msgs::Marker::SPHERE_LIST;
+
+    Matrix4 translation;
+    translation.translate(marker.pose.position.x*scaling_factor,
+                          marker.pose.position.y*scaling_factor,
+                          marker.pose.position.z*scaling_factor);
+    geometry.model = translation*quat2mat(marker.pose.orientation);
+
+    /// Cubes use the whole scale. Spheres and points (which rviz draws as camera facing quads) only scale.x, like before.
+    Vector3 radius(marker.scale.x/2.0*scaling_factor,marker.scale.y/2.0*scaling_factor,marker.scale.z/2.0*scaling_factor);
+    if(marker.type!=visualization_msgs::Marker::CUBE_LIST){
+        radius.y = radius.x;
+        radius.z = radius.x;
     }
+    MarkerInstance instance;
+    instance.scale[0] = radius.x;
+    instance.scale[1] = radius.y;
+    instance.scale[2] = radius.z;
+    std::vector<MarkerInstance>& instances = geometry.instances;
+    instances.resize(marker.points.size());
+    for(size_t idx=0;idx<marker.points.size();idx++)
+    {
+        instance.position[0] = marker.points[idx].x*scaling_factor;
+        instance.position[1] = marker.points[idx].y*scaling_factor;
+        instance.position[2] = marker.points[idx].z*scaling_factor;
+        /// If there are per-element colors, use those
+        const std_msgs::ColorRGBA& color = idx<marker.colors.size() ? marker.colors[idx] : marker.color;
+        instance.color[0] = uint8_t(std::min(std::max(color.r,0.0f),1.0f)*255.0f+0.5f);
+        instance.color[1] = uint8_t(std::min(std::max(color.g,0.0f),1.0f)*255.0f+0.5f);
+        instance.color[2] = uint8_t(std::min(std::max(color.b,0.0f),1.0f)*255.0f+0.5f);
+        instance.color[3] = uint8_t(std::min(std::max(color.a,0.0f),1.0f)*255.0f+0.5f);
+        instances[idx] = instance;
+    }
+}
+
+/*!
+ * \brief Set up an ARROW, CUBE, SPHERE or CYLINDER marker as a primitive of the library
+ *
+ * These used to be tessellated with the pose baked in, so any change re-tessellated and re-uploaded them.
+ * Now the pose, scale and color only go into model, model_scale and model_color for the shader.
+ * The sizes are the same as the old geometry had.
+ */
+void Mesh::InitShape(float scaling_factor)
+{
+    InitPrimitiveLibrary();
+
+    Matrix4 translation;
+    translation.translate(marker.pose.position.x*scaling_factor,
+                          marker.pose.position.y*scaling_factor,
+                          marker.pose.position.z*scaling_factor);
+    model = translation*quat2mat(marker.pose.orientation);
+    model_color = Vector4(marker.color.r,marker.color.g,marker.color.b,marker.color.a);
+
+    Vector3 radius(marker.scale.x/2.0*scaling_factor,marker.scale.y/2.0*scaling_factor,marker.scale.z/2.0*scaling_factor);
+    PrimitiveShape shape;
+    if(marker.type==visualization_msgs::Marker::ARROW){
+        /// scale.x is length, and y,z are the diameters of the head
+        /// \warning there's a custom arrow type in rviz where you can use points to define the shape. That isn't implemented here.
+        shape = PRIMITIVE_ARROW;
+        model_scale = Vector3(marker.scale.x*scaling_factor,radius.y,radius.z);
+    }else if(marker.type==visualization_msgs::Marker::CUBE){
+        /// scale x,y,z all used
+        shape = PRIMITIVE_CUBE;
+        model_scale = radius;
+    }else if(marker.type==visualization_msgs::Marker::SPHERE){
+        /// scale.x should be diameter, so radius.x is radius
+        shape = PRIMITIVE_SPHERE;
+        model_scale = Vector3(radius.x,radius.x,radius.x);
+    }else{
+        /// scale.x is diameter in x direction (currently don't support ellipse), scale.z the height
+        shape = PRIMITIVE_CYLINDER;
+        model_scale = Vector3(radius.x,radius.x,radius.z);
+    }
+    model_scale = Vector3(nonZero(model_scale.x),nonZero(model_scale.y),nonZero(model_scale.z));
+
+    const int lod = shape==PRIMITIVE_CUBE ? 0 : primitiveLod(model_scale);
+    const UnitPrimitive& primitive = primitive_library[shape][lod];
+    m_Entries[0].InitPrimitive(primitive.VA,primitive.VB,primitive.IB,primitive.NumIndices);
 }
 
 void Mesh::InitCube(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Vector3 radius, Vector3 color, Matrix4 mat )
@@ -614,7 +1039,7 @@ void Mesh::InitCylinder( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, st
     }
 }
 
-void Mesh::InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat, Vector3 radius,std::vector<geometry_msgs::Point> &points,std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color){
+void Mesh::InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat, Vector3 radius,const std::vector<geometry_msgs::Point> &points,const std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color){
     /// If the points aren't a multiple of 3, something is wrong
     assert(points.size()%3==0);
     Vector4 scale(radius.x*2.0,radius.y*2.0,radius.z*2.0,1.0);
@@ -21,6 +21,7 @@
 
 #include <map>
 #include <vector>
+#include <stdint.h>
 #include <GL/glew.h>
 #include <assimp/Importer.hpp>      // C++ importer interface
 #include <assimp/scene.h>       // Output data structure
@@ -46,6 +47,36 @@ struct RenderModel_Vertex_t_rgb
 };
 }
 
+/// One element of a CUBE_LIST, SPHERE_LIST or POINTS marker, drawn as an instance of a unit primitive
+struct MarkerInstance
+{
+    float position[3];///!< In the frame of the marker pose
+    float scale[3];///!< Half extents; the unit primitives span -1 to 1
+    uint8_t color[4];
+};
+
+/*!
+ * \brief The CPU side of a marker, built by Mesh::BuildMarker() on any thread and uploaded by Mesh::UploadMarker()
+ */
+struct MarkerGeometry
+{
+    Matrix4 model;///!< Becomes Mesh::model
+    std::vector<vr::RenderModel_Vertex_t_rgb> vertices;
+    std::vector<u_int32_t> indices;
+    bool instanced;///!< Draw the unit cube or sphere once for every element of instances, instead of the vertices
+    bool sphere;
+    std::vector<MarkerInstance> instances;
+
+    MarkerGeometry() : instanced(false), sphere(false) {}
+
+    /// How much the upload sends to the GPU
+    size_t Bytes() const
+    {
+        return vertices.size()*sizeof(vr::RenderModel_Vertex_t_rgb) + indices.size()*sizeof(u_int32_t) +
+               instances.size()*sizeof(MarkerInstance);
+    }
+};
+
 struct Vertex
 {
     Vector3 m_pos;
@@ -72,7 +103,12 @@ public:
 
     bool LoadMesh(const std::string& Filename);
     void InitMarker(float scaling_factor=1.0);
-    Matrix4 quat2mat(geometry_msgs::Quaternion quat);
+    static bool BuildsOnCpu(int32_t marker_type);
+    static void BuildMarker(const visualization_msgs::Marker& marker, float scaling_factor, MarkerGeometry& geometry);
+    void UploadMarker(const MarkerGeometry& geometry);
+    static void InitPrimitiveLibrary();
+    void Recycle();
+    static Matrix4 quat2mat(geometry_msgs::Quaternion quat);
 
     void Render();
 
@@ -90,19 +126,25 @@ public:
     std::string fallback_texture_filename;
     Vector3 scale;
     Matrix4 trans;
+    Matrix4 model;///!< Applied to the geometry by the shader, within frame_id; the marker pose for primitive and instanced markers
+    Vector3 model_scale;///!< Applied by the shader before model
+    Vector4 model_color;///!< Multiplies the vertex colors in the shader
     bool Z_UP;
 
 private:
-    geometry_msgs::Quaternion quatPoint2Point(Vector4 p1, Vector4 p2, float distance);
+    /// The geometry generators only write their output, so worker threads can use them
+    static geometry_msgs::Quaternion quatPoint2Point(Vector4 p1, Vector4 p2, float distance);
     bool InitFromScene(const aiScene* pScene, const std::string& Filename);
-    Vector4 sphere2cart(float azimuth, float elevation, float radius);
-    void AddColorVertex(Vector4 pt,Vector4 normal,Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices);
-    void AddColorTri(Vector4 pt1, Vector4 pt2, Vector4 pt3, Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices);
-    void InitCube(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Vector3 radius, Vector3 color, Matrix4 mat );
-    void InitSphere(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, float radius, Vector3 color, Vector4 center, int num_lat=8, int num_lon=0 );
-    void InitArrow( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float radius_y,float radius_z, float length, Vector3 color, int num_facets=16 );
-    void InitCylinder( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float radius, float length, Vector3 color, int num_facets=16 );
-    void InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat,Vector3 radius, std::vector<geometry_msgs::Point> &points,std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color);
+    static Vector4 sphere2cart(float azimuth, float elevation, float radius);
+    static void AddColorVertex(Vector4 pt,Vector4 normal,Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices);
+    static void AddColorTri(Vector4 pt1, Vector4 pt2, Vector4 pt3, Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices);
+    static void InitCube(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Vector3 radius, Vector3 color, Matrix4 mat );
+    static void InitSphere(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, float radius, Vector3 color, Vector4 center, int num_lat=8, int num_lon=0 );
+    static void InitArrow( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float radius_y,float radius_z, float length, Vector3 color, int num_facets=16 );
+    static void InitCylinder( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float radius, float length, Vector3 color, int num_facets=16 );
+    static void InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat,Vector3 radius, const std::vector<geometry_msgs::Point> &points,const std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color);
+    static void BuildInstances(const visualization_msgs::Marker& marker, float scaling_factor, MarkerGeometry& geometry);
+    void InitShape(float scaling_factor);
     void InitMesh(unsigned int Index, const aiMesh* paiMesh, const aiNode* node);
     bool InitMaterials(const aiScene* pScene, const std::string& Filename);
     void Clear();
@@ -120,12 +162,24 @@ public:
                   const std::vector<u_int32_t>& Indices);
         void Init(const std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
                   const std::vector<u_int32_t>& Indices);
+        void InitInstanced(GLuint PrimitiveVB, GLuint PrimitiveIB, unsigned int PrimitiveIndices,
+                           const std::vector<MarkerInstance>& Instances);
+        void InitPrimitive(GLuint PrimitiveVA, GLuint PrimitiveVB, GLuint PrimitiveIB, unsigned int PrimitiveIndices);
+        void Release();
+        void Recycle();
+        static void ReleasePool();
 
         GLuint VB;
         GLuint VA;
         GLuint IB;
         unsigned int NumIndices;
         unsigned int MaterialIndex;
+        GLuint InstanceBuffer;///!< Only for instanced entries, whose VB and IB are shared and not owned
+        unsigned int NumInstances;
+        bool Shared;///!< VA, VB and IB belong to the primitive library
+
+    private:
+        void Acquire();
     };
 
     std::vector<MeshEntry> m_Entries;
@@ -1,6 +1,8 @@
 //========= Copyright Valve Corporation ============//
 
 #include "openvr_gl.h"
+#include "point_cloud.h"
+#include "frustum.h"
 //-----------------------------------------------------------------------------
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
@@ -13,6 +15,9 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_unCompanionWindowProgramID( 0 )
 	, m_unControllerTransformProgramID( 0 )
 	, m_unRenderModelProgramID( 0 )
+	, m_unPointCloudProgramID( 0 )
+	, m_unPointScalarProgramID( 0 )
+	, m_unDepthProgramID( 0 )
 	, m_pHMD( NULL )
 	, m_bDebugOpenGL( false )
 	, m_bVerbose( false )
@@ -21,13 +26,22 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_bGlFinishHack( true )
 	, m_glControllerVertBuffer( 0 )
 	, m_unControllerVAO( 0 )
-	, m_glPointCloudVertBuffer( 0 )
-	, m_unPointCloudVAO( 0 )
+	, m_sceneStream( sizeof( VertexDataScene ) )
+	, m_nSceneFirstVert( 0 )
+	, m_controllerStream( sizeof( PointVertex ) )
+	, m_nControllerFirstVert( 0 )
 	, m_glColorTrisVertBuffer( 0 )
 	, m_unColorTrisVAO( 0 )
 	, m_unSceneVAO( 0 )
 	, m_nSceneMatrixLocation( -1 )
 	, m_nControllerMatrixLocation( -1 )
+	, m_nPointCloudMatrixLocation( -1 )
+	, m_nPointScalarMatrixLocation( -1 )
+	, m_nPointScalarRangeLocation( -1 )
+	, m_nDepthMatrixLocation( -1 )
+	, m_nDepthIntrinsicsLocation( -1 )
+	, m_nDepthScaleLocation( -1 )
+	, m_nDepthHasColorLocation( -1 )
 	, m_nRenderModelMatrixLocation( -1 )
 	, m_iTrackedControllerCount( 0 )
 	, m_iTrackedControllerCount_Last( -1 )
@@ -37,6 +51,16 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_strPoseClasses("")
 	, m_bShowCubes( true )
 	, m_bShowControllers( true )
+	, m_unDepthTexture( 0 )
+	, m_unDepthColorTexture( 0 )
+	, m_unDepthVAO( 0 )
+	, m_uiDepthWidth( 0 )
+	, m_uiDepthHeight( 0 )
+	, m_iDepthInternalFormat( 0 )
+	, m_uiDepthColorWidth( 0 )
+	, m_uiDepthColorHeight( 0 )
+	, m_fDepthScale( 1.0f )
+	, m_bDepthHasColor( false )
 {
 
 	for( int i = 1; i < argc; i++ )
@@ -328,6 +352,29 @@ void CMainApplication::Shutdown()
 			glDebugMessageCallback(nullptr, nullptr);
 		}
 		glDeleteBuffers(1, &m_glSceneVertBuffer);
+		m_sceneStream.Release();
+		m_controllerStream.Release();
+		for ( size_t i = 0; i < m_vecPointCloudLayers.size(); i++ )
+		{
+			PointCloudLayer *pLayer = m_vecPointCloudLayers[i];
+			pLayer->m_stream.Release();
+			if ( pLayer->m_unVAO )
+			{
+				glDeleteVertexArrays( 1, &pLayer->m_unVAO );
+			}
+			if ( pLayer->m_colorState.m_unColormapTexture )
+			{
+				glDeleteTextures( 1, &pLayer->m_colorState.m_unColormapTexture );
+			}
+			delete pLayer;
+		}
+		m_vecPointCloudLayers.clear();
+		for ( std::unordered_map<uint64_t,PointMapChunk>::iterator it = m_mapPointMapChunks.begin(); it != m_mapPointMapChunks.end(); ++it )
+		{
+			glDeleteVertexArrays( 1, &it->second.m_unVAO );
+			glDeleteBuffers( 1, &it->second.m_glVertBuffer );
+		}
+		m_mapPointMapChunks.clear();
 
 		if ( m_unSceneProgramID )
 		{
@@ -341,6 +388,34 @@ void CMainApplication::Shutdown()
 		{
 			glDeleteProgram( m_unRenderModelProgramID );
 		}
+		if ( m_unPointCloudProgramID )
+		{
+			glDeleteProgram( m_unPointCloudProgramID );
+		}
+		if ( m_unPointScalarProgramID )
+		{
+			glDeleteProgram( m_unPointScalarProgramID );
+		}
+		if ( m_pointMapColorState.m_unColormapTexture )
+		{
+			glDeleteTextures( 1, &m_pointMapColorState.m_unColormapTexture );
+		}
+		if ( m_unDepthProgramID )
+		{
+			glDeleteProgram( m_unDepthProgramID );
+		}
+		if ( m_unDepthTexture )
+		{
+			glDeleteTextures( 1, &m_unDepthTexture );
+		}
+		if ( m_unDepthColorTexture )
+		{
+			glDeleteTextures( 1, &m_unDepthColorTexture );
+		}
+		if ( m_unDepthVAO )
+		{
+			glDeleteVertexArrays( 1, &m_unDepthVAO );
+		}
 		if ( m_unCompanionWindowProgramID )
 		{
 			glDeleteProgram( m_unCompanionWindowProgramID );
@@ -370,9 +445,6 @@ void CMainApplication::Shutdown()
 		{
 			glDeleteVertexArrays( 1, &m_unControllerVAO );
 		}
-		if( m_unPointCloudVAO != 0 ){
-			glDeleteVertexArrays( 1, &m_unPointCloudVAO );
-		}
 		if( m_unColorTrisVAO != 0 ){
 			glDeleteVertexArrays( 1, &m_unColorTrisVAO );
 		}
@@ -730,6 +802,130 @@ bool CMainApplication::CreateAllShaders()
 		return false;
 	}
 
+	// Same as the controller shader, but the color arrives as normalized RGBA8 (see PointVertex)
+	m_unPointCloudProgramID = CompileGLShader(
+		"PointCloud",
+
+		// vertex shader
+		"#version 410\n"
+		"uniform mat4 matrix;\n"
+		"layout(location = 0) in vec4 position;\n"
+		"layout(location = 1) in vec4 v4ColorIn;\n"
+		"out vec4 v4Color;\n"
+		"void main()\n"
+		"{\n"
+		"	v4Color = v4ColorIn;\n"
+		"	gl_Position = matrix * position;\n"
+		"}\n",
+
+		// fragment shader
+		"#version 410\n"
+		"in vec4 v4Color;\n"
+		"out vec4 outputColor;\n"
+		"void main()\n"
+		"{\n"
+		"   outputColor = v4Color;\n"
+		"}\n"
+		);
+	m_nPointCloudMatrixLocation = glGetUniformLocation( m_unPointCloudProgramID, "matrix" );
+	if( m_nPointCloudMatrixLocation == -1 )
+	{
+		dprintf( "Unable to find matrix uniform in point cloud shader\n" );
+		return false;
+	}
+
+	// Points that carry a raw scalar (intensity or height) where the color would be. The scalar
+	// is scaled by range (min and 1/(max-min)) and looked up in a 1D colormap texture.
+	m_unPointScalarProgramID = CompileGLShader(
+		"PointScalar",
+
+		// vertex shader
+		"#version 410\n"
+		"uniform mat4 matrix;\n"
+		"uniform vec2 range;\n"
+		"uniform sampler1D colormap;\n"
+		"layout(location = 0) in vec4 position;\n"
+		"layout(location = 2) in float scalarIn;\n"
+		"out vec4 v4Color;\n"
+		"void main()\n"
+		"{\n"
+		"	float n = float(textureSize(colormap, 0));\n"
+		"	float t = clamp((scalarIn - range.x) * range.y, 0.0, 1.0);\n"
+		"	v4Color = textureLod(colormap, (t * (n - 1.0) + 0.5) / n, 0.0);\n"
+		"	gl_Position = matrix * position;\n"
+		"}\n",
+
+		// fragment shader
+		"#version 410\n"
+		"in vec4 v4Color;\n"
+		"out vec4 outputColor;\n"
+		"void main()\n"
+		"{\n"
+		"   outputColor = v4Color;\n"
+		"}\n"
+		);
+	m_nPointScalarMatrixLocation = glGetUniformLocation( m_unPointScalarProgramID, "matrix" );
+	m_nPointScalarRangeLocation = glGetUniformLocation( m_unPointScalarProgramID, "range" );
+	if( m_nPointScalarMatrixLocation == -1 || m_nPointScalarRangeLocation == -1 )
+	{
+		dprintf( "Unable to find matrix or range uniform in point scalar shader\n" );
+		return false;
+	}
+
+	// Turns a depth image into one point per pixel, with no vertex data at all. The pixel comes
+	// from gl_VertexID, and is unprojected with the pinhole intrinsics (fx, fy, cx, cy). Pixels
+	// without a valid depth are moved outside the clip volume, so they are dropped.
+	m_unDepthProgramID = CompileGLShader(
+		"DepthImage",
+
+		// vertex shader
+		"#version 410\n"
+		"uniform mat4 matrix;\n"
+		"uniform vec4 intrinsics;\n"
+		"uniform float depthScale;\n"
+		"uniform bool hasColor;\n"
+		"uniform sampler2D depth;\n"
+		"uniform sampler2D color;\n"
+		"out vec4 v4Color;\n"
+		"void main()\n"
+		"{\n"
+		"	ivec2 size = textureSize(depth, 0);\n"
+		"	ivec2 pixel = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);\n"
+		"	float z = texelFetch(depth, pixel, 0).r * depthScale;\n"
+		"	if (!(z > 0.0))\n"
+		"	{\n"
+		"		v4Color = vec4(0.0);\n"
+		"		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+		"		return;\n"
+		"	}\n"
+		"	vec2 xy = (vec2(pixel) - intrinsics.zw) * z / intrinsics.xy;\n"
+		"	v4Color = hasColor ? texelFetch(color, pixel, 0) : vec4(1.0, 0.0, 0.0, 1.0);\n"
+		"	gl_Position = matrix * vec4(xy, z, 1.0);\n"
+		"}\n",
+
+		// fragment shader
+		"#version 410\n"
+		"in vec4 v4Color;\n"
+		"out vec4 outputColor;\n"
+		"void main()\n"
+		"{\n"
+		"   outputColor = v4Color;\n"
+		"}\n"
+		);
+	m_nDepthMatrixLocation = glGetUniformLocation( m_unDepthProgramID, "matrix" );
+	m_nDepthIntrinsicsLocation = glGetUniformLocation( m_unDepthProgramID, "intrinsics" );
+	m_nDepthScaleLocation = glGetUniformLocation( m_unDepthProgramID, "depthScale" );
+	m_nDepthHasColorLocation = glGetUniformLocation( m_unDepthProgramID, "hasColor" );
+	if( m_nDepthMatrixLocation == -1 || m_nDepthIntrinsicsLocation == -1 || m_nDepthScaleLocation == -1 || m_nDepthHasColorLocation == -1 )
+	{
+		dprintf( "Unable to find uniforms in depth image shader\n" );
+		return false;
+	}
+	glUseProgram( m_unDepthProgramID );
+	glUniform1i( glGetUniformLocation( m_unDepthProgramID, "depth" ), 0 );
+	glUniform1i( glGetUniformLocation( m_unDepthProgramID, "color" ), 1 );
+	glUseProgram( 0 );
+
 
 
     m_unRenderModelProgramID = CompileGLShader(
@@ -775,9 +971,15 @@ bool CMainApplication::CreateAllShaders()
 		"layout (location = 0) in vec3 Position;\n"
 		"layout (location = 1) in vec3 Normal;\n"
 		"layout (location = 2) in vec3 v3ColorIn;\n"
+		"layout (location = 3) in vec3 InstancePosition;\n"
+		"layout (location = 4) in vec3 InstanceScale;\n"
+		"layout (location = 5) in vec4 InstanceColor;\n"
 		"\n"
 		"uniform mat4 gWVP;\n"
 		"uniform mat4 gWorld;\n"
+		"uniform bool gInstanced;\n"
+		"uniform vec3 gScale;\n"
+		"uniform vec4 gColor;\n"
 		"\n"
 		"out vec4 v4Color;\n"
 		"out vec3 Normal0;\n"
@@ -785,10 +987,17 @@ bool CMainApplication::CreateAllShaders()
 		"\n"
 		"void main()\n"
 		"{\n"
-		" gl_Position = gWVP * vec4(Position, 1.0);\n"
-		" v4Color = vec4(v3ColorIn, 1.0);\n"
-		" Normal0 = (gWorld * vec4(Normal, 0.0)).xyz;\n"
-		" WorldPos0 = (gWorld * vec4(Position, 1.0)).xyz;\n"
+		" vec3 ModelPos = gScale * Position;\n"
+		" vec3 ModelNormal = Normal / gScale;\n"
+		" v4Color = gColor * vec4(v3ColorIn, 1.0);\n"
+		" if (gInstanced) {\n"
+		" ModelPos = InstancePosition + InstanceScale * Position;\n"
+		" ModelNormal = Normal / InstanceScale;\n"
+		" v4Color *= InstanceColor;\n"
+		" }\n"
+		" gl_Position = gWVP * vec4(ModelPos, 1.0);\n"
+		" Normal0 = (gWorld * vec4(ModelNormal, 0.0)).xyz;\n"
+		" WorldPos0 = (gWorld * vec4(ModelPos, 1.0)).xyz;\n"
 		"}\n",
 
 		//fragment shader
@@ -933,6 +1142,9 @@ bool CMainApplication::CreateAllShaders()
     m_matSpecularPowerRGBLocation = glGetUniformLocation( m_unLitRGBModelProgramID, "gSpecularPower");
     m_numPointLightsRGBLocation = glGetUniformLocation( m_unLitRGBModelProgramID, "gNumPointLights");
     m_numSpotLightsRGBLocation = glGetUniformLocation( m_unLitRGBModelProgramID, "gNumSpotLights");
+    m_instancedRGBLocation = glGetUniformLocation( m_unLitRGBModelProgramID, "gInstanced");
+    m_scaleRGBLocation = glGetUniformLocation( m_unLitRGBModelProgramID, "gScale");
+    m_colorRGBLocation = glGetUniformLocation( m_unLitRGBModelProgramID, "gColor");
 
 
 
@@ -1149,6 +1361,9 @@ bool CMainApplication::CreateAllShaders()
 
 	return m_unSceneProgramID != 0 
 		&& m_unControllerTransformProgramID != 0
+		&& m_unPointCloudProgramID != 0
+		&& m_unPointScalarProgramID != 0
+		&& m_unDepthProgramID != 0
 		&& m_unRenderModelProgramID != 0
 		&& m_unCompanionWindowProgramID != 0;
 }
@@ -1545,6 +1760,8 @@ void CMainApplication::SetupCompanionWindow()
 //-----------------------------------------------------------------------------
 void CMainApplication::RenderStereoTargets()
 {
+	CullPointChunks();
+
 	glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
 	glEnable( GL_MULTISAMPLE );
 
@@ -1588,6 +1805,71 @@ void CMainApplication::RenderStereoTargets()
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Works out which point cloud and point map chunks are inside the
+//          frustum of either eye, once per frame for both eyes.
+//-----------------------------------------------------------------------------
+void CMainApplication::CullPointChunks()
+{
+	Frustum leftFrustum, rightFrustum;
+
+	for ( size_t i = 0; i < m_vecPointCloudLayers.size(); i++ )
+	{
+		PointCloudLayer & layer = *m_vecPointCloudLayers[i];
+		layer.m_vecVisibleFirsts.clear();
+		layer.m_vecVisibleCounts.clear();
+		// Only bother if there are points. This avoids calls to GetRobotMatrixPose() where m_strFrame is an empty string.
+		if ( layer.m_uiVertcount == 0 )
+			continue;
+
+		Matrix4 matCloud = GetRobotMatrixPose( layer.m_strFrame );
+		leftFrustum.SetFromMatrix( GetCurrentViewProjectionMatrix( vr::Eye_Left ) * matCloud );
+		rightFrustum.SetFromMatrix( GetCurrentViewProjectionMatrix( vr::Eye_Right ) * matCloud );
+		for ( size_t j = 0; j < layer.m_vecChunks.size(); j++ )
+		{
+			const PointChunk & chunk = layer.m_vecChunks[j];
+			if ( leftFrustum.IntersectsBox( chunk.min, chunk.max ) || rightFrustum.IntersectsBox( chunk.min, chunk.max ) )
+			{
+				layer.m_vecVisibleFirsts.push_back( layer.m_nFirstVert + chunk.first );
+				layer.m_vecVisibleCounts.push_back( chunk.count );
+			}
+		}
+	}
+
+	if ( !m_mapPointMapChunks.empty() )
+	{
+		Matrix4 matMap = GetRobotMatrixPose( m_strPointMapFrame );
+		leftFrustum.SetFromMatrix( GetCurrentViewProjectionMatrix( vr::Eye_Left ) * matMap );
+		rightFrustum.SetFromMatrix( GetCurrentViewProjectionMatrix( vr::Eye_Right ) * matMap );
+		for ( std::unordered_map<uint64_t,PointMapChunk>::iterator it = m_mapPointMapChunks.begin(); it != m_mapPointMapChunks.end(); ++it )
+		{
+			PointMapChunk & chunk = it->second;
+			chunk.m_bVisible = leftFrustum.IntersectsBox( chunk.m_vMin, chunk.m_vMax ) || rightFrustum.IntersectsBox( chunk.m_vMin, chunk.m_vMax );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Selects the shader for points carrying colors or scalars, and sets
+//          its uniforms.
+//-----------------------------------------------------------------------------
+void CMainApplication::BindPointProgram( const PointColorState & colorState, const Matrix4 & matMVP )
+{
+	if ( !colorState.m_bScalars || colorState.m_unColormapTexture == 0 )
+	{
+		glUseProgram( m_unPointCloudProgramID );
+		glUniformMatrix4fv( m_nPointCloudMatrixLocation, 1, GL_FALSE, matMVP.get() );
+		return;
+	}
+
+	float fRange = colorState.m_fScalarMax - colorState.m_fScalarMin;
+	glUseProgram( m_unPointScalarProgramID );
+	glUniformMatrix4fv( m_nPointScalarMatrixLocation, 1, GL_FALSE, matMVP.get() );
+	glUniform2f( m_nPointScalarRangeLocation, colorState.m_fScalarMin, fRange > 0.0f ? 1.0f / fRange : 0.0f );
+	glActiveTexture( GL_TEXTURE0 );
+	glBindTexture( GL_TEXTURE_1D, colorState.m_unColormapTexture );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Renders a scene with respect to nEye.
 //-----------------------------------------------------------------------------
@@ -1602,7 +1884,7 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 		glUniformMatrix4fv( m_nSceneMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix( nEye ).get() );
 		glBindVertexArray( m_unSceneVAO );
 		glBindTexture( GL_TEXTURE_2D, m_iTexture );
-		glDrawArrays( GL_TRIANGLES, 0, m_uiVertcount );
+		glDrawArrays( GL_TRIANGLES, m_nSceneFirstVert, m_uiVertcount );
 		glBindVertexArray( 0 );
 	}
 
@@ -1614,17 +1896,51 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 		glUseProgram( m_unControllerTransformProgramID );
 		glUniformMatrix4fv( m_nControllerMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix( nEye ).get() );
 		glBindVertexArray( m_unControllerVAO );
-		glDrawArrays( GL_LINES, 0, m_uiControllerVertcount );
+		glDrawArrays( GL_LINES, m_nControllerFirstVert, m_uiControllerVertcount );
 		glBindVertexArray( 0 );
 
-        // Only bother drawing if there are points. This avoids calls to GetRobotMatrixPose() where m_strPointCloudFrame is an empty string.
-        if(m_uiPointCloudVertcount>0){
-            // draw the point cloud
-            glUseProgram( m_unControllerTransformProgramID );
-            glUniformMatrix4fv( m_nControllerMatrixLocation, 1, GL_FALSE, (GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(m_strPointCloudFrame)).get() );
-            glBindVertexArray( m_unPointCloudVAO );
+        // draw the chunks of each point cloud that survived CullPointChunks()
+        for ( size_t i = 0; i < m_vecPointCloudLayers.size(); i++ )
+        {
+            const PointCloudLayer & layer = *m_vecPointCloudLayers[i];
+            // Only bother drawing if there are visible points. This avoids calls to GetRobotMatrixPose() where m_strFrame is an empty string.
+            if ( layer.m_vecVisibleFirsts.empty() )
+                continue;
+            BindPointProgram( layer.m_colorState, GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(layer.m_strFrame) );
+            glBindVertexArray( layer.m_unVAO );
+            glPointSize( layer.m_unPointSize );
+            glMultiDrawArrays( GL_POINTS, &layer.m_vecVisibleFirsts[0], &layer.m_vecVisibleCounts[0], layer.m_vecVisibleFirsts.size() );
+        }
+        glBindVertexArray( 0 );
+
+        // draw the accumulated point map, one chunk at a time
+        if(!m_mapPointMapChunks.empty()){
+            BindPointProgram( m_pointMapColorState, GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(m_strPointMapFrame) );
             glPointSize( m_unPointSize );
-            glDrawArrays( GL_POINTS, 0, m_uiPointCloudVertcount );
+            for ( std::unordered_map<uint64_t,PointMapChunk>::const_iterator it = m_mapPointMapChunks.begin(); it != m_mapPointMapChunks.end(); ++it )
+            {
+                if ( !it->second.m_bVisible )
+                    continue;
+                glBindVertexArray( it->second.m_unVAO );
+                glDrawArrays( GL_POINTS, 0, it->second.m_uiVertcount );
+            }
+            glBindVertexArray( 0 );
+        }
+
+        // draw the depth image, unprojected by the depth shader
+        if(m_uiDepthWidth>0){
+            glUseProgram( m_unDepthProgramID );
+            glUniformMatrix4fv( m_nDepthMatrixLocation, 1, GL_FALSE, (GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(m_strDepthFrame)).get() );
+            glUniform4f( m_nDepthIntrinsicsLocation, m_vDepthIntrinsics.x, m_vDepthIntrinsics.y, m_vDepthIntrinsics.z, m_vDepthIntrinsics.w );
+            glUniform1f( m_nDepthScaleLocation, m_fDepthScale );
+            glUniform1i( m_nDepthHasColorLocation, m_bDepthHasColor );
+            glActiveTexture( GL_TEXTURE1 );
+            glBindTexture( GL_TEXTURE_2D, m_bDepthHasColor ? m_unDepthColorTexture : 0 );
+            glActiveTexture( GL_TEXTURE0 );
+            glBindTexture( GL_TEXTURE_2D, m_unDepthTexture );
+            glBindVertexArray( m_unDepthVAO );
+            glPointSize( m_unPointSize );
+            glDrawArrays( GL_POINTS, 0, m_uiDepthWidth * m_uiDepthHeight );
             glBindVertexArray( 0 );
         }
 
@@ -1652,23 +1968,41 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 	}
 
 
-    for(int idx=0;idx<robot_meshes.size();idx++){
+	RenderMeshes( robot_meshes, nEye );
+	{
+		// Only copy the list under the lock, so markers keep arriving while they are drawn. Meshes are only
+		// deleted and set up on this thread, and the ROS thread only touches their marker, so this is safe.
+		boost::mutex::scoped_lock lock( marker_registry.GetMutex() );
+		m_vecMarkerDrawList = marker_registry.GetMeshes();
+	}
+	RenderMeshes( m_vecMarkerDrawList, nEye );
+
+	glUseProgram( 0 );
+}
+
 
-        //robot_meshes[idx]->Render();
-        for(int jj=0;jj<robot_meshes[idx]->m_Entries.size();jj++){
-            if(robot_meshes[idx]->initialized && !robot_meshes[idx]->load_mesh){
-                if(robot_meshes[idx]->frame_id.length()==0)
+//-----------------------------------------------------------------------------
+// Purpose: Draw the robot links or markers, each in its own frame
+//-----------------------------------------------------------------------------
+void CMainApplication::RenderMeshes( const std::vector<Mesh*> &meshes, vr::Hmd_Eye nEye )
+{
+    for(int idx=0;idx<meshes.size();idx++){
+
+        //meshes[idx]->Render();
+        for(int jj=0;jj<meshes[idx]->m_Entries.size();jj++){
+            if(meshes[idx]->initialized && !meshes[idx]->load_mesh){
+                if(meshes[idx]->frame_id.length()==0)
                 {
-                    std::cout << "empty frameid when rendering " << robot_meshes[idx]->name << " ID=" << robot_meshes[idx]->id << " FrameID=" << robot_meshes[idx]->frame_id << std::endl;
+                    std::cout << "empty frameid when rendering " << meshes[idx]->name << " ID=" << meshes[idx]->id << " FrameID=" << meshes[idx]->frame_id << std::endl;
                 }
 
-                if(robot_meshes[idx]->m_Entries[jj].MaterialIndex!=NO_TEXTURE){
+                if(meshes[idx]->m_Entries[jj].MaterialIndex!=NO_TEXTURE){
 
                     // ----- Render Model rendering -----
                     glUseProgram( m_unLitModelProgramID );
 
-                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(robot_meshes[idx]->frame_id);
-                    Matrix4 matWorld = GetRobotMatrixPose(robot_meshes[idx]->frame_id) ;
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(meshes[idx]->frame_id);
+                    Matrix4 matWorld = GetRobotMatrixPose(meshes[idx]->frame_id) ;
                     Vector4 eyePos = GetHMDMatrixPoseEye(nEye)*Vector4(0,0,0,1);
                     glUniformMatrix4fv( m_nLitModelMatrixLocation, 1, GL_FALSE, matMVP.get() );
 
@@ -1685,11 +2019,11 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
                     glUniform1i(m_numPointLightsLocation, 0);
                     glUniform1i(m_numSpotLightsLocation, 0);
 
-                    glBindVertexArray( robot_meshes[idx]->m_Entries[jj].VA );
+                    glBindVertexArray( meshes[idx]->m_Entries[jj].VA );
 
-                    robot_meshes[idx]->m_Textures[jj]->Bind(GL_TEXTURE0);
+                    meshes[idx]->m_Textures[jj]->Bind(GL_TEXTURE0);
 
-                    glDrawElements( GL_TRIANGLES, robot_meshes[idx]->m_Entries[jj].NumIndices, GL_UNSIGNED_INT, 0 );
+                    glDrawElements( GL_TRIANGLES, meshes[idx]->m_Entries[jj].NumIndices, GL_UNSIGNED_INT, 0 );
 
                     glBindVertexArray( 0 );
 
@@ -1699,8 +2033,8 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
                     // ----- Render Model rendering -----
                     glUseProgram( m_unLitRGBModelProgramID );
 
-                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(robot_meshes[idx]->frame_id);
-                    Matrix4 matWorld = GetRobotMatrixPose(robot_meshes[idx]->frame_id) ;
+                    Matrix4 matWorld = GetRobotMatrixPose(meshes[idx]->frame_id) * meshes[idx]->model;
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * matWorld;
                     Vector4 eyePos = GetHMDMatrixPoseEye(nEye)*Vector4(0,0,0,1);
                     glUniformMatrix4fv( m_nLitRGBModelMatrixLocation, 1, GL_FALSE, matMVP.get() );
 
@@ -1717,9 +2051,24 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
                     glUniform1i(m_numPointLightsRGBLocation, 0);
                     glUniform1i(m_numSpotLightsRGBLocation, 0);
 
-                    glBindVertexArray( robot_meshes[idx]->m_Entries[jj].VA );
-
-                    glDrawElements( GL_TRIANGLES, robot_meshes[idx]->m_Entries[jj].NumIndices, GL_UNSIGNED_INT, 0 );
+                    const Mesh::MeshEntry &entry = meshes[idx]->m_Entries[jj];
+                    const bool instanced = entry.InstanceBuffer != INVALID_OGL_VALUE;
+                    glUniform1i(m_instancedRGBLocation, instanced);
+                    const Vector3 &scale = meshes[idx]->model_scale;
+                    const Vector4 &color = meshes[idx]->model_color;
+                    glUniform3f(m_scaleRGBLocation, scale.x, scale.y, scale.z);
+                    glUniform4f(m_colorRGBLocation, color.x, color.y, color.z, color.w);
+
+                    glBindVertexArray( entry.VA );
+
+                    if( instanced )
+                    {
+                        glDrawElementsInstanced( GL_TRIANGLES, entry.NumIndices, GL_UNSIGNED_INT, 0, entry.NumInstances );
+                    }
+                    else
+                    {
+                        glDrawElements( GL_TRIANGLES, entry.NumIndices, GL_UNSIGNED_INT, 0 );
+                    }
 
                     glBindVertexArray( 0 );
 
@@ -1728,8 +2077,6 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
             }
         }
     }
-
-	glUseProgram( 0 );
 }
 
 
@@ -0,0 +1,78 @@
+#include <cmath>
+#include <algorithm>
+#include "point_chunks.h"
+#include "grid_coord.h"
+
+namespace
+{
+
+/// Pack the grid cell of a point into one key, 21 bits per axis
+inline uint64_t cellKey(const PointVertex& pt, float inv_size)
+{
+    const uint64_t ix = gridCoord(std::floor(pt.x*inv_size));
+    const uint64_t iy = gridCoord(std::floor(pt.y*inv_size));
+    const uint64_t iz = gridCoord(std::floor(pt.z*inv_size));
+    return (ix<<(2*GRID_BITS)) | (iy<<GRID_BITS) | iz;
+}
+
+}
+
+PointChunker::PointChunker()
+    : cell_size(2.0f)
+{
+}
+
+/*!
+ * \brief Sort points by grid cell, with a counting sort
+ *
+ * \param points The cloud; reordered in place
+ * \param chunks Output; one entry per non-empty cell
+ */
+void PointChunker::Split(std::vector<PointVertex>& points, std::vector<PointChunk>& chunks)
+{
+    const float inv_size = 1.0f/cell_size;
+    m_cellIndex.clear();
+    chunks.clear();
+    m_pointChunk.resize(points.size());
+
+    /// First pass finds the cell of every point, and counts the points in each cell
+    for(size_t ii=0;ii<points.size();ii++)
+    {
+        const PointVertex& pt = points[ii];
+        std::pair<std::unordered_map<uint64_t,uint32_t>::iterator,bool> cell =
+                m_cellIndex.insert(std::make_pair(cellKey(pt,inv_size),uint32_t(chunks.size())));
+        if(cell.second){
+            PointChunk chunk;
+            chunk.first = 0;
+            chunk.count = 0;
+            chunk.min = Vector3(pt.x,pt.y,pt.z);
+            chunk.max = chunk.min;
+            chunks.push_back(chunk);
+        }
+        PointChunk& chunk = chunks[cell.first->second];
+        chunk.count++;
+        chunk.min.x = std::min(chunk.min.x,pt.x);
+        chunk.min.y = std::min(chunk.min.y,pt.y);
+        chunk.min.z = std::min(chunk.min.z,pt.z);
+        chunk.max.x = std::max(chunk.max.x,pt.x);
+        chunk.max.y = std::max(chunk.max.y,pt.y);
+        chunk.max.z = std::max(chunk.max.z,pt.z);
+        m_pointChunk[ii] = cell.first->second;
+    }
+
+    /// Then every point is copied straight to its place
+    m_next.resize(chunks.size());
+    uint32_t first = 0;
+    for(size_t ii=0;ii<chunks.size();ii++)
+    {
+        chunks[ii].first = first;
+        m_next[ii] = first;
+        first += chunks[ii].count;
+    }
+    m_sorted.resize(points.size());
+    for(size_t ii=0;ii<points.size();ii++)
+    {
+        m_sorted[m_next[m_pointChunk[ii]]++] = points[ii];
+    }
+    points.swap(m_sorted);
+}
@@ -0,0 +1,42 @@
+#ifndef POINT_CHUNKS_H
+#define	POINT_CHUNKS_H
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "shared/Matrices.h"
+#include "point_cloud.h"
+
+/// A run of points that share one cell of a coarse grid, and the box around them
+struct PointChunk
+{
+    uint32_t first;///!< Index of the first point
+    uint32_t count;
+    Vector3 min;
+    Vector3 max;
+};
+
+/*!
+ * \brief Reorders a converted cloud so the points of each grid cell are next to each other
+ *
+ * The render thread tests the box of each chunk against the view frustum and only draws the
+ * chunks that can be seen. Cells are cubes of cell_size; the chunks are written in no particular order.
+ */
+class PointChunker
+{
+public:
+    PointChunker();
+
+    void Split(std::vector<PointVertex>& points, std::vector<PointChunk>& chunks);
+
+    float cell_size;///!< VR units
+
+private:
+    std::unordered_map<uint64_t,uint32_t> m_cellIndex;///!< Cell key to chunk index
+    std::vector<uint32_t> m_pointChunk;///!< Chunk index of every point
+    std::vector<uint32_t> m_next;///!< Where the next point of each chunk goes
+    std::vector<PointVertex> m_sorted;
+};
+
+
+#endif	/* POINT_CHUNKS_H */
@@ -0,0 +1,117 @@
+/*!
+ * \brief Checks that the grid coordinates of grid_coord.h, and PointChunker on top of them, survive any coordinate
+ *
+ * Finite but huge coordinates such as ±1e30 from a bad driver used to be converted to an integer before
+ * they were clamped, which is undefined. They have to end up in the outermost cells instead, next to
+ * ordinary points, with every point in exactly one chunk whose box holds it. Returns non-zero on failure.
+ */
+#include <stdio.h>
+#include <limits>
+#include <random>
+#include <vector>
+#include "grid_coord.h"
+#include "point_chunks.h"
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool ok, const char* what)
+{
+    if(!ok){
+        fprintf(stderr,"FAIL %s\n",what);
+        failures++;
+    }
+}
+
+void checkGridCoord()
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    check(gridCoord(0.0f)==uint64_t(GRID_OFFSET),"cell 0 sits at the offset");
+    check(gridCoord(-1.0f)==uint64_t(GRID_OFFSET-1),"cell -1");
+    check(gridCoord(float(-GRID_OFFSET))==0,"lowest cell");
+    check(gridCoord(float(GRID_OFFSET-1))==uint64_t(GRID_MAX),"highest cell");
+    check(gridCoord(float(GRID_OFFSET))==uint64_t(GRID_MAX),"one past the highest cell is clamped");
+    check(gridCoord(1e30f)==uint64_t(GRID_MAX),"1e30 is clamped high");
+    check(gridCoord(-1e30f)==0,"-1e30 is clamped low");
+    check(gridCoord(std::numeric_limits<float>::max())==uint64_t(GRID_MAX),"FLT_MAX is clamped high");
+    check(gridCoord(inf)==uint64_t(GRID_MAX),"infinity is clamped high");
+    check(gridCoord(-inf)==0,"-infinity is clamped low");
+    check(gridCoord(nan)==0,"NAN goes to cell 0");
+}
+
+PointVertex vertex(float x, float y, float z)
+{
+    PointVertex pt;
+    pt.x = x;
+    pt.y = y;
+    pt.z = z;
+    pt.r = pt.g = pt.b = pt.a = 255;
+    return pt;
+}
+
+void checkChunker()
+{
+    const float extremes[] = {1e30f, -1e30f, std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+                              4.0e6f, -4.0e6f, 0.0f, 0.5f, -0.5f};
+    const size_t num_extremes = sizeof(extremes)/sizeof(extremes[0]);
+    std::vector<PointVertex> points;
+    for(size_t ii=0;ii<num_extremes;ii++){
+        for(size_t jj=0;jj<num_extremes;jj++){
+            points.push_back(vertex(extremes[ii],extremes[jj],extremes[(ii+jj)%num_extremes]));
+        }
+    }
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> near(-10.0f,10.0f);
+    for(int ii=0;ii<1000;ii++){
+        points.push_back(vertex(near(rng),near(rng),near(rng)));
+    }
+    const size_t num_points = points.size();
+
+    PointChunker chunker;
+    chunker.cell_size = 2.0f;
+    std::vector<PointChunk> chunks;
+    chunker.Split(points,chunks);
+
+    check(points.size()==num_points,"no points are lost");
+    size_t total = 0;
+    bool contained = true;
+    for(size_t cc=0;cc<chunks.size();cc++)
+    {
+        const PointChunk& chunk = chunks[cc];
+        total += chunk.count;
+        for(uint32_t ii=chunk.first;ii<chunk.first+chunk.count && ii<points.size();ii++){
+            const PointVertex& pt = points[ii];
+            contained = contained && pt.x>=chunk.min.x && pt.x<=chunk.max.x
+                                  && pt.y>=chunk.min.y && pt.y<=chunk.max.y
+                                  && pt.z>=chunk.min.z && pt.z<=chunk.max.z;
+        }
+    }
+    check(total==num_points,"every point is in exactly one chunk");
+    check(contained,"every chunk box holds its points");
+
+    /// Clamped points share the outermost cells with each other, but never a cell with the points near the origin
+    bool separate = true;
+    for(size_t cc=0;cc<chunks.size();cc++)
+    {
+        const PointChunk& chunk = chunks[cc];
+        const float lo[3] = {chunk.min.x,chunk.min.y,chunk.min.z};
+        const float hi[3] = {chunk.max.x,chunk.max.y,chunk.max.z};
+        for(int axis=0;axis<3;axis++){
+            separate = separate && !(lo[axis]<=-1e6f && hi[axis]>-20.0f) && !(hi[axis]>=1e6f && lo[axis]<20.0f);
+        }
+    }
+    check(separate,"far points stay out of the cells near the origin");
+}
+
+}
+
+int main()
+{
+    checkGridCoord();
+    checkChunker();
+    printf("%s\n",failures ? "point chunks: FAILED" : "point chunks: ok");
+    return failures ? 1 : 0;
+}
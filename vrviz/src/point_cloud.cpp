@@ -0,0 +1,622 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <ros/ros.h>
+#include "point_cloud.h"
+#include "point_kernels.h"
+#include "grid_coord.h"
+
+namespace
+{
+
+/// Size in bytes of a sensor_msgs::PointField datatype, or 0 if it is unknown
+uint32_t fieldSize(uint8_t datatype)
+{
+    switch(datatype)
+    {
+        case sensor_msgs::PointField::INT8:
+        case sensor_msgs::PointField::UINT8:
+            return 1;
+        case sensor_msgs::PointField::INT16:
+        case sensor_msgs::PointField::UINT16:
+            return 2;
+        case sensor_msgs::PointField::INT32:
+        case sensor_msgs::PointField::UINT32:
+        case sensor_msgs::PointField::FLOAT32:
+            return 4;
+        case sensor_msgs::PointField::FLOAT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/// Read a single value of any PointField datatype as a float.
+/// memcpy is used since PointCloud2 makes no alignment guarantees.
+inline float readField(const uint8_t* ptr, uint8_t datatype)
+{
+    switch(datatype)
+    {
+        case sensor_msgs::PointField::INT8:    { int8_t   v; memcpy(&v,ptr,sizeof(v)); return v; }
+        case sensor_msgs::PointField::UINT8:   { uint8_t  v; memcpy(&v,ptr,sizeof(v)); return v; }
+        case sensor_msgs::PointField::INT16:   { int16_t  v; memcpy(&v,ptr,sizeof(v)); return v; }
+        case sensor_msgs::PointField::UINT16:  { uint16_t v; memcpy(&v,ptr,sizeof(v)); return v; }
+        case sensor_msgs::PointField::INT32:   { int32_t  v; memcpy(&v,ptr,sizeof(v)); return v; }
+        case sensor_msgs::PointField::UINT32:  { uint32_t v; memcpy(&v,ptr,sizeof(v)); return v; }
+        case sensor_msgs::PointField::FLOAT32: { float    v; memcpy(&v,ptr,sizeof(v)); return v; }
+        case sensor_msgs::PointField::FLOAT64: { double   v; memcpy(&v,ptr,sizeof(v)); return v; }
+        default: return 0.0f;
+    }
+}
+
+/// Voxel edge length in real world units to start from when only max_points is set
+const float BUDGET_VOXEL_SIZE = 0.01f;
+
+/*!
+ * \brief Pack the voxel coordinates of a point into one key, 21 bits per axis
+ *
+ * \return false if the point has no voxel, because a coordinate (or its product with inv_size) is not finite
+ */
+inline bool voxelKey(float x, float y, float z, float inv_size, uint64_t& key)
+{
+    const float vx = std::floor(x*inv_size);
+    const float vy = std::floor(y*inv_size);
+    const float vz = std::floor(z*inv_size);
+    if(!std::isfinite(vx) || !std::isfinite(vy) || !std::isfinite(vz)){
+        return false;
+    }
+    key = (gridCoord(vx)<<(2*GRID_BITS)) | (gridCoord(vy)<<GRID_BITS) | gridCoord(vz);
+    return true;
+}
+
+}
+
+const size_t PointCloudDecoder::BLOCK_SIZE;
+const size_t PointCloudDecoder::CHUNK_SIZE;
+
+PointCloudDecoder::PointCloudDecoder()
+    : scaling_factor(1.0f)
+    , axis_colored(false)
+    , use_hsv(true)
+    , intensity_max(0.0f)
+    , worker_pool(NULL)
+    , voxel_size(0.0f)
+    , max_points(0)
+    , gpu_colormap(false)
+    , scalar_min(0.0f)
+    , scalar_max(0.0f)
+    , m_xyzFloat(false)
+    , m_colorMode(COLOR_SOLID)
+    , m_scalars(false)
+    , m_zMin(0.0f)
+    , m_zMax(0.0f)
+    , m_voxelScale(1.0f)
+    , m_voxelSize(0.0f)
+{
+}
+
+bool PointCloudDecoder::LookupField(const sensor_msgs::PointCloud2& cloud, const char* name, Field& field)
+{
+    field = Field();
+    for(size_t ii=0;ii<cloud.fields.size();ii++)
+    {
+        const sensor_msgs::PointField& pf = cloud.fields[ii];
+        if(pf.name!=name){
+            continue;
+        }
+        uint32_t size = fieldSize(pf.datatype);
+        if(size==0 || pf.offset+size>cloud.point_step){
+            ROS_WARN_THROTTLE(5.0,"Point cloud field '%s' has an unsupported datatype (%d) or offset (%d)",name,int(pf.datatype),int(pf.offset));
+            return false;
+        }
+        field.offset = pf.offset;
+        field.datatype = pf.datatype;
+        field.valid = true;
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * \brief Work out where each channel lives in the point, and how the cloud will be colored
+ *
+ * \param cloud The message whose field table should be read
+ * \return false if the cloud cannot be decoded (no x/y/z, big endian or truncated data)
+ */
+bool PointCloudDecoder::ParseFields(const sensor_msgs::PointCloud2& cloud)
+{
+    if(cloud.is_bigendian){
+        ROS_ERROR_THROTTLE(5.0,"Big endian point clouds are not supported");
+        return false;
+    }
+    if(!LookupField(cloud,"x",m_x) || !LookupField(cloud,"y",m_y) || !LookupField(cloud,"z",m_z)){
+        ROS_ERROR_THROTTLE(5.0,"Point cloud is missing an x, y or z field");
+        return false;
+    }
+    if(size_t(cloud.row_step)*cloud.height > cloud.data.size() || size_t(cloud.point_step)*cloud.width > cloud.row_step){
+        ROS_ERROR_THROTTLE(5.0,"Point cloud data is smaller than its header claims (%d bytes for %dx%d points)",
+                           int(cloud.data.size()),int(cloud.width),int(cloud.height));
+        return false;
+    }
+    m_xyzFloat = m_x.datatype==sensor_msgs::PointField::FLOAT32 &&
+                 m_y.datatype==sensor_msgs::PointField::FLOAT32 &&
+                 m_z.datatype==sensor_msgs::PointField::FLOAT32;
+
+    /// The packed color is 4 bytes, stored b,g,r,a in memory (it is usually typed as a float)
+    if(!LookupField(cloud,"rgb",m_rgb)){
+        LookupField(cloud,"rgba",m_rgb);
+    }
+    if(m_rgb.valid && fieldSize(m_rgb.datatype)!=4){
+        m_rgb.valid = false;
+    }
+    LookupField(cloud,"intensity",m_intensity);
+
+    if(axis_colored){
+        m_colorMode = COLOR_AXIS;
+    }else if(m_rgb.valid){ /// We prefer color channel info, if it has it
+        m_colorMode = COLOR_RGB;
+    }else if(m_intensity.valid){ /// Intensity can be mapped to color
+        m_colorMode = COLOR_INTENSITY;
+    }else{ /// If we have no useful info, we pick a solid color.
+        m_colorMode = COLOR_SOLID;
+    }
+    m_scalars = gpu_colormap && (m_colorMode==COLOR_INTENSITY || m_colorMode==COLOR_AXIS);
+    return true;
+}
+
+/*!
+ * \brief Convert up to BLOCK_SIZE points from one row of the cloud
+ *
+ * The points are gathered into separate x/y/z and color arrays so the SIMD kernels can
+ * work on them, then the finite ones are interleaved into out.
+ *
+ * \param pt First point of the block in the message buffer
+ * \param point_step Bytes between points
+ * \param n Number of points, at most BLOCK_SIZE
+ * \param out Where the first finite point is written
+ * \param chunk Running z range and intensity max of the chunk this block is part of, updated
+ *
+ * Intensities are written as raw scalars, since the ramp needs the max of the whole cloud.
+ * Decode() colors them once every chunk is done, unless the shader does it.
+ * \param voxels If not NULL, the finite points are added to these voxels instead of written to out
+ * \return The number of finite points written to out
+ */
+size_t PointCloudDecoder::DecodeBlock(const uint8_t* pt, uint32_t point_step, size_t n, PointVertex* out, Chunk& chunk, VoxelMap* voxels) const
+{
+    const PointKernels& kernels = GetPointKernels();
+    float x[BLOCK_SIZE],y[BLOCK_SIZE],z[BLOCK_SIZE];
+    float intensity[BLOCK_SIZE];
+    uint32_t rgb[BLOCK_SIZE];
+    uint32_t rgba[BLOCK_SIZE];
+    uint8_t keep[BLOCK_SIZE];
+
+    for(size_t ii=0;ii<n;ii++,pt+=point_step)
+    {
+        if(m_xyzFloat){
+            memcpy(&x[ii],pt+m_x.offset,sizeof(float));
+            memcpy(&y[ii],pt+m_y.offset,sizeof(float));
+            memcpy(&z[ii],pt+m_z.offset,sizeof(float));
+        }else{
+            x[ii] = readField(pt+m_x.offset,m_x.datatype);
+            y[ii] = readField(pt+m_y.offset,m_y.datatype);
+            z[ii] = readField(pt+m_z.offset,m_z.datatype);
+        }
+        if(m_colorMode==COLOR_RGB){
+            memcpy(&rgb[ii],pt+m_rgb.offset,sizeof(uint32_t));
+        }else if(m_colorMode==COLOR_INTENSITY){
+            intensity[ii] = readField(pt+m_intensity.offset,m_intensity.datatype);
+        }
+    }
+
+    /// We scale up from real world units to 'vr units', and flag NAN points, since they would not render well
+    kernels.scale_finite(x,y,z,n,scaling_factor,keep);
+
+    if(m_colorMode==COLOR_INTENSITY)
+    {
+        /// Only the range is tracked here; the ramp is applied to the whole cloud afterwards
+        for(size_t ii=0;ii<n;ii++){
+            if(keep[ii] && intensity[ii] > chunk.intensity_max){
+                chunk.intensity_max = intensity[ii];
+            }
+        }
+        memcpy(rgba,intensity,n*sizeof(float));
+    }
+    else if(m_scalars)
+    {
+        /// The shader does the coloring of the height
+        memcpy(rgba,z,n*sizeof(float));
+    }
+    else
+    {
+        switch(m_colorMode)
+        {
+            case COLOR_RGB:
+                kernels.rgb_to_rgba8(rgb,n,rgba);
+                break;
+            case COLOR_AXIS:
+                /// Needs the z range of the whole cloud, so this is filled in by Decode()
+                break;
+            default:
+                /// The color is just solid red. This could be a param.
+                std::fill(rgba,rgba+n,0xff0000ffu);
+                break;
+        }
+    }
+
+    if(voxels)
+    {
+        const float inv_size = 1.0f/m_voxelSize;
+        uint64_t key;
+        for(size_t ii=0;ii<n;ii++)
+        {
+            if(!keep[ii] || !voxelKey(x[ii],y[ii],z[ii],inv_size,key)){
+                continue;
+            }
+            Voxel& voxel = (*voxels)[key];
+            voxel.x += x[ii];
+            voxel.y += y[ii];
+            voxel.z += z[ii];
+            if(HasRawScalars()){
+                float value;
+                memcpy(&value,&rgba[ii],sizeof(float));
+                voxel.r += value;
+            }else if(m_colorMode!=COLOR_AXIS){
+                uint8_t color[4];
+                memcpy(color,&rgba[ii],sizeof(uint32_t));
+                voxel.r += color[0];
+                voxel.g += color[1];
+                voxel.b += color[2];
+                voxel.a += color[3];
+            }
+            voxel.count++;
+            chunk.z_max = std::max(chunk.z_max,z[ii]);
+            chunk.z_min = std::min(chunk.z_min,z[ii]);
+        }
+        return 0;
+    }
+
+    PointVertex* first = out;
+    for(size_t ii=0;ii<n;ii++)
+    {
+        if(!keep[ii]){
+            continue;
+        }
+        out->x = x[ii];
+        out->y = y[ii];
+        out->z = z[ii];
+        memcpy(&out->r,&rgba[ii],sizeof(uint32_t));
+        chunk.z_max = std::max(chunk.z_max,z[ii]);
+        chunk.z_min = std::min(chunk.z_min,z[ii]);
+        out++;
+    }
+    return out-first;
+}
+
+/*!
+ * \brief Convert the points [begin,end) of the cloud, counting across rows
+ *
+ * \param cloud The message to convert
+ * \param begin Index of the first point
+ * \param end One past the index of the last point
+ * \param out Where the first finite point is written
+ * \param chunk Output; number of points written, their z range and the intensity max
+ * \param voxels If not NULL, the points are added to these voxels instead of written to out
+ */
+void PointCloudDecoder::DecodeChunk(const sensor_msgs::PointCloud2& cloud, size_t begin, size_t end, PointVertex* out, Chunk& chunk, VoxelMap* voxels) const
+{
+    size_t idx = begin;
+    while(idx<end)
+    {
+        size_t row = idx/cloud.width;
+        size_t col = idx%cloud.width;
+        size_t n = std::min(std::min<size_t>(BLOCK_SIZE,end-idx),cloud.width-col);
+        const uint8_t* pt = cloud.data.data() + row*cloud.row_step + col*cloud.point_step;
+        chunk.count += DecodeBlock(pt,cloud.point_step,n,out+chunk.count,chunk,voxels);
+        idx += n;
+    }
+}
+
+/*!
+ * \brief Convert every finite point of the cloud into vertdata
+ *
+ * ParseFields() must have succeeded on this cloud (or one with the same layout) first.
+ * If a worker pool has been set, the cloud is split into chunks of CHUNK_SIZE points
+ * that are converted in parallel into their own slice of vertdata, and the slices are
+ * then moved down next to each other to drop the gaps left by NAN points.
+ *
+ * When voxel filtering is on, each chunk fills its own voxel map instead, and the maps
+ * are merged into the output afterwards by MergeVoxels().
+ *
+ * \param cloud The message to convert
+ * \param vertdata Output, resized to the number of finite points
+ * \return The number of points written
+ */
+size_t PointCloudDecoder::Decode(const sensor_msgs::PointCloud2& cloud, std::vector<PointVertex>& vertdata)
+{
+    const size_t num_points = size_t(cloud.width)*cloud.height;
+    const size_t num_chunks = (num_points+CHUNK_SIZE-1)/CHUNK_SIZE;
+
+    /// Work out whether this cloud goes through the voxel grid, and how coarse it is
+    m_voxelSize = 0.0f;
+    if(voxel_size>0.0f){
+        m_voxelSize = voxel_size*m_voxelScale*scaling_factor;
+    }else if(max_points>0 && num_points>max_points){
+        m_voxelSize = BUDGET_VOXEL_SIZE*m_voxelScale*scaling_factor;
+    }
+    const bool use_voxels = m_voxelSize>0.0f;
+    if(use_voxels){
+        m_chunkVoxels.resize(num_chunks);
+        for(size_t ii=0;ii<num_chunks;ii++){
+            m_chunkVoxels[ii].clear();
+        }
+    }else{
+        vertdata.resize(num_points);
+    }
+
+    Chunk empty;
+    empty.count = 0;
+    empty.z_min = 0.0;
+    empty.z_max = 0.0;
+    empty.intensity_max = 0.0;
+    m_chunks.assign(num_chunks,empty);
+
+    boost::function<void(size_t)> decode_chunk = [&](size_t ii){
+        size_t begin = ii*CHUNK_SIZE;
+        if(use_voxels){
+            DecodeChunk(cloud,begin,std::min(begin+CHUNK_SIZE,num_points),NULL,m_chunks[ii],&m_chunkVoxels[ii]);
+        }else{
+            DecodeChunk(cloud,begin,std::min(begin+CHUNK_SIZE,num_points),&vertdata[begin],m_chunks[ii],NULL);
+        }
+    };
+    if(worker_pool){
+        worker_pool->ParallelFor(num_chunks,decode_chunk);
+    }else{
+        for(size_t ii=0;ii<num_chunks;ii++){
+            decode_chunk(ii);
+        }
+    }
+
+    /// Stitch the slices together. Each slice only ever moves towards the front, so a forward memmove is safe.
+    size_t num_valid = 0;
+    float z_max = 0.0;
+    float z_min = 0.0;
+    for(size_t ii=0;ii<num_chunks;ii++)
+    {
+        const Chunk& chunk = m_chunks[ii];
+        if(num_valid!=ii*CHUNK_SIZE && chunk.count>0){
+            memmove(&vertdata[num_valid],&vertdata[ii*CHUNK_SIZE],chunk.count*sizeof(PointVertex));
+        }
+        num_valid += chunk.count;
+        z_max = std::max(z_max,chunk.z_max);
+        z_min = std::min(z_min,chunk.z_min);
+        intensity_max = std::max(intensity_max,chunk.intensity_max);
+    }
+    if(use_voxels){
+        num_valid = MergeVoxels(vertdata);
+    }else{
+        vertdata.resize(num_valid);
+    }
+
+    m_zMin = z_min;
+    m_zMax = z_max;
+    /// The ramps need the range of the whole cloud, so they run only now that every chunk has been reduced.
+    /// That way a point gets the same color however the cloud was split up.
+    if(!m_scalars && (m_colorMode==COLOR_AXIS || m_colorMode==COLOR_INTENSITY))
+    {
+        boost::function<void(size_t)> color_chunk = [&](size_t ii){
+            size_t begin = ii*CHUNK_SIZE;
+            size_t end = std::min(begin+CHUNK_SIZE,num_valid);
+            if(begin>=end){
+                return;
+            }
+            if(m_colorMode==COLOR_AXIS){
+                ColorByAxis(&vertdata[begin],end-begin,z_min,z_max);
+            }else{
+                ColorByIntensity(&vertdata[begin],end-begin,intensity_max);
+            }
+        };
+        size_t num_color_chunks = (num_valid+CHUNK_SIZE-1)/CHUNK_SIZE;
+        if(worker_pool){
+            worker_pool->ParallelFor(num_color_chunks,color_chunk);
+        }else{
+            for(size_t ii=0;ii<num_color_chunks;ii++){
+                color_chunk(ii);
+            }
+        }
+    }
+    return num_valid;
+}
+
+/*!
+ * \brief Combine the voxel maps of every chunk, and write one averaged point per voxel
+ *
+ * If there are more voxels than max_points, they are merged into coarser voxels (each one
+ * binned by its centroid) until they fit, and the larger size is remembered for the next
+ * cloud. Once the clouds fit comfortably again the size slowly goes back down.
+ *
+ * \param vertdata Output, resized to the number of voxels
+ * \return The number of points written
+ */
+size_t PointCloudDecoder::MergeVoxels(std::vector<PointVertex>& vertdata)
+{
+    m_voxels.clear();
+    for(size_t ii=0;ii<m_chunkVoxels.size();ii++)
+    {
+        for(VoxelMap::const_iterator it=m_chunkVoxels[ii].begin();it!=m_chunkVoxels[ii].end();++it)
+        {
+            Voxel& voxel = m_voxels[it->first];
+            voxel.x += it->second.x;
+            voxel.y += it->second.y;
+            voxel.z += it->second.z;
+            voxel.r += it->second.r;
+            voxel.g += it->second.g;
+            voxel.b += it->second.b;
+            voxel.a += it->second.a;
+            voxel.count += it->second.count;
+        }
+    }
+
+    while(max_points>0 && m_voxels.size()>max_points)
+    {
+        /// Surfaces shrink with the square of the voxel size and volumes with the cube, so this may take a few rounds
+        float factor = std::max(1.25f,std::cbrt(float(m_voxels.size())/max_points));
+        m_voxelScale *= factor;
+        m_voxelSize *= factor;
+        const float inv_size = 1.0f/m_voxelSize;
+        m_coarseVoxels.clear();
+        for(VoxelMap::const_iterator it=m_voxels.begin();it!=m_voxels.end();++it)
+        {
+            const Voxel& fine = it->second;
+            uint64_t key;
+            if(!voxelKey(fine.x/fine.count,fine.y/fine.count,fine.z/fine.count,inv_size,key)){
+                continue;
+            }
+            Voxel& voxel = m_coarseVoxels[key];
+            voxel.x += fine.x;
+            voxel.y += fine.y;
+            voxel.z += fine.z;
+            voxel.r += fine.r;
+            voxel.g += fine.g;
+            voxel.b += fine.b;
+            voxel.a += fine.a;
+            voxel.count += fine.count;
+        }
+        m_voxels.swap(m_coarseVoxels);
+    }
+    if(max_points>0 && m_voxels.size()<max_points/2 && m_voxelScale>1.0f){
+        m_voxelScale = std::max(1.0f,m_voxelScale*0.9f);
+    }
+
+    vertdata.resize(m_voxels.size());
+    PointVertex* out = vertdata.data();
+    for(VoxelMap::const_iterator it=m_voxels.begin();it!=m_voxels.end();++it,++out)
+    {
+        const Voxel& voxel = it->second;
+        const float inv_count = 1.0f/voxel.count;
+        out->x = voxel.x*inv_count;
+        out->y = voxel.y*inv_count;
+        out->z = voxel.z*inv_count;
+        if(HasRawScalars()){
+            SetPointScalar(*out,voxel.r*inv_count);
+            continue;
+        }
+        out->r = voxel.r*inv_count+0.5f;
+        out->g = voxel.g*inv_count+0.5f;
+        out->b = voxel.b*inv_count+0.5f;
+        out->a = voxel.a*inv_count+0.5f;
+    }
+    return vertdata.size();
+}
+
+/*!
+ * \brief Fill in the color of already converted points from their height
+ *
+ * \param verts Interleaved points, as written by DecodeBlock()
+ * \param n Number of points
+ * \param z_min Lowest z in the cloud, which maps to the start of the ramp
+ * \param z_max Highest z in the cloud, which maps to the end of the ramp
+ */
+void PointCloudDecoder::ColorByAxis(PointVertex* verts, size_t n, float z_min, float z_max) const
+{
+    const PointKernels& kernels = GetPointKernels();
+    float z[BLOCK_SIZE];
+    float r[BLOCK_SIZE],g[BLOCK_SIZE],b[BLOCK_SIZE];
+    uint32_t rgba[BLOCK_SIZE];
+
+    for(size_t start=0;start<n;start+=BLOCK_SIZE)
+    {
+        size_t count = std::min<size_t>(BLOCK_SIZE,n-start);
+        PointVertex* vert = verts + start;
+        for(size_t ii=0;ii<count;ii++){
+            z[ii] = vert[ii].z;
+        }
+        kernels.axis_ramp(z,count,z_min,z_max-z_min,use_hsv,r,g,b);
+        kernels.pack_rgba8(r,g,b,count,rgba);
+        for(size_t ii=0;ii<count;ii++){
+            memcpy(&vert[ii].r,&rgba[ii],sizeof(uint32_t));
+        }
+    }
+}
+
+/*!
+ * \brief Fill in the color of already converted points from the intensity that DecodeBlock() left in them
+ *
+ * Convert intensity into a color spectrum, going from 0.0=blue to max=white.
+ * This was chosen since black->white doesn't render well on the black background,
+ * and the rainbow color scheme has repeatedly been proven awful in every way.
+ *
+ * \param verts Interleaved points, holding their intensity as a scalar
+ * \param n Number of points
+ * \param max Largest intensity seen so far, same as the default for rviz
+ */
+void PointCloudDecoder::ColorByIntensity(PointVertex* verts, size_t n, float max) const
+{
+    const PointKernels& kernels = GetPointKernels();
+    float intensity[BLOCK_SIZE];
+    float r[BLOCK_SIZE],g[BLOCK_SIZE],b[BLOCK_SIZE];
+    uint32_t rgba[BLOCK_SIZE];
+
+    for(size_t start=0;start<n;start+=BLOCK_SIZE)
+    {
+        size_t count = std::min<size_t>(BLOCK_SIZE,n-start);
+        PointVertex* vert = verts + start;
+        for(size_t ii=0;ii<count;ii++){
+            intensity[ii] = GetPointScalar(vert[ii]);
+        }
+        kernels.intensity_ramp(intensity,count,max,r,g,b);
+        kernels.pack_rgba8(r,g,b,count,rgba);
+        for(size_t ii=0;ii<count;ii++){
+            memcpy(&vert[ii].r,&rgba[ii],sizeof(uint32_t));
+        }
+    }
+}
+
+/*!
+ * \brief Get the scalar values that map to the two ends of the colormap
+ *
+ * This is scalar_min/scalar_max when they are set. Otherwise intensities go from 0 to the
+ * largest intensity seen so far, and heights span the z range of the last cloud.
+ *
+ * \param min Output; value at the start of the colormap
+ * \param max Output; value at the end of the colormap
+ */
+void PointCloudDecoder::GetScalarRange(float& min, float& max) const
+{
+    const float scale = m_colorMode==COLOR_AXIS ? scaling_factor : 1.0f;
+    if(scalar_max>scalar_min){
+        min = scalar_min*scale;
+        max = scalar_max*scale;
+    }else if(m_colorMode==COLOR_AXIS){
+        min = m_zMin;
+        max = m_zMax;
+    }else{
+        min = 0.0f;
+        max = intensity_max;
+    }
+}
+
+/*!
+ * \brief Sample the ramp of the current color mode into a colormap texture
+ *
+ * The same kernels that color the points on the CPU are used, so switching gpu_colormap
+ * on does not change how a cloud looks.
+ *
+ * \param texels Output; RGBA8 texels as laid out in memory, from the start of the ramp to the end
+ */
+void PointCloudDecoder::GetColormap(std::vector<uint32_t>& texels) const
+{
+    const PointKernels& kernels = GetPointKernels();
+    const size_t n = BLOCK_SIZE;
+    float value[BLOCK_SIZE];
+    float r[BLOCK_SIZE],g[BLOCK_SIZE],b[BLOCK_SIZE];
+    for(size_t ii=0;ii<n;ii++){
+        value[ii] = float(ii)/(n-1);
+    }
+    if(m_colorMode==COLOR_AXIS){
+        kernels.axis_ramp(value,n,0.0f,1.0f,use_hsv,r,g,b);
+    }else{
+        kernels.intensity_ramp(value,n,1.0f,r,g,b);
+    }
+    texels.resize(n);
+    kernels.pack_rgba8(r,g,b,n,&texels[0]);
+}
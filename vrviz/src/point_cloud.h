@@ -0,0 +1,149 @@
+#ifndef POINT_CLOUD_H
+#define	POINT_CLOUD_H
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+#include <sensor_msgs/PointCloud2.h>
+#include "worker_pool.h"
+
+/// Packed point layout used by the point cloud VAO; float position plus normalized RGBA8 color, 16 bytes per point
+/// When the decoder outputs scalars (see PointCloudDecoder::HasScalars()) the color bytes hold a float instead.
+/// That keeps the point at 16 bytes rather than shrinking it; what the scalar buys is that the colormap and its
+/// range live in the shader, so changing either never touches the points already uploaded.
+struct PointVertex
+{
+    float x, y, z;
+    uint8_t r, g, b, a;
+};
+
+/// Store a float in place of the color of a point
+inline void SetPointScalar(PointVertex& pt, float value)
+{
+    memcpy(&pt.r,&value,sizeof(float));
+}
+
+inline float GetPointScalar(const PointVertex& pt)
+{
+    float value;
+    memcpy(&value,&pt.r,sizeof(float));
+    return value;
+}
+
+/*!
+ * \brief Converts sensor_msgs::PointCloud2 messages directly into the render vertex layout
+ *
+ * The field table of the message is read once to find where x/y/z and the optional
+ * rgb/intensity channels live, after which the raw message buffer is walked a single
+ * time. Points with a non-finite coordinate are dropped as they are found, so there
+ * are no intermediate pcl::PointCloud copies and no separate NaN removal pass.
+ *
+ * The per-point math is done a block at a time by the kernels in point_kernels.h.
+ *
+ * The output is PointVertex: x,y,z scaled into VR units, followed by an RGBA8 color.
+ *
+ * Optionally the points are merged into a voxel grid as they are converted, so only one
+ * averaged point per voxel is output. If that still leaves more than max_points, the
+ * voxels are merged into coarser ones until it fits, and the coarser size is kept for the
+ * following clouds.
+ *
+ * With gpu_colormap set, intensity and height colored clouds are not colored here at all.
+ * The raw intensity (or z, in VR units) is written in place of the color, and the point
+ * shader looks it up in a colormap texture between the bounds given by GetScalarRange().
+ */
+class PointCloudDecoder
+{
+public:
+    PointCloudDecoder();
+
+    /// How the points are colored, picked by ParseFields() from the available channels
+    enum ColorMode {
+        COLOR_SOLID,     ///!< No useful channel, every point is solid red
+        COLOR_RGB,       ///!< Packed rgb/rgba channel
+        COLOR_INTENSITY, ///!< Intensity mapped from blue (0.0) to white (intensity_max)
+        COLOR_AXIS       ///!< Height (z) mapped through a color ramp
+    };
+
+    static const size_t BLOCK_SIZE = 256;///!< Points handed to the SIMD kernels at a time
+    static const size_t CHUNK_SIZE = 64*BLOCK_SIZE;///!< Points converted by one worker task
+
+    bool ParseFields(const sensor_msgs::PointCloud2& cloud);
+    size_t Decode(const sensor_msgs::PointCloud2& cloud, std::vector<PointVertex>& vertdata);
+
+    ColorMode GetColorMode() const { return m_colorMode; }
+
+    /// True if the last cloud was output as scalars rather than colors
+    bool HasScalars() const { return m_scalars; }
+    void GetScalarRange(float& min, float& max) const;
+    void GetColormap(std::vector<uint32_t>& texels) const;
+
+    /// Voxel edge length used on the last cloud, in real world units, or 0 if it was not filtered
+    float GetVoxelSize() const { return m_voxelSize/scaling_factor; }
+
+    float scaling_factor;///!< Unitless; applied to every coordinate to go from real world units to 'vr units'
+    bool axis_colored;///!< If true, color by height even if the cloud has rgb or intensity
+    bool use_hsv;///!< Only used when axis_colored; pick between the HSV ramp and the blue->red->yellow ramp
+    float intensity_max;///!< Largest intensity seen so far, used to normalize the intensity ramp
+    WorkerPool* worker_pool;///!< If set, chunks of the cloud are converted in parallel on this pool
+    float voxel_size;///!< Voxel edge length in real world units; 0 disables the voxel grid unless max_points is exceeded
+    size_t max_points;///!< Most points a cloud may turn into; 0 for no limit
+    bool gpu_colormap;///!< If true, output intensity or height as a scalar and let the shader color it
+    float scalar_min;///!< Fixed colormap range for gpu_colormap, in the units of the channel; only used if scalar_max>scalar_min
+    float scalar_max;
+
+private:
+    struct Field {
+        Field() : offset(0), datatype(0), valid(false) {}
+        uint32_t offset;
+        uint8_t datatype;
+        bool valid;
+    };
+
+    /// Running sums of the points that fell into one voxel
+    struct Voxel {
+        Voxel() : x(0), y(0), z(0), r(0), g(0), b(0), a(0), count(0) {}
+        float x, y, z;
+        float r, g, b, a;
+        uint32_t count;
+    };
+    typedef std::unordered_map<uint64_t,Voxel> VoxelMap;
+
+    /// Result of converting one CHUNK_SIZE slice of the cloud
+    struct Chunk {
+        size_t count;
+        float z_min;
+        float z_max;
+        float intensity_max;
+    };
+
+    bool LookupField(const sensor_msgs::PointCloud2& cloud, const char* name, Field& field);
+    void DecodeChunk(const sensor_msgs::PointCloud2& cloud, size_t begin, size_t end, PointVertex* out, Chunk& chunk, VoxelMap* voxels) const;
+    size_t DecodeBlock(const uint8_t* pt, uint32_t point_step, size_t n, PointVertex* out, Chunk& chunk, VoxelMap* voxels) const;
+    size_t MergeVoxels(std::vector<PointVertex>& vertdata);
+    void ColorByAxis(PointVertex* verts, size_t n, float z_min, float z_max) const;
+    void ColorByIntensity(PointVertex* verts, size_t n, float max) const;
+
+    /// True while the decoded points hold a scalar rather than a color: always for intensities until they are ramped
+    bool HasRawScalars() const { return m_scalars || m_colorMode==COLOR_INTENSITY; }
+
+    Field m_x;
+    Field m_y;
+    Field m_z;
+    Field m_rgb;
+    Field m_intensity;
+    bool m_xyzFloat;
+    ColorMode m_colorMode;
+    bool m_scalars;
+    float m_zMin;///!< z range of the last cloud, in VR units
+    float m_zMax;
+    std::vector<Chunk> m_chunks;
+    std::vector<VoxelMap> m_chunkVoxels;///!< Per chunk, so workers never share a map
+    VoxelMap m_voxels;
+    VoxelMap m_coarseVoxels;
+    float m_voxelScale;///!< Grows past 1 when the budget forces coarser voxels, and slowly shrinks back
+    float m_voxelSize;///!< Edge length in VR units used for the current cloud, 0 if not filtering
+};
+
+
+#endif	/* POINT_CLOUD_H */
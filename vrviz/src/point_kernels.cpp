@@ -0,0 +1,470 @@
+#include <cmath>
+#include <algorithm>
+#include "point_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define POINT_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/// The SIMD versions below only vectorize the bulk of each block, and call these for the tail,
+/// so any change here needs to be mirrored in the SIMD code to keep the results identical.
+namespace
+{
+
+inline float axisVal(float z, float z_min, float z_range)
+{
+    return z_range > 0.0f ? (z-z_min)/z_range : 0.0f;
+}
+
+/// Clamp to 0->1 before the HSV region is truncated to int, which is undefined for NAN and huge values.
+/// Written as compares so NAN maps to 0, the same as the SIMD min/max instructions.
+inline float hsvVal(float val)
+{
+    val = val > 0.0f ? val : 0.0f;
+    return val < 1.0f ? val : 1.0f;
+}
+
+void scaleFiniteScalar(float* x, float* y, float* z, size_t n, float scale, uint8_t* keep)
+{
+    for(size_t i=0;i<n;i++)
+    {
+        keep[i] = std::isfinite(x[i]) && std::isfinite(y[i]) && std::isfinite(z[i]);
+        x[i] *= scale;
+        y[i] *= scale;
+        z[i] *= scale;
+    }
+}
+
+void rgbToRgba8Scalar(const uint32_t* packed, size_t n, uint32_t* rgba)
+{
+    for(size_t i=0;i<n;i++)
+    {
+        uint32_t p = packed[i];
+        rgba[i] = 0xff000000u | ((p & 0xff)<<16) | (p & 0xff00) | ((p>>16) & 0xff);
+    }
+}
+
+/// Written as compares rather than std::min/max so NAN maps to 0, the same as the SIMD min/max instructions
+inline uint32_t toByte(float v)
+{
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 1.0f ? v : 1.0f;
+    return uint32_t(v*255.0f+0.5f);
+}
+
+void packRgba8Scalar(const float* r, const float* g, const float* b, size_t n, uint32_t* rgba)
+{
+    for(size_t i=0;i<n;i++)
+    {
+        rgba[i] = 0xff000000u | (toByte(b[i])<<16) | (toByte(g[i])<<8) | toByte(r[i]);
+    }
+}
+
+void intensityRampScalar(const float* intensity, size_t n, float max, float* r, float* g, float* b)
+{
+    for(size_t i=0;i<n;i++)
+    {
+        float ratio = max > 0.0f ? intensity[i]/max : 0.0f;
+        r[i] = 1.0f-ratio;
+        g[i] = 1.0f-ratio;
+        b[i] = 1.0f;
+    }
+}
+
+void axisRampScalar(const float* z, size_t n, float z_min, float z_range, bool hsv, float* r, float* g, float* b)
+{
+    for(size_t i=0;i<n;i++)
+    {
+        float val = axisVal(z[i],z_min,z_range);
+        if(hsv)
+        {
+            val = hsvVal(val);
+            int region = int(val * 360.0f / 43.0f);
+            float remainder = (val * 360.0f - float(region * 43)) * 6.0f / 256.0f;
+
+            float q = 1.0f - (remainder);
+            float t = (remainder);
+
+            switch (region)
+            {
+                case 0:
+                    r[i] = 1.0f; g[i] = t; b[i] = 0.0f;
+                    break;
+                case 1:
+                    r[i] = q; g[i] = 1.0f; b[i] = 0.0f;
+                    break;
+                case 2:
+                    r[i] = 0.0f; g[i] = 1.0f; b[i] = t;
+                    break;
+                case 3:
+                    r[i] = 0.0f; g[i] = q; b[i] = 1.0f;
+                    break;
+                case 4:
+                    r[i] = t; g[i] = 0.0f; b[i] = 1.0f;
+                    break;
+                default:
+                    r[i] = 1.0f; g[i] = 0.0f; b[i] = q;
+                    break;
+            }
+        }else{
+            r[i] = val*0.95f+0.05f;
+            b[i] = std::max(0.0f, 1.0f - 10.0f*val);
+            if(val>0.5f){
+                g[i] = 2.0f - 2.0f*val;
+            }else{
+                g[i] = 2.0f*val;
+            }
+        }
+    }
+}
+
+const PointKernels scalar_kernels = {
+    "scalar",
+    scaleFiniteScalar,
+    rgbToRgba8Scalar,
+    packRgba8Scalar,
+    intensityRampScalar,
+    axisRampScalar
+};
+
+#ifdef POINT_KERNELS_X86
+
+/// Helpers shared by the SSE4.1 kernels; x - x is 0 for finite values and NaN otherwise
+__attribute__((target("sse4.1")))
+inline __m128 finiteMask4(__m128 v)
+{
+    return _mm_cmpeq_ps(_mm_sub_ps(v,v),_mm_setzero_ps());
+}
+
+__attribute__((target("sse4.1")))
+void scaleFiniteSse41(float* x, float* y, float* z, size_t n, float scale, uint8_t* keep)
+{
+    const __m128 s = _mm_set1_ps(scale);
+    size_t i=0;
+    for(;i+4<=n;i+=4)
+    {
+        __m128 vx = _mm_loadu_ps(x+i);
+        __m128 vy = _mm_loadu_ps(y+i);
+        __m128 vz = _mm_loadu_ps(z+i);
+        int mask = _mm_movemask_ps(_mm_and_ps(_mm_and_ps(finiteMask4(vx),finiteMask4(vy)),finiteMask4(vz)));
+        for(int k=0;k<4;k++){
+            keep[i+k] = (mask>>k) & 1;
+        }
+        _mm_storeu_ps(x+i,_mm_mul_ps(vx,s));
+        _mm_storeu_ps(y+i,_mm_mul_ps(vy,s));
+        _mm_storeu_ps(z+i,_mm_mul_ps(vz,s));
+    }
+    scaleFiniteScalar(x+i,y+i,z+i,n-i,scale,keep+i);
+}
+
+__attribute__((target("sse4.1")))
+void rgbToRgba8Sse41(const uint32_t* packed, size_t n, uint32_t* rgba)
+{
+    /// Bytes in memory are b,g,r,x; swap b and r and force alpha on
+    const __m128i swap = _mm_setr_epi8(2,1,0,-1, 6,5,4,-1, 10,9,8,-1, 14,13,12,-1);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    size_t i=0;
+    for(;i+4<=n;i+=4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(packed+i));
+        _mm_storeu_si128((__m128i*)(rgba+i),_mm_or_si128(_mm_shuffle_epi8(p,swap),alpha));
+    }
+    rgbToRgba8Scalar(packed+i,n-i,rgba+i);
+}
+
+__attribute__((target("sse4.1")))
+inline __m128i toByte4(__m128 v)
+{
+    v = _mm_min_ps(_mm_max_ps(v,_mm_setzero_ps()),_mm_set1_ps(1.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v,_mm_set1_ps(255.0f)),_mm_set1_ps(0.5f)));
+}
+
+__attribute__((target("sse4.1")))
+void packRgba8Sse41(const float* r, const float* g, const float* b, size_t n, uint32_t* rgba)
+{
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    size_t i=0;
+    for(;i+4<=n;i+=4)
+    {
+        __m128i c = _mm_or_si128(toByte4(_mm_loadu_ps(r+i)),_mm_slli_epi32(toByte4(_mm_loadu_ps(g+i)),8));
+        c = _mm_or_si128(c,_mm_slli_epi32(toByte4(_mm_loadu_ps(b+i)),16));
+        _mm_storeu_si128((__m128i*)(rgba+i),_mm_or_si128(c,alpha));
+    }
+    packRgba8Scalar(r+i,g+i,b+i,n-i,rgba+i);
+}
+
+__attribute__((target("sse4.1")))
+void intensityRampSse41(const float* intensity, size_t n, float max, float* r, float* g, float* b)
+{
+    if(!(max > 0.0f)){
+        intensityRampScalar(intensity,n,max,r,g,b);
+        return;
+    }
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 m = _mm_set1_ps(max);
+    size_t i=0;
+    for(;i+4<=n;i+=4)
+    {
+        __m128 c = _mm_sub_ps(one,_mm_div_ps(_mm_loadu_ps(intensity+i),m));
+        _mm_storeu_ps(r+i,c);
+        _mm_storeu_ps(g+i,c);
+        _mm_storeu_ps(b+i,one);
+    }
+    intensityRampScalar(intensity+i,n-i,max,r+i,g+i,b+i);
+}
+
+__attribute__((target("sse4.1")))
+void axisRampSse41(const float* z, size_t n, float z_min, float z_range, bool hsv, float* r, float* g, float* b)
+{
+    if(!(z_range > 0.0f)){
+        axisRampScalar(z,n,z_min,z_range,hsv,r,g,b);
+        return;
+    }
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 vmin = _mm_set1_ps(z_min);
+    const __m128 vrange = _mm_set1_ps(z_range);
+    size_t i=0;
+    for(;i+4<=n;i+=4)
+    {
+        __m128 val = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(z+i),vmin),vrange);
+        __m128 vr,vg,vb;
+        if(hsv)
+        {
+            __m128 deg = _mm_mul_ps(_mm_min_ps(_mm_max_ps(val,zero),one),_mm_set1_ps(360.0f));
+            __m128i region = _mm_cvttps_epi32(_mm_div_ps(deg,_mm_set1_ps(43.0f)));
+            __m128 t = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(deg,_mm_cvtepi32_ps(_mm_mullo_epi32(region,_mm_set1_epi32(43)))),
+                                             _mm_set1_ps(6.0f)),_mm_set1_ps(256.0f));
+            __m128 q = _mm_sub_ps(one,t);
+
+            /// Start from the default case (region 5 and up), then overwrite the lower regions
+            vr = one; vg = zero; vb = q;
+            __m128 m0 = _mm_castsi128_ps(_mm_cmpeq_epi32(region,_mm_set1_epi32(0)));
+            __m128 m1 = _mm_castsi128_ps(_mm_cmpeq_epi32(region,_mm_set1_epi32(1)));
+            __m128 m2 = _mm_castsi128_ps(_mm_cmpeq_epi32(region,_mm_set1_epi32(2)));
+            __m128 m3 = _mm_castsi128_ps(_mm_cmpeq_epi32(region,_mm_set1_epi32(3)));
+            __m128 m4 = _mm_castsi128_ps(_mm_cmpeq_epi32(region,_mm_set1_epi32(4)));
+            vr = _mm_blendv_ps(vr,one, m0); vg = _mm_blendv_ps(vg,t,   m0); vb = _mm_blendv_ps(vb,zero,m0);
+            vr = _mm_blendv_ps(vr,q,   m1); vg = _mm_blendv_ps(vg,one, m1); vb = _mm_blendv_ps(vb,zero,m1);
+            vr = _mm_blendv_ps(vr,zero,m2); vg = _mm_blendv_ps(vg,one, m2); vb = _mm_blendv_ps(vb,t,   m2);
+            vr = _mm_blendv_ps(vr,zero,m3); vg = _mm_blendv_ps(vg,q,   m3); vb = _mm_blendv_ps(vb,one, m3);
+            vr = _mm_blendv_ps(vr,t,   m4); vg = _mm_blendv_ps(vg,zero,m4); vb = _mm_blendv_ps(vb,one, m4);
+        }else{
+            const __m128 two = _mm_set1_ps(2.0f);
+            __m128 twice = _mm_mul_ps(two,val);
+            vr = _mm_add_ps(_mm_mul_ps(val,_mm_set1_ps(0.95f)),_mm_set1_ps(0.05f));
+            vb = _mm_max_ps(_mm_sub_ps(one,_mm_mul_ps(_mm_set1_ps(10.0f),val)),zero);
+            vg = _mm_blendv_ps(twice,_mm_sub_ps(two,twice),_mm_cmpgt_ps(val,_mm_set1_ps(0.5f)));
+        }
+        _mm_storeu_ps(r+i,vr);
+        _mm_storeu_ps(g+i,vg);
+        _mm_storeu_ps(b+i,vb);
+    }
+    axisRampScalar(z+i,n-i,z_min,z_range,hsv,r+i,g+i,b+i);
+}
+
+const PointKernels sse41_kernels = {
+    "sse4.1",
+    scaleFiniteSse41,
+    rgbToRgba8Sse41,
+    packRgba8Sse41,
+    intensityRampSse41,
+    axisRampSse41
+};
+
+__attribute__((target("avx2")))
+inline __m256 finiteMask8(__m256 v)
+{
+    return _mm256_cmp_ps(_mm256_sub_ps(v,v),_mm256_setzero_ps(),_CMP_EQ_OQ);
+}
+
+__attribute__((target("avx2")))
+void scaleFiniteAvx2(float* x, float* y, float* z, size_t n, float scale, uint8_t* keep)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    size_t i=0;
+    for(;i+8<=n;i+=8)
+    {
+        __m256 vx = _mm256_loadu_ps(x+i);
+        __m256 vy = _mm256_loadu_ps(y+i);
+        __m256 vz = _mm256_loadu_ps(z+i);
+        int mask = _mm256_movemask_ps(_mm256_and_ps(_mm256_and_ps(finiteMask8(vx),finiteMask8(vy)),finiteMask8(vz)));
+        for(int k=0;k<8;k++){
+            keep[i+k] = (mask>>k) & 1;
+        }
+        _mm256_storeu_ps(x+i,_mm256_mul_ps(vx,s));
+        _mm256_storeu_ps(y+i,_mm256_mul_ps(vy,s));
+        _mm256_storeu_ps(z+i,_mm256_mul_ps(vz,s));
+    }
+    scaleFiniteScalar(x+i,y+i,z+i,n-i,scale,keep+i);
+}
+
+__attribute__((target("avx2")))
+void rgbToRgba8Avx2(const uint32_t* packed, size_t n, uint32_t* rgba)
+{
+    /// Bytes in memory are b,g,r,x; swap b and r and force alpha on
+    const __m256i swap = _mm256_setr_epi8(2,1,0,-1, 6,5,4,-1, 10,9,8,-1, 14,13,12,-1,
+                                          2,1,0,-1, 6,5,4,-1, 10,9,8,-1, 14,13,12,-1);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    size_t i=0;
+    for(;i+8<=n;i+=8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(packed+i));
+        _mm256_storeu_si256((__m256i*)(rgba+i),_mm256_or_si256(_mm256_shuffle_epi8(p,swap),alpha));
+    }
+    rgbToRgba8Scalar(packed+i,n-i,rgba+i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i toByte8(__m256 v)
+{
+    v = _mm256_min_ps(_mm256_max_ps(v,_mm256_setzero_ps()),_mm256_set1_ps(1.0f));
+    return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v,_mm256_set1_ps(255.0f)),_mm256_set1_ps(0.5f)));
+}
+
+__attribute__((target("avx2")))
+void packRgba8Avx2(const float* r, const float* g, const float* b, size_t n, uint32_t* rgba)
+{
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    size_t i=0;
+    for(;i+8<=n;i+=8)
+    {
+        __m256i c = _mm256_or_si256(toByte8(_mm256_loadu_ps(r+i)),_mm256_slli_epi32(toByte8(_mm256_loadu_ps(g+i)),8));
+        c = _mm256_or_si256(c,_mm256_slli_epi32(toByte8(_mm256_loadu_ps(b+i)),16));
+        _mm256_storeu_si256((__m256i*)(rgba+i),_mm256_or_si256(c,alpha));
+    }
+    packRgba8Scalar(r+i,g+i,b+i,n-i,rgba+i);
+}
+
+__attribute__((target("avx2")))
+void intensityRampAvx2(const float* intensity, size_t n, float max, float* r, float* g, float* b)
+{
+    if(!(max > 0.0f)){
+        intensityRampScalar(intensity,n,max,r,g,b);
+        return;
+    }
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 m = _mm256_set1_ps(max);
+    size_t i=0;
+    for(;i+8<=n;i+=8)
+    {
+        __m256 c = _mm256_sub_ps(one,_mm256_div_ps(_mm256_loadu_ps(intensity+i),m));
+        _mm256_storeu_ps(r+i,c);
+        _mm256_storeu_ps(g+i,c);
+        _mm256_storeu_ps(b+i,one);
+    }
+    intensityRampScalar(intensity+i,n-i,max,r+i,g+i,b+i);
+}
+
+__attribute__((target("avx2")))
+void axisRampAvx2(const float* z, size_t n, float z_min, float z_range, bool hsv, float* r, float* g, float* b)
+{
+    if(!(z_range > 0.0f)){
+        axisRampScalar(z,n,z_min,z_range,hsv,r,g,b);
+        return;
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 vmin = _mm256_set1_ps(z_min);
+    const __m256 vrange = _mm256_set1_ps(z_range);
+    size_t i=0;
+    for(;i+8<=n;i+=8)
+    {
+        __m256 val = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(z+i),vmin),vrange);
+        __m256 vr,vg,vb;
+        if(hsv)
+        {
+            __m256 deg = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(val,zero),one),_mm256_set1_ps(360.0f));
+            __m256i region = _mm256_cvttps_epi32(_mm256_div_ps(deg,_mm256_set1_ps(43.0f)));
+            __m256 t = _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(deg,_mm256_cvtepi32_ps(_mm256_mullo_epi32(region,_mm256_set1_epi32(43)))),
+                                                   _mm256_set1_ps(6.0f)),_mm256_set1_ps(256.0f));
+            __m256 q = _mm256_sub_ps(one,t);
+
+            /// Start from the default case (region 5 and up), then overwrite the lower regions
+            vr = one; vg = zero; vb = q;
+            __m256 m0 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(region,_mm256_set1_epi32(0)));
+            __m256 m1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(region,_mm256_set1_epi32(1)));
+            __m256 m2 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(region,_mm256_set1_epi32(2)));
+            __m256 m3 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(region,_mm256_set1_epi32(3)));
+            __m256 m4 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(region,_mm256_set1_epi32(4)));
+            vr = _mm256_blendv_ps(vr,one, m0); vg = _mm256_blendv_ps(vg,t,   m0); vb = _mm256_blendv_ps(vb,zero,m0);
+            vr = _mm256_blendv_ps(vr,q,   m1); vg = _mm256_blendv_ps(vg,one, m1); vb = _mm256_blendv_ps(vb,zero,m1);
+            vr = _mm256_blendv_ps(vr,zero,m2); vg = _mm256_blendv_ps(vg,one, m2); vb = _mm256_blendv_ps(vb,t,   m2);
+            vr = _mm256_blendv_ps(vr,zero,m3); vg = _mm256_blendv_ps(vg,q,   m3); vb = _mm256_blendv_ps(vb,one, m3);
+            vr = _mm256_blendv_ps(vr,t,   m4); vg = _mm256_blendv_ps(vg,zero,m4); vb = _mm256_blendv_ps(vb,one, m4);
+        }else{
+            const __m256 two = _mm256_set1_ps(2.0f);
+            __m256 twice = _mm256_mul_ps(two,val);
+            vr = _mm256_add_ps(_mm256_mul_ps(val,_mm256_set1_ps(0.95f)),_mm256_set1_ps(0.05f));
+            vb = _mm256_max_ps(_mm256_sub_ps(one,_mm256_mul_ps(_mm256_set1_ps(10.0f),val)),zero);
+            vg = _mm256_blendv_ps(twice,_mm256_sub_ps(two,twice),_mm256_cmp_ps(val,_mm256_set1_ps(0.5f),_CMP_GT_OQ));
+        }
+        _mm256_storeu_ps(r+i,vr);
+        _mm256_storeu_ps(g+i,vg);
+        _mm256_storeu_ps(b+i,vb);
+    }
+    axisRampScalar(z+i,n-i,z_min,z_range,hsv,r+i,g+i,b+i);
+}
+
+const PointKernels avx2_kernels = {
+    "avx2",
+    scaleFiniteAvx2,
+    rgbToRgba8Avx2,
+    packRgba8Avx2,
+    intensityRampAvx2,
+    axisRampAvx2
+};
+
+#endif
+
+const PointKernels& selectPointKernels()
+{
+#ifdef POINT_KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        return avx2_kernels;
+    }
+    if(__builtin_cpu_supports("sse4.1")){
+        return sse41_kernels;
+    }
+#endif
+    return scalar_kernels;
+}
+
+}
+
+/*!
+ * \brief The fastest kernels this CPU supports, picked the first time this is called
+ */
+const PointKernels& GetPointKernels()
+{
+    static const PointKernels& kernels = selectPointKernels();
+    return kernels;
+}
+
+/*!
+ * \brief The plain C++ kernels, which every other table must match exactly
+ */
+const PointKernels& GetScalarPointKernels()
+{
+    return scalar_kernels;
+}
+
+/*!
+ * \brief Every table this CPU can run, starting with the scalar one, for comparing them against each other
+ */
+std::vector<const PointKernels*> GetSupportedPointKernels()
+{
+    std::vector<const PointKernels*> kernels(1,&scalar_kernels);
+#ifdef POINT_KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.1")){
+        kernels.push_back(&sse41_kernels);
+    }
+    if(__builtin_cpu_supports("avx2")){
+        kernels.push_back(&avx2_kernels);
+    }
+#endif
+    return kernels;
+}
@@ -0,0 +1,42 @@
+#ifndef POINT_KERNELS_H
+#define	POINT_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*!
+ * \brief Table of the per-point math used when converting point clouds
+ *
+ * All kernels work on blocks of points stored as separate x/y/z/r/g/b arrays, which lets
+ * the SSE4.1 and AVX2 versions handle 4 or 8 points per instruction. Every SIMD kernel
+ * produces exactly the same bits as its scalar version, so which table gets picked only
+ * changes the speed. GetPointKernels() picks the widest version the CPU supports at
+ * runtime, so the same binary still runs on older robot PCs.
+ */
+struct PointKernels
+{
+    const char* name;
+
+    /// Scale x/y/z in place, and set keep[i] to 1 if the (unscaled) point was finite, 0 otherwise
+    void (*scale_finite)(float* x, float* y, float* z, size_t n, float scale, uint8_t* keep);
+
+    /// Reorder packed 0x00RRGGBB colors (as found in PointCloud2) into RGBA8 as laid out in memory, with alpha 255
+    void (*rgb_to_rgba8)(const uint32_t* packed, size_t n, uint32_t* rgba);
+
+    /// Clamp r/g/b to 0->1 and round them into RGBA8 as laid out in memory, with alpha 255
+    void (*pack_rgba8)(const float* r, const float* g, const float* b, size_t n, uint32_t* rgba);
+
+    /// Intensity ramp from blue (0.0) to white (max): r = g = 1-intensity/max, b = 1
+    void (*intensity_ramp)(const float* intensity, size_t n, float max, float* r, float* g, float* b);
+
+    /// Height ramp; val = (z-z_min)/z_range is mapped through either the HSV or the blue->red->yellow ramp
+    void (*axis_ramp)(const float* z, size_t n, float z_min, float z_range, bool hsv, float* r, float* g, float* b);
+};
+
+const PointKernels& GetPointKernels();
+const PointKernels& GetScalarPointKernels();
+std::vector<const PointKernels*> GetSupportedPointKernels();
+
+
+#endif	/* POINT_KERNELS_H */
@@ -0,0 +1,137 @@
+/*!
+ * \brief Checks that every SIMD table of point_kernels.h produces the same bits as the scalar one
+ *
+ * Runs every kernel on random values mixed with the awkward ones (NAN, infinities, denormals, huge and
+ * negative values, HSV region boundaries), for lengths that exercise both the vector loop and the tail.
+ * Returns non-zero if any output differs.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <limits>
+#include <random>
+#include <vector>
+#include "point_kernels.h"
+
+namespace
+{
+
+const size_t LENGTHS[] = {0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 1000, 4099};
+
+std::vector<float> randomFloats(std::mt19937& rng, size_t n, float lo, float hi)
+{
+    static const float special[] = {
+        std::numeric_limits<float>::quiet_NaN(),
+        -std::numeric_limits<float>::quiet_NaN(),
+        std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(),
+        std::numeric_limits<float>::denorm_min(),
+        std::numeric_limits<float>::max(),
+        -std::numeric_limits<float>::max(),
+        3.0e9f, -3.0e9f, 0.0f, -0.0f, 0.5f, 1.0f,
+        /// The edges of the HSV regions, val = 43*k/360
+        43.0f/360.0f, 86.0f/360.0f, 129.0f/360.0f, 172.0f/360.0f, 215.0f/360.0f
+    };
+    std::uniform_real_distribution<float> uniform(lo,hi);
+    std::uniform_int_distribution<int> pick(0,7);
+    std::uniform_int_distribution<size_t> which(0,sizeof(special)/sizeof(special[0])-1);
+    std::vector<float> values(n);
+    for(size_t i=0;i<n;i++){
+        values[i] = pick(rng)==0 ? special[which(rng)] : uniform(rng);
+    }
+    return values;
+}
+
+template <typename T>
+bool same(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size()==b.size() && (a.empty() || memcmp(&a[0],&b[0],a.size()*sizeof(T))==0);
+}
+
+int failures = 0;
+
+void check(bool ok, const char* kernel, const PointKernels& table, size_t n, const char* detail="")
+{
+    if(!ok){
+        fprintf(stderr,"FAIL %s %s n=%zu %s\n",table.name,kernel,n,detail);
+        failures++;
+    }
+}
+
+void compare(const PointKernels& ref, const PointKernels& test, std::mt19937& rng, size_t n)
+{
+    {
+        std::vector<float> x = randomFloats(rng,n,-100.0f,100.0f);
+        std::vector<float> y = randomFloats(rng,n,-100.0f,100.0f);
+        std::vector<float> z = randomFloats(rng,n,-100.0f,100.0f);
+        std::vector<float> x2 = x, y2 = y, z2 = z;
+        std::vector<uint8_t> keep(n), keep2(n);
+        ref.scale_finite(x.data(),y.data(),z.data(),n,2.5f,keep.data());
+        test.scale_finite(x2.data(),y2.data(),z2.data(),n,2.5f,keep2.data());
+        check(same(x,x2) && same(y,y2) && same(z,z2) && same(keep,keep2),"scale_finite",test,n);
+    }
+    {
+        std::uniform_int_distribution<uint32_t> bits;
+        std::vector<uint32_t> packed(n);
+        for(size_t i=0;i<n;i++){
+            packed[i] = bits(rng);
+        }
+        std::vector<uint32_t> rgba(n), rgba2(n);
+        ref.rgb_to_rgba8(packed.data(),n,rgba.data());
+        test.rgb_to_rgba8(packed.data(),n,rgba2.data());
+        check(same(rgba,rgba2),"rgb_to_rgba8",test,n);
+    }
+    {
+        std::vector<float> r = randomFloats(rng,n,-0.5f,1.5f);
+        std::vector<float> g = randomFloats(rng,n,-0.5f,1.5f);
+        std::vector<float> b = randomFloats(rng,n,-0.5f,1.5f);
+        std::vector<uint32_t> rgba(n), rgba2(n);
+        ref.pack_rgba8(r.data(),g.data(),b.data(),n,rgba.data());
+        test.pack_rgba8(r.data(),g.data(),b.data(),n,rgba2.data());
+        check(same(rgba,rgba2),"pack_rgba8",test,n);
+    }
+    const float maxes[] = {0.0f, -1.0f, 1.0f, 255.0f, std::numeric_limits<float>::quiet_NaN()};
+    for(size_t m=0;m<sizeof(maxes)/sizeof(maxes[0]);m++)
+    {
+        std::vector<float> intensity = randomFloats(rng,n,0.0f,300.0f);
+        std::vector<float> r(n), g(n), b(n), r2(n), g2(n), b2(n);
+        ref.intensity_ramp(intensity.data(),n,maxes[m],r.data(),g.data(),b.data());
+        test.intensity_ramp(intensity.data(),n,maxes[m],r2.data(),g2.data(),b2.data());
+        char detail[64];
+        snprintf(detail,sizeof(detail),"max=%g",maxes[m]);
+        check(same(r,r2) && same(g,g2) && same(b,b2),"intensity_ramp",test,n,detail);
+    }
+    const float ranges[][2] = {{0.0f,1.0f}, {-5.0f,10.0f}, {2.0f,0.0f}, {0.0f,1.0e-30f}};
+    for(size_t rr=0;rr<sizeof(ranges)/sizeof(ranges[0]);rr++)
+    {
+        for(int hsv=0;hsv<2;hsv++)
+        {
+            std::vector<float> z = randomFloats(rng,n,-6.0f,6.0f);
+            std::vector<float> r(n), g(n), b(n), r2(n), g2(n), b2(n);
+            ref.axis_ramp(z.data(),n,ranges[rr][0],ranges[rr][1],hsv,r.data(),g.data(),b.data());
+            test.axis_ramp(z.data(),n,ranges[rr][0],ranges[rr][1],hsv,r2.data(),g2.data(),b2.data());
+            char detail[64];
+            snprintf(detail,sizeof(detail),"z_min=%g z_range=%g hsv=%d",ranges[rr][0],ranges[rr][1],hsv);
+            check(same(r,r2) && same(g,g2) && same(b,b2),"axis_ramp",test,n,detail);
+        }
+    }
+}
+
+}
+
+int main()
+{
+    std::vector<const PointKernels*> tables = GetSupportedPointKernels();
+    const PointKernels& ref = GetScalarPointKernels();
+    for(size_t t=0;t<tables.size();t++)
+    {
+        const int before = failures;
+        std::mt19937 rng(1234);
+        for(int round=0;round<20;round++){
+            for(size_t l=0;l<sizeof(LENGTHS)/sizeof(LENGTHS[0]);l++){
+                compare(ref,*tables[t],rng,LENGTHS[l]);
+            }
+        }
+        printf("%s: %s\n",tables[t]->name,failures>before ? "differs from scalar" : "matches scalar");
+    }
+    return failures ? 1 : 0;
+}
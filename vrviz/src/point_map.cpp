@@ -0,0 +1,236 @@
+#include <cmath>
+#include <algorithm>
+#include "point_map.h"
+#include "grid_coord.h"
+
+namespace
+{
+
+/// Spread the low 21 bits of v out so there are two zero bits between each of them
+inline uint64_t spreadBits(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+/// Undo spreadBits()
+inline uint64_t compactBits(uint64_t v)
+{
+    v &= 0x1249249249249249ull;
+    v = (v ^ (v >> 2))  & 0x10c30c30c30c30c3ull;
+    v = (v ^ (v >> 4))  & 0x100f00f00f00f00full;
+    v = (v ^ (v >> 8))  & 0x1f0000ff0000ffull;
+    v = (v ^ (v >> 16)) & 0x1f00000000ffffull;
+    v = (v ^ (v >> 32)) & 0x1fffffull;
+    return v;
+}
+
+}
+
+PointMap::PointMap()
+    : node_size(1.0f)
+    , decay_time(30.0)
+    , max_points(5000000)
+    , bucket_size(100000)
+    , m_numPoints(0)
+{
+}
+
+/// Morton code of the node that holds (x,y,z); anything beyond the 21 bit node grid goes to its outermost nodes
+uint64_t PointMap::NodeKey(float x, float y, float z) const
+{
+    const float inv_size = 1.0f/node_size;
+    return spreadBits(gridCoord(std::floor(x*inv_size))) |
+           spreadBits(gridCoord(std::floor(y*inv_size))) << 1 |
+           spreadBits(gridCoord(std::floor(z*inv_size))) << 2;
+}
+
+/*!
+ * \brief Get the box covered by a node
+ * \param key Node key, as given by TakeUpdates()
+ * \param min Output; lowest corner, in VR units
+ * \param max Output; highest corner, in VR units
+ */
+void PointMap::GetNodeBounds(uint64_t key, Vector3& min, Vector3& max) const
+{
+    min.x = (int64_t(compactBits(key))-GRID_OFFSET)*node_size;
+    min.y = (int64_t(compactBits(key>>1))-GRID_OFFSET)*node_size;
+    min.z = (int64_t(compactBits(key>>2))-GRID_OFFSET)*node_size;
+    max = min + Vector3(node_size,node_size,node_size);
+}
+
+/*!
+ * \brief Add a converted cloud to the map
+ *
+ * \param points Points as output by PointCloudDecoder, in the frame of the cloud
+ * \param to_map Transform from the frame of the cloud to the frame of the map
+ * \param stamp Time the points were seen, in seconds
+ */
+void PointMap::Insert(const std::vector<PointVertex>& points, const Matrix4& to_map, double stamp)
+{
+    const float* m = to_map.get();
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    /// Neighbouring points nearly always share a node, so remember the last one
+    uint64_t last_key = 0;
+    Node* node = NULL;
+    for(size_t ii=0;ii<points.size();ii++)
+    {
+        PointVertex pt = points[ii];
+        float x = pt.x, y = pt.y, z = pt.z;
+        pt.x = m[0]*x + m[4]*y + m[8]*z  + m[12];
+        pt.y = m[1]*x + m[5]*y + m[9]*z  + m[13];
+        pt.z = m[2]*x + m[6]*y + m[10]*z + m[14];
+
+        uint64_t key = NodeKey(pt.x,pt.y,pt.z);
+        if(!node || key!=last_key)
+        {
+            last_key = key;
+            NodeMap::iterator it = m_nodes.find(key);
+            if(it==m_nodes.end()){
+                it = m_nodes.insert(std::make_pair(key,Node())).first;
+                it->second.lru = m_lru.insert(m_lru.end(),key);
+            }
+            node = &it->second;
+            if(node->batches.empty() || node->batches.back().stamp!=stamp){
+                Batch batch;
+                batch.stamp = stamp;
+                batch.count = 0;
+                node->batches.push_back(batch);
+                m_lru.splice(m_lru.end(),m_lru,node->lru);
+            }
+            MarkDirty(key,*node);
+        }
+        node->points.push_back(pt);
+        node->batches.back().count++;
+        m_numPoints++;
+        /// Trim full buckets with some slack, so the erase is not done for every point
+        if(node->points.size()>bucket_size+bucket_size/8){
+            DropOldest(*node,node->points.size()-bucket_size);
+        }
+    }
+
+    /// Over the memory cap, so forget the parts of the map that have not been seen for longest
+    while(m_numPoints>max_points && !m_lru.empty())
+    {
+        RemoveNode(m_nodes.find(m_lru.front()));
+    }
+}
+
+/*!
+ * \brief Drop every point older than decay_time
+ *
+ * \param now Current time, in seconds
+ * \return true if anything was dropped
+ */
+bool PointMap::Expire(double now)
+{
+    if(decay_time<=0.0){
+        return false;
+    }
+    const double cutoff = now-decay_time;
+    bool changed = false;
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    NodeMap::iterator it = m_nodes.begin();
+    while(it!=m_nodes.end())
+    {
+        Node& node = it->second;
+        size_t count = 0;
+        for(size_t ii=0;ii<node.batches.size() && node.batches[ii].stamp<cutoff;ii++){
+            count += node.batches[ii].count;
+        }
+        if(count==0){
+            ++it;
+            continue;
+        }
+        changed = true;
+        if(count>=node.points.size()){
+            RemoveNode(it++);
+        }else{
+            DropOldest(node,count);
+            MarkDirty(it->first,node);
+            ++it;
+        }
+    }
+    return changed;
+}
+
+/*!
+ * \brief Hand the changes since the last call over to the render thread
+ *
+ * \param updated Output; every node whose points changed, with a copy of its points
+ * \param removed Output; every node that no longer exists
+ */
+void PointMap::TakeUpdates(std::vector<Update>& updated, std::vector<uint64_t>& removed)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    removed.swap(m_removed);
+    m_removed.clear();
+    updated.resize(m_dirty.size());
+    size_t count = 0;
+    for(size_t ii=0;ii<m_dirty.size();ii++)
+    {
+        NodeMap::iterator it = m_nodes.find(m_dirty[ii]);
+        if(it==m_nodes.end() || !it->second.dirty){
+            continue;
+        }
+        updated[count].key = it->first;
+        updated[count].points = it->second.points;
+        it->second.dirty = false;
+        count++;
+    }
+    updated.resize(count);
+    m_dirty.clear();
+}
+
+size_t PointMap::GetNumPoints()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_numPoints;
+}
+
+size_t PointMap::GetNumNodes()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_nodes.size();
+}
+
+/// Drop the count oldest points of a node. Called with m_mutex locked.
+void PointMap::DropOldest(Node& node, size_t count)
+{
+    node.points.erase(node.points.begin(),node.points.begin()+count);
+    m_numPoints -= count;
+    while(count>0)
+    {
+        Batch& batch = node.batches.front();
+        if(batch.count>count){
+            batch.count -= count;
+            break;
+        }
+        count -= batch.count;
+        node.batches.pop_front();
+    }
+}
+
+/// Called with m_mutex locked.
+void PointMap::MarkDirty(uint64_t key, Node& node)
+{
+    if(!node.dirty){
+        node.dirty = true;
+        m_dirty.push_back(key);
+    }
+}
+
+/// Called with m_mutex locked.
+void PointMap::RemoveNode(NodeMap::iterator it)
+{
+    m_numPoints -= it->second.points.size();
+    m_lru.erase(it->second.lru);
+    m_removed.push_back(it->first);
+    m_nodes.erase(it);
+}
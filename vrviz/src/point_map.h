@@ -0,0 +1,80 @@
+#ifndef POINT_MAP_H
+#define	POINT_MAP_H
+
+#include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <stdint.h>
+#include <boost/thread/mutex.hpp>
+#include "shared/Matrices.h"
+#include "point_cloud.h"
+
+/*!
+ * \brief Accumulates converted point clouds into a sparse octree, so a scene builds up as the robot moves
+ *
+ * Space is split into cubic nodes of node_size; only nodes holding points exist, stored in a
+ * hash map keyed by the Morton code of the node's coordinates (so the keys follow the octree
+ * order). Each node keeps its own bucket of points in the order they arrived.
+ *
+ * Points older than decay_time are dropped, each node keeps about bucket_size points at most, and
+ * when the whole map holds more than max_points the least recently updated nodes are evicted.
+ *
+ * The ROS thread calls Insert()/Expire(), and the render thread picks up the nodes that changed
+ * with TakeUpdates(), so only those have to be uploaded to the GPU again.
+ */
+class PointMap
+{
+public:
+    PointMap();
+
+    /// New contents of a node that changed since the last TakeUpdates()
+    struct Update {
+        uint64_t key;
+        std::vector<PointVertex> points;
+    };
+
+    void Insert(const std::vector<PointVertex>& points, const Matrix4& to_map, double stamp);
+    bool Expire(double now);
+    void TakeUpdates(std::vector<Update>& updated, std::vector<uint64_t>& removed);
+    void GetNodeBounds(uint64_t key, Vector3& min, Vector3& max) const;
+
+    size_t GetNumPoints();
+    size_t GetNumNodes();
+
+    float node_size;///!< Edge length of a node, in VR units
+    double decay_time;///!< Seconds a point is kept; 0 keeps points until they are evicted
+    size_t max_points;///!< Points in the whole map before nodes get evicted
+    size_t bucket_size;///!< Points in one node before its oldest ones are dropped (with 1/8 slack)
+
+private:
+    /// Points added to a node by one Insert()
+    struct Batch {
+        double stamp;
+        size_t count;
+    };
+
+    struct Node {
+        Node() : dirty(false) {}
+        std::vector<PointVertex> points;
+        std::deque<Batch> batches;///!< Oldest first, matching the order of points
+        std::list<uint64_t>::iterator lru;
+        bool dirty;
+    };
+    typedef std::unordered_map<uint64_t,Node> NodeMap;
+
+    uint64_t NodeKey(float x, float y, float z) const;
+    void DropOldest(Node& node, size_t count);
+    void MarkDirty(uint64_t key, Node& node);
+    void RemoveNode(NodeMap::iterator it);
+
+    boost::mutex m_mutex;///!< Protects everything below
+    NodeMap m_nodes;
+    std::list<uint64_t> m_lru;///!< Node keys, least recently updated first
+    std::vector<uint64_t> m_dirty;
+    std::vector<uint64_t> m_removed;
+    size_t m_numPoints;
+};
+
+
+#endif	/* POINT_MAP_H */
@@ -0,0 +1,126 @@
+#include <string.h>
+#include "streaming_buffer.h"
+#include "gl_stats.h"
+
+StreamingBuffer::StreamingBuffer(GLsizei vertex_size)
+    : m_vertexSize(vertex_size)
+    , m_capacity(0)
+    , m_buffer(0)
+    , m_mapped(NULL)
+    , m_segment(0)
+    , m_firstVertex(0)
+{
+    for(int ii=0;ii<SEGMENTS;ii++){
+        m_fences[ii]=0;
+    }
+}
+
+/// \note GL objects are only freed by Release(), since there may be no context left by the time this runs
+StreamingBuffer::~StreamingBuffer()
+{
+}
+
+/*!
+ * \brief Copy count vertices into the buffer
+ *
+ * \return true if the buffer object is new, and any VAO using it has to be set up again
+ */
+bool StreamingBuffer::Upload(const void* data, size_t count)
+{
+    bool reallocated = false;
+    if(m_buffer==0 || count>m_capacity){
+        /// Leave some headroom, since clouds tend to grow a little from message to message
+        Allocate(count+count/2);
+        reallocated = true;
+    }
+
+    if(m_mapped){
+        if(!reallocated){
+            /// Every draw that reads the current segment has been issued by now
+            m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+            m_segment = (m_segment+1)%SEGMENTS;
+            WaitForSegment(m_segment);
+        }
+        memcpy(m_mapped+m_segment*m_capacity*m_vertexSize,data,count*m_vertexSize);
+        m_firstVertex = m_segment*m_capacity;
+    }else{
+        glBindBuffer( GL_ARRAY_BUFFER, m_buffer );
+        /// Orphan the old storage, so the driver does not wait for draws still using it
+        glBufferData( GL_ARRAY_BUFFER, m_capacity*m_vertexSize, NULL, GL_STREAM_DRAW );
+        glBufferSubData( GL_ARRAY_BUFFER, 0, count*m_vertexSize, data );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        m_firstVertex = 0;
+    }
+    return reallocated;
+}
+
+/// Free the buffer and fences. Needs the GL context.
+void StreamingBuffer::Release()
+{
+    for(int ii=0;ii<SEGMENTS;ii++){
+        if(m_fences[ii]){
+            glDeleteSync(m_fences[ii]);
+            m_fences[ii]=0;
+        }
+    }
+    if(m_buffer){
+        if(m_mapped){
+            glBindBuffer( GL_ARRAY_BUFFER, m_buffer );
+            glUnmapBuffer( GL_ARRAY_BUFFER );
+            glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        }
+        glDeleteBuffers( 1, &m_buffer );
+        gl_object_counts.buffers--;
+        gl_object_counts.stream_bytes -= (m_mapped ? SEGMENTS : 1)*m_capacity*m_vertexSize;
+    }
+    m_buffer = 0;
+    m_mapped = NULL;
+    m_capacity = 0;
+    m_segment = 0;
+    m_firstVertex = 0;
+}
+
+void StreamingBuffer::Allocate(size_t capacity)
+{
+    /// Draws already issued keep the old buffer alive until they are done, so there is no need to wait here
+    Release();
+    if(capacity==0){
+        capacity=1;
+    }
+    m_capacity = capacity;
+
+    glGenBuffers( 1, &m_buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, m_buffer );
+    gl_object_counts.buffers++;
+    if(GLEW_ARB_buffer_storage || GLEW_VERSION_4_4){
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = SEGMENTS*m_capacity*m_vertexSize;
+        glBufferStorage( GL_ARRAY_BUFFER, size, NULL, flags );
+        m_mapped = (char*)glMapBufferRange( GL_ARRAY_BUFFER, 0, size, flags );
+        if(!m_mapped){
+            /// Immutable storage can't be handed to glBufferData, so start over with a plain buffer
+            glDeleteBuffers( 1, &m_buffer );
+            glGenBuffers( 1, &m_buffer );
+            glBindBuffer( GL_ARRAY_BUFFER, m_buffer );
+        }
+    }
+    if(!m_mapped){
+        glBufferData( GL_ARRAY_BUFFER, m_capacity*m_vertexSize, NULL, GL_STREAM_DRAW );
+    }
+    gl_object_counts.stream_bytes += (m_mapped ? SEGMENTS : 1)*m_capacity*m_vertexSize;
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+/// Block until the GPU is done with the draws that were given this segment
+void StreamingBuffer::WaitForSegment(int segment)
+{
+    if(!m_fences[segment]){
+        return;
+    }
+    GLenum result = glClientWaitSync(m_fences[segment],GL_SYNC_FLUSH_COMMANDS_BIT,1000000);
+    while(result==GL_TIMEOUT_EXPIRED){
+        result = glClientWaitSync(m_fences[segment],0,1000000);
+    }
+    glDeleteSync(m_fences[segment]);
+    m_fences[segment]=0;
+}
@@ -0,0 +1,50 @@
+#ifndef STREAMING_BUFFER_H
+#define	STREAMING_BUFFER_H
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+/*!
+ * \brief Vertex buffer for data that is re-uploaded often, such as point clouds and per-frame lines
+ *
+ * When GL_ARB_buffer_storage is available the buffer is allocated once as SEGMENTS equal parts,
+ * mapped persistently, and written with a plain memcpy. Each upload goes to the next segment,
+ * after waiting on the fence placed when the GPU was last given that segment, so nothing that is
+ * still being drawn is overwritten and the driver never has to reallocate or synchronize.
+ *
+ * Without it, the buffer is orphaned with glBufferData(NULL) and filled with glBufferSubData.
+ *
+ * Either way the data of the last Upload() starts at vertex GetFirstVertex() of GetBuffer().
+ * The buffer object is replaced when a bigger upload does not fit, so VAOs need to be
+ * pointed at it again whenever Upload() returns true.
+ */
+class StreamingBuffer
+{
+public:
+    explicit StreamingBuffer(GLsizei vertex_size);
+    ~StreamingBuffer();
+
+    bool Upload(const void* data, size_t count);
+    void Release();
+
+    GLuint GetBuffer() const { return m_buffer; }
+    GLint GetFirstVertex() const { return m_firstVertex; }
+    bool IsPersistent() const { return m_mapped!=NULL; }
+
+    static const int SEGMENTS = 3;///!< Uploads that may be in flight at once in persistent mode
+
+private:
+    void Allocate(size_t capacity);
+    void WaitForSegment(int segment);
+
+    GLsizei m_vertexSize;///!< Bytes per vertex
+    size_t m_capacity;///!< Vertices per segment
+    GLuint m_buffer;
+    char* m_mapped;///!< Persistent mapping of the whole buffer, or NULL in the fallback mode
+    GLsync m_fences[SEGMENTS];
+    int m_segment;
+    GLint m_firstVertex;
+};
+
+
+#endif	/* STREAMING_BUFFER_H */
@@ -18,11 +18,22 @@
 
 #include <iostream>
 #include "texture.h"
+#include "gl_stats.h"
 
 Texture::Texture(GLenum TextureTarget, const std::string& FileName)
 {
     m_textureTarget = TextureTarget;
     m_fileName      = FileName;
+    m_textureObj    = 0;
+}
+
+Texture::~Texture()
+{
+    if (m_textureObj != 0)
+    {
+        glDeleteTextures(1, &m_textureObj);
+        gl_object_counts.textures--;
+    }
 }
 
 bool Texture::Load()
@@ -33,7 +44,11 @@ bool Texture::Load()
         return false;
     }
 
-    glGenTextures(1, &m_textureObj);
+    if (m_textureObj == 0)
+    {
+        glGenTextures(1, &m_textureObj);
+        gl_object_counts.textures++;
+    }
     glBindTexture(m_textureTarget, m_textureObj);
 
     glTexImage2D(GL_TEXTURE_2D,     // Type of texture
@@ -29,6 +29,7 @@ class Texture
 {
 public:
     Texture(GLenum TextureTarget, const std::string& FileName);
+    ~Texture();
 
     bool Load();
 
@@ -0,0 +1,67 @@
+#ifndef TRIPLE_BUFFER_H
+#define	TRIPLE_BUFFER_H
+
+#include <atomic>
+
+/*!
+ * \brief Lock-free mailbox for handing the newest data from one producer thread to one consumer thread
+ *
+ * There are three slots: one the producer (a ROS callback) is writing into, one the consumer
+ * (the render thread) is reading from, and one in the middle holding the newest finished data.
+ * Publish() and Update() just swap a slot index with the middle one atomically, so neither side
+ * ever blocks or copies, and the reader never sees a half-written slot. If the producer publishes
+ * faster than the consumer reads, the older data is simply overwritten.
+ *
+ * Slots are reused, so containers keep their capacity and stop allocating once they are big enough.
+ */
+template <class T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : m_write(0)
+        , m_middle(1)
+        , m_read(2)
+    {
+    }
+
+    /// The producer's slot. It holds whatever was in it the last time it was swapped out, so clear it as needed.
+    T& GetWriteBuffer() { return m_slots[m_write]; }
+
+    /// Hand the write slot over to the consumer
+    void Publish()
+    {
+        m_write = m_middle.exchange(m_write | FRESH) & INDEX_MASK;
+    }
+
+    /*!
+     * \brief Pick up the newest published slot, if there is one
+     *
+     * \return true if GetReadBuffer() now holds data that has not been seen before
+     */
+    bool Update()
+    {
+        if(!(m_middle.load() & FRESH)){
+            return false;
+        }
+        m_read = m_middle.exchange(m_read) & INDEX_MASK;
+        return true;
+    }
+
+    /// The consumer's slot, which only changes when Update() is called
+    const T& GetReadBuffer() const { return m_slots[m_read]; }
+
+private:
+    enum { INDEX_MASK = 3, FRESH = 4 };
+
+    TripleBuffer(const TripleBuffer&);
+    TripleBuffer& operator=(const TripleBuffer&);
+
+    T m_slots[3];
+    unsigned int m_write;///!< Only touched by the producer
+    std::atomic<unsigned int> m_middle;///!< Slot index, plus FRESH if it has not been picked up yet
+    unsigned int m_read;///!< Only touched by the consumer
+};
+
+
+#endif	/* TRIPLE_BUFFER_H */
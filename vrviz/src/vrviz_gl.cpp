@@ -1,6 +1,7 @@
 /// ROS
 #include <ros/ros.h>
 #include <ros/package.h>
+#include <ros/callback_queue.h>
 #include <urdf/model.h>
 
 /// Used to broadcast information about the VR system (positions, buttons)
@@ -10,13 +11,17 @@
 
 /// Used to render ros messages in the VR scene
 #include <tf/transform_listener.h>
-#include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/PointCloud2.h>
 #include <visualization_msgs/MarkerArray.h>
 #include <std_msgs/Bool.h>
 
+/// Used to report how vrviz itself is doing
+#include <diagnostic_msgs/DiagnosticArray.h>
+
 /// Needed for rendering image to overlay
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CompressedImage.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
@@ -25,18 +30,6 @@
 #include <image_geometry/pinhole_camera_model.h>
 #include <sensor_msgs/image_encodings.h>
 
-/// PCL specific includes
-#include <pcl_ros/point_cloud.h>
-#include <pcl/conversions.h>
-#include <pcl/filters/filter.h>
-#include <pcl/io/pcd_io.h>
-#include <pcl/point_cloud.h>
-#include <pcl/point_types.h>
-#include <pcl/common/transforms.h>
-
-/// PCL Bridge to/from ROS
-#include <pcl_conversions/pcl_conversions.h>
-
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/foreach.hpp>
@@ -48,6 +41,17 @@
 #include "openvr_gl.h"
 #endif
 
+#include "point_cloud.h"
+#include "point_map.h"
+#include "point_chunks.h"
+#include "image_converter.h"
+#include "image_uploader.h"
+#include "compressed_image.h"
+#include "marker_builder.h"
+#include "worker_pool.h"
+#include "triple_buffer.h"
+#include "gl_stats.h"
+
 
 struct tf_obj{
     Matrix4 transform;
@@ -62,12 +66,10 @@ ros::NodeHandle* pnh;
 ros::Publisher controller_pub[3];
 ros::Publisher twist_pub;
 ros::Publisher navgoal_pub;
+ros::Publisher diagnostics_pub;
 tf::TransformBroadcaster* broadcaster;
 tf::TransformListener* listener;
 image_transport::ImageTransport* image_transporter;
-image_geometry::PinholeCameraModel cam_model;
-std::string camera_frame_id;
-bool camera_image_received = false;
 
 /// Parameters
 std::string vrviz_include_path;
@@ -77,20 +79,18 @@ std::string texture_character_map=" !\"#$%&\'()*+,-./0123456789:;<=>?@ABCDEFGHIJ
 std::string base_frame = "vrviz_base";
 std::string intermediate_frame = "vrviz_intermediate";
 std::string frame_prefix = base_frame;
-float hud_dist=1.0;///!< meters; distance that the head's up display will appear away
-float hud_size=2.0;///!< Radians; How much
 float scaling_factor=1.0f;///!< Unitless; for values >1.0 this will make the scene bigger, relative to the person in VR
 int point_size=1;
-bool sbs_image=true;///!< If true, render the left half of the image to the left eye, the right half to the right eye. If false, render whole image to both eyes
+int worker_threads=0;///!< Threads used to split up heavy callbacks like point cloud conversion; 0 picks one less than the number of cores
+bool accumulate_clouds=false;///!< If true, clouds are added to point_map in base_frame instead of replacing each other
+float map_node_size=2.0;///!< meters; edge length of the point map nodes, which are also the pieces it is uploaded in
+float cull_chunk_size=2.0;///!< meters; edge length of the grid cells a cloud is split into for frustum culling
+int marker_upload_budget_kb=2048;///!< KiB of marker geometry uploaded per frame, so a burst of marker changes is spread over several frames
 bool show_tf=false;
 bool load_robot=false;
 bool show_grid=true;
 bool show_movement=true;
-bool axis_colored_pc=false;
-bool use_hsv=true;
-float intensity_max=0.0;
-bool manual_image_copy = false;
-int overlay_alpha = 255;
+bool compressed_depth_color = false;///!< Subscribe to <depth_color>/compressed and decode it here, instead of to the raw image
 bool teleport_mode=false;
 float teleport_throw_speed=10.0;///!< m/s
 float teleport_gravity=9.81;///!< m/s^2, 9.81 for Earth, 3.7 for Mars
@@ -107,27 +107,193 @@ float navgoal_g=0.0;///!< 0->1
 float navgoal_b=1.0;///!< 0->1
 
 /// This is a flag that tells the VR code that we have new ROS data
-/// \todo This should be a semaphore or mutex
-volatile bool scene_update_needed=true;
+/// The data itself is handed over through the mailboxes below, or the uploader of each image stream
+std::atomic<bool> scene_update_needed(true);
+
+/*!
+ * \brief Check that the rows of an image can be read straight out of the message
+ *
+ * GL_UNPACK_ROW_LENGTH counts pixels, so the step has to be a whole number of them.
+ *
+ * \param msg
+ * \param pixel_bytes Bytes per pixel of the encoding
+ * \return False if the message is empty, padded oddly, or shorter than its header says
+ */
+bool checkImageRows(const sensor_msgs::Image& msg, size_t pixel_bytes)
+{
+    return msg.width>0 && msg.height>0
+            && msg.step%pixel_bytes == 0
+            && msg.step >= msg.width*pixel_bytes
+            && msg.data.size() >= size_t(msg.step)*msg.height;
+}
 
 #ifdef USE_VULKAN
 #else
-/// Variables for rendering image to overlay
-GLuint textureFromImage = 0;
+/*!
+ * \brief Work out whether GL can take the message data as is, so it doesn't have to be converted at all
+ *
+ * \param msg
+ * \param upload Set to the format to upload msg with
+ * \return False if msg has to be converted to RGBA first
+ */
+bool getNativeImageFormat(const sensor_msgs::Image& msg, ImageUploadFormat& upload)
+{
+    namespace enc = sensor_msgs::image_encodings;
+    upload.internal_format = GL_RGBA8;
+    upload.type = GL_UNSIGNED_BYTE;
+    upload.gray = false;
+    upload.swap_bytes = false;
+    if(msg.encoding == enc::RGB8){
+        upload.format = GL_RGB;
+        upload.pixel_bytes = 3;
+    }else if(msg.encoding == enc::BGR8){
+        upload.format = GL_BGR;
+        upload.pixel_bytes = 3;
+    }else if(msg.encoding == enc::RGBA8){
+        upload.format = GL_RGBA;
+        upload.pixel_bytes = 4;
+    }else if(msg.encoding == enc::BGRA8){
+        upload.format = GL_BGRA;
+        upload.pixel_bytes = 4;
+    }else if(msg.encoding == enc::MONO8){
+        upload.internal_format = GL_R8;
+        upload.format = GL_RED;
+        upload.pixel_bytes = 1;
+        upload.gray = true;
+    }else if(msg.encoding == enc::MONO16){
+        upload.internal_format = GL_R16;
+        upload.format = GL_RED;
+        upload.type = GL_UNSIGNED_SHORT;
+        upload.pixel_bytes = 2;
+        upload.gray = true;
+        upload.swap_bytes = msg.is_bigendian;
+    }else{
+        return false;
+    }
+    /// Odd row padding still has to go through the converter
+    return checkImageRows(msg,upload.pixel_bytes);
+}
+#endif
+
+/*!
+ * \brief An image or camera topic, shown on an overlay of its own
+ *
+ * Like the cloud streams, every image stream has its own callback queue and spinner thread (and
+ * decode thread, for compressed images), so a 4K camera never holds up the other feeds. Its
+ * conversions only spread over the shared worker pool when that is not busy.
+ * The global image settings can be overridden per stream in the ~image_<index> namespace.
+ */
+struct ImageStream
+{
+    ImageStream()
+        : use_camera_info(true), compressed(false), hud_dist(1.0), hud_size(2.0), sbs(true), alpha(255), max_rate(0.0)
+        , decoder(NULL), camera_received(false), spinner(NULL), overlay(vr::k_ulOverlayHandleInvalid) {}
+    std::string topic;
+    bool use_camera_info;///!< Place the overlay in front of the camera in the scene, rather than in front of the HMD
+    bool compressed;///!< Subscribe to <topic>/compressed and decode it here
+    float hud_dist;
+    float hud_size;
+    bool sbs;
+    int alpha;
+    double max_rate;///!< Hz; images that arrive faster than this are dropped, 0 for no limit
+    ros::WallTime last_image;///!< Only used by the spinner of the stream
+    ImageConverter converter;
+#ifndef USE_VULKAN
+    ImageUploader uploader;
 #endif
-bool received_image=false;
-bool received_first_image=false;
-boost::mutex image_mutex;
-cv::Mat image_flipped;
-cv_bridge::CvImagePtr cv_ptr_raw;
+    CompressedImageDecoder* decoder;
+    boost::mutex camera_mutex;///!< Protects the camera fields below
+    image_geometry::PinholeCameraModel cam_model;
+    std::string camera_frame_id;
+    bool camera_received;
+    ros::NodeHandle nh;///!< Subscribes through queue, rather than the global queue
+    ros::CallbackQueue queue;
+    image_transport::CameraSubscriber camera_subscriber;
+    image_transport::Subscriber image_subscriber;
+    ros::Subscriber compressed_subscriber;
+    ros::Subscriber info_subscriber;
+    ros::AsyncSpinner* spinner;
+    vr::VROverlayHandle_t overlay;///!< Created and used by the VR thread
+};
+std::vector<ImageStream*> image_streams;
+CompressedImageDecoder* depth_color_decoder = NULL;
+sensor_msgs::ImagePtr decoded_depth_color;///!< Only used by the thread of depth_color_decoder
 
 
 /// Arrays of objects to be rendered. These have been converted into VR space, and are in a format easily rendered by the VR code.
 /// We do this so that the maximum amount of work can be done by the ROS spinner thread, and the VR code can run as fast as possible
-/// \warning These arrays are edited by the ROS callback, and read by the VR code! This is probably NOT THREADSAFE!
+/// Each stream goes through its own TripleBuffer, so the ROS callback builds the next array while the VR code reads the last one.
 
-std::vector<float> color_points_vertdataarray;
-std::vector<float> textured_tris_vertdataarray;
+/// How the shader should color points that carry a scalar, see PointCloudDecoder::HasScalars()
+struct PointColorScale
+{
+    PointColorScale() : scalars(false), min(0.0f), max(1.0f) {}
+    bool scalars;///!< If false, the points carry colors and the rest is unused
+    float min;
+    float max;
+    std::vector<uint32_t> colormap;///!< RGBA8 texels
+};
+
+/// A converted cloud, along with the frame it should be drawn in
+struct PointCloudFrame
+{
+    std::vector<PointVertex> points;
+    std::vector<PointChunk> chunks;///!< Grid cells the points are sorted into, for culling
+    std::string frame_id;
+    PointColorScale color_scale;
+};
+
+TripleBuffer<std::vector<float> > textured_tris_buffer;
+
+/*!
+ * \brief One subscribed point cloud topic
+ *
+ * Each topic is converted with its own settings into its own buffer, and drawn in the frame of its
+ * own messages. It also has its own callback queue and spinner thread, so a slow lidar never holds
+ * up a fast depth camera.
+ */
+struct CloudStream
+{
+    CloudStream() : point_size(1), spinner(NULL) {}
+    std::string topic;
+    PointCloudDecoder decoder;///!< Converts incoming clouds straight into the layout of buffer
+    PointChunker chunker;///!< Sorts clouds into grid cells, so the VR code can skip the ones out of view
+    TripleBuffer<PointCloudFrame> buffer;
+    std::vector<PointVertex> map_input;///!< Converted cloud on its way into point_map, only used with accumulate_clouds
+    int point_size;
+    ros::NodeHandle nh;///!< Subscribes through queue, rather than the global queue
+    ros::CallbackQueue queue;
+    ros::Subscriber subscriber;
+    ros::AsyncSpinner* spinner;
+};
+std::vector<CloudStream*> cloud_streams;
+
+/// Shared by the callbacks to spread large conversions over several cores
+WorkerPool* worker_pool = NULL;
+
+/// Builds line, triangle and list markers off the render thread
+MarkerBuilder* marker_builder = NULL;
+
+/// Accumulated clouds, only used with accumulate_clouds
+PointMap point_map;
+TripleBuffer<PointColorScale> point_map_color_scale;
+boost::mutex point_map_color_mutex;///!< Every cloud stream publishes to point_map_color_scale
+
+/// A depth image, and optionally a color image registered to it, that the VR code turns into points on the GPU
+/// The messages are shared rather than copied, since the pixels only have to be read once for the upload
+struct DepthFrame
+{
+    sensor_msgs::ImageConstPtr depth;
+    sensor_msgs::ImageConstPtr color;///!< NULL if there is no color image of the same size
+    float fx, fy, cx, cy;///!< Pinhole intrinsics, in pixels
+};
+
+TripleBuffer<DepthFrame> depth_buffer;
+boost::mutex depth_color_mutex;
+sensor_msgs::ImageConstPtr depth_color;///!< Latest registered color image, protected by depth_color_mutex
+
+/// Live GL objects, published on /diagnostics so leaks can be spotted in long sessions
+GLObjectCounts gl_object_counts;
 
 
 /*!
@@ -156,6 +322,9 @@ private:
     Vector3 navgoal_target;
     Vector3 navgoal_start;
     std::vector<tf_obj> tf_cache;
+    boost::mutex tf_cache_mutex;///!< The render thread, the timer and every cloud stream look up poses
+    std::vector<PointMap::Update> point_map_updates;
+    std::vector<uint64_t> point_map_removed;
 
    public:
 
@@ -193,44 +362,64 @@ private:
         /// Call the normal part of initializing OpenGL stuff
         bool bSuccess = CMainApplication::BInitGL();
 
-        /// Now set up the Overlay
-        vr::HmdError m_eOverlayError;
-        vr::Compositor_OverlaySettings m_overlaySettings;
-        std::string m_strName="systemoverlay";
-        if( vr::VROverlay() )
-        {
-            std::string sKey = std::string( "sample." ) + m_strName;
-            vr::VROverlayError overlayError = vr::VROverlay()->CreateOverlay( sKey.c_str(), m_strName.c_str(), &m_ulOverlayHandle );
-            bSuccess = bSuccess && (overlayError == vr::VROverlayError_None);
+        /// Tessellate the marker shapes up front, rather than when the first marker arrives
+        if(bSuccess){
+            Mesh::InitPrimitiveLibrary();
+        }
+
+        /// Now set up an overlay for every image stream
+        for(size_t ii=0;ii<image_streams.size() && bSuccess;ii++){
+            bSuccess = CreateImageOverlay(*image_streams[ii],ii);
         }
 
-        if( bSuccess )
+        return bSuccess;
+    }
+
+    /*!
+     * \brief Create the overlay of an image stream, floating in front of the HMD until its first camera info arrives
+     */
+    bool CreateImageOverlay(ImageStream& stream, size_t index)
+    {
+        if( !vr::VROverlay() )
         {
-            /// This seems to break sbs mode, and for cameras it looks weird to draw on top of everything, so we don't use it.
-            /// But if in a later update it works for sbs mode, it would be nice to use.
-            //vr::VROverlay()->SetHighQualityOverlay(m_ulOverlayHandle);
-
-            vr::VROverlay()->SetOverlayFlag(m_ulOverlayHandle, vr::VROverlayFlags_SideBySide_Parallel, sbs_image );
-            vr::VROverlay()->SetOverlayWidthInMeters(m_ulOverlayHandle, hud_size*hud_dist);
-            OverlayTransform.m[0][3]=0.0;
-            OverlayTransform.m[1][3]=0.0;
-            OverlayTransform.m[2][3]=-hud_dist;
-            OverlayTransform.m[0][0]=1.0;
-            OverlayTransform.m[0][1]=0.0;
-            OverlayTransform.m[0][2]=0.0;
-            OverlayTransform.m[1][0]=0.0;
-            OverlayTransform.m[1][1]=1.0;
-            OverlayTransform.m[1][2]=0.0;
-            OverlayTransform.m[2][0]=0.0;
-            OverlayTransform.m[2][1]=0.0;
-            OverlayTransform.m[2][2]=1.0;
-            vr::VROverlay()->SetOverlayTransformTrackedDeviceRelative(m_ulOverlayHandle, vr::k_unTrackedDeviceIndex_Hmd, &OverlayTransform);
-            vr::VROverlay()->SetOverlayInputMethod( m_ulOverlayHandle, vr::VROverlayInputMethod_Mouse );
-        }else{
             ROS_ERROR("Failed to setup VR Overlay");
+            return false;
+        }
+        std::string sName = "systemoverlay" + (index>0 ? std::to_string(index) : std::string());
+        std::string sKey = std::string( "sample." ) + sName;
+        vr::VROverlayError overlayError = vr::VROverlay()->CreateOverlay( sKey.c_str(), sName.c_str(), &stream.overlay );
+        if( overlayError != vr::VROverlayError_None )
+        {
+            ROS_ERROR("Failed to setup VR Overlay for %s",stream.topic.c_str());
+            return false;
         }
 
-        return bSuccess;
+        /// This seems to break sbs mode, and for cameras it looks weird to draw on top of everything, so we don't use it.
+        /// But if in a later update it works for sbs mode, it would be nice to use.
+        //vr::VROverlay()->SetHighQualityOverlay(stream.overlay);
+
+        vr::VROverlay()->SetOverlayFlag(stream.overlay, vr::VROverlayFlags_SideBySide_Parallel, stream.sbs );
+        vr::VROverlay()->SetOverlayWidthInMeters(stream.overlay, stream.hud_size*stream.hud_dist);
+        /// Images are uploaded top row first, so flip v to show them the right way up
+        vr::VRTextureBounds_t bounds = {0.0f,1.0f,1.0f,0.0f};
+        vr::VROverlay()->SetOverlayTextureBounds(stream.overlay, &bounds);
+        vr::VROverlay()->SetOverlayAlpha(stream.overlay, stream.alpha/255.0f);
+        vr::HmdMatrix34_t transform;
+        transform.m[0][3]=0.0;
+        transform.m[1][3]=0.0;
+        transform.m[2][3]=-stream.hud_dist;
+        transform.m[0][0]=1.0;
+        transform.m[0][1]=0.0;
+        transform.m[0][2]=0.0;
+        transform.m[1][0]=0.0;
+        transform.m[1][1]=1.0;
+        transform.m[1][2]=0.0;
+        transform.m[2][0]=0.0;
+        transform.m[2][1]=0.0;
+        transform.m[2][2]=1.0;
+        vr::VROverlay()->SetOverlayTransformTrackedDeviceRelative(stream.overlay, vr::k_unTrackedDeviceIndex_Hmd, &transform);
+        vr::VROverlay()->SetOverlayInputMethod( stream.overlay, vr::VROverlayInputMethod_Mouse );
+        return true;
     }
 #endif
 
@@ -251,7 +440,15 @@ private:
 
             RenderFrame();
 
-            if(scene_update_needed){
+#ifndef USE_VULKAN
+            UpdateImageOverlays();
+            /// Every frame, not only on scene updates, so what is over the budget goes up in the next ones
+            if(marker_builder){
+                marker_builder->Upload();
+            }
+#endif
+
+            if(scene_update_needed.exchange(false)){
                 SetupScene();
             }
 
@@ -262,6 +459,193 @@ private:
     }
 
 #ifndef USE_VULKAN
+    /*!
+     * \brief Release the GL buffers of the image streams and of the shared mesh pool
+     *
+     * The spinners and decoders write into those, so this is only called once all of them have stopped.
+     */
+    void ReleaseStreams()
+    {
+        for(size_t ii=0;ii<image_streams.size();ii++){
+            image_streams[ii]->uploader.Release();
+        }
+        Mesh::MeshEntry::ReleasePool();
+    }
+#endif
+
+#ifndef USE_VULKAN
+    /*!
+     * \brief Point a VAO at a buffer of PointVertex
+     * \param vao      Vertex array to set up
+     * \param buffer   Buffer holding the vertices
+     */
+    void SetupColorVertexArray( GLuint vao, GLuint buffer )
+    {
+        glBindVertexArray( vao );
+        glBindBuffer( GL_ARRAY_BUFFER, buffer );
+
+        /// Float position followed by the color as 4 normalized bytes, see PointVertex
+        GLuint stride = sizeof( PointVertex );
+        uintptr_t offset = 0;
+
+        glEnableVertexAttribArray( 0 );
+        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+
+        offset += 3 * sizeof( float );
+        glEnableVertexAttribArray( 1 );
+        glVertexAttribPointer( 1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (const void *)offset);
+
+        /// The same bytes read as a float, for the points that carry a scalar instead of a color
+        glEnableVertexAttribArray( 2 );
+        glVertexAttribPointer( 2, 1, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+
+        glBindVertexArray( 0 );
+    }
+
+    /*!
+     * \brief Take over the colormap range of new points, and upload the colormap if it changed
+     * \param state   Color state of the points being replaced
+     * \param scale   Color scale that came with the points
+     */
+    void ApplyColorScale( PointColorState& state, const PointColorScale& scale )
+    {
+        state.m_bScalars = scale.scalars;
+        if( !scale.scalars ){
+            return;
+        }
+        state.m_fScalarMin = scale.min;
+        state.m_fScalarMax = scale.max;
+        if( scale.colormap == state.m_vecColormap ){
+            return;
+        }
+        state.m_vecColormap = scale.colormap;
+        if( state.m_unColormapTexture == 0 ){
+            glGenTextures( 1, &state.m_unColormapTexture );
+            gl_object_counts.textures++;
+            glBindTexture( GL_TEXTURE_1D, state.m_unColormapTexture );
+            glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+            glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+            glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        }
+        glBindTexture( GL_TEXTURE_1D, state.m_unColormapTexture );
+        glTexImage1D( GL_TEXTURE_1D, 0, GL_RGBA8, state.m_vecColormap.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, &state.m_vecColormap[0] );
+        glBindTexture( GL_TEXTURE_1D, 0 );
+    }
+
+    /*!
+     * \brief Upload a depth image (and its color image) into the textures read by the depth shader
+     * \param frame   Images and intrinsics, as checked by depthCallback()
+     */
+    void UploadDepthFrame( const DepthFrame& frame )
+    {
+        const sensor_msgs::Image& depth = *frame.depth;
+        if( m_unDepthVAO == 0 ){
+            glGenVertexArrays( 1, &m_unDepthVAO );
+            glGenTextures( 1, &m_unDepthTexture );
+            glGenTextures( 1, &m_unDepthColorTexture );
+            gl_object_counts.vertex_arrays++;
+            gl_object_counts.textures += 2;
+            GLuint textures[2] = { m_unDepthTexture, m_unDepthColorTexture };
+            for( int ii=0; ii<2; ii++ ){
+                glBindTexture( GL_TEXTURE_2D, textures[ii] );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+            }
+        }
+
+        /// 16 bit depth is in millimeters, and read back normalized, so 1.0 is 65535mm
+        bool is_float = depth.encoding==sensor_msgs::image_encodings::TYPE_32FC1;
+        GLsizei pixel_size = is_float ? 4 : 2;
+        GLint internal_format = is_float ? GL_R32F : GL_R16;
+        m_fDepthScale = (is_float ? 1.0f : 65.535f) * scaling_factor;
+        m_vDepthIntrinsics = Vector4( frame.fx, frame.fy, frame.cx, frame.cy );
+        m_strDepthFrame = depth.header.frame_id;
+
+        /// The rows are read straight out of the message, padding and all
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+        glPixelStorei( GL_UNPACK_ROW_LENGTH, depth.step / pixel_size );
+        glPixelStorei( GL_UNPACK_SWAP_BYTES, depth.is_bigendian ? GL_TRUE : GL_FALSE );
+        glBindTexture( GL_TEXTURE_2D, m_unDepthTexture );
+        if( depth.width!=m_uiDepthWidth || depth.height!=m_uiDepthHeight || internal_format!=m_iDepthInternalFormat ){
+            glTexImage2D( GL_TEXTURE_2D, 0, internal_format, depth.width, depth.height, 0, GL_RED,
+                          is_float ? GL_FLOAT : GL_UNSIGNED_SHORT, &depth.data[0] );
+            m_iDepthInternalFormat = internal_format;
+        }else{
+            glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, depth.width, depth.height, GL_RED,
+                             is_float ? GL_FLOAT : GL_UNSIGNED_SHORT, &depth.data[0] );
+        }
+        glPixelStorei( GL_UNPACK_SWAP_BYTES, GL_FALSE );
+
+        m_bDepthHasColor = (bool)frame.color;
+        if( m_bDepthHasColor ){
+            const sensor_msgs::Image& color = *frame.color;
+            int channels = sensor_msgs::image_encodings::numChannels(color.encoding);
+            GLenum format = GL_RGB;
+            if( color.encoding==sensor_msgs::image_encodings::BGR8 ){
+                format = GL_BGR;
+            }else if( color.encoding==sensor_msgs::image_encodings::RGBA8 ){
+                format = GL_RGBA;
+            }else if( color.encoding==sensor_msgs::image_encodings::BGRA8 ){
+                format = GL_BGRA;
+            }
+            glPixelStorei( GL_UNPACK_ROW_LENGTH, color.step / channels );
+            glBindTexture( GL_TEXTURE_2D, m_unDepthColorTexture );
+            /// The texture is always RGBA8, so only a new size needs new storage
+            if( color.width!=m_uiDepthColorWidth || color.height!=m_uiDepthColorHeight ){
+                glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, color.width, color.height, 0, format, GL_UNSIGNED_BYTE, &color.data[0] );
+                m_uiDepthColorWidth = color.width;
+                m_uiDepthColorHeight = color.height;
+            }else{
+                glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, color.width, color.height, format, GL_UNSIGNED_BYTE, &color.data[0] );
+            }
+        }
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
+        m_uiDepthWidth = depth.width;
+        m_uiDepthHeight = depth.height;
+    }
+
+    /*!
+     * \brief Upload the nodes of the point map that changed since last time, and drop the removed ones
+     */
+    void UpdatePointMapChunks()
+    {
+        if( point_map_color_scale.Update() ){
+            ApplyColorScale( m_pointMapColorState, point_map_color_scale.GetReadBuffer() );
+        }
+        point_map.TakeUpdates(point_map_updates,point_map_removed);
+        for(size_t ii=0;ii<point_map_removed.size();ii++){
+            std::unordered_map<uint64_t,PointMapChunk>::iterator it = m_mapPointMapChunks.find(point_map_removed[ii]);
+            if(it==m_mapPointMapChunks.end()){
+                continue;
+            }
+            glDeleteVertexArrays( 1, &it->second.m_unVAO );
+            glDeleteBuffers( 1, &it->second.m_glVertBuffer );
+            gl_object_counts.vertex_arrays--;
+            gl_object_counts.buffers--;
+            m_mapPointMapChunks.erase(it);
+        }
+        for(size_t ii=0;ii<point_map_updates.size();ii++){
+            const PointMap::Update& update = point_map_updates[ii];
+            PointMapChunk& chunk = m_mapPointMapChunks[update.key];
+            if(chunk.m_unVAO==0){
+                glGenVertexArrays( 1, &chunk.m_unVAO );
+                glGenBuffers( 1, &chunk.m_glVertBuffer );
+                gl_object_counts.vertex_arrays++;
+                gl_object_counts.buffers++;
+                SetupColorVertexArray( chunk.m_unVAO, chunk.m_glVertBuffer );
+            }
+            glBindBuffer( GL_ARRAY_BUFFER, chunk.m_glVertBuffer );
+            glBufferData( GL_ARRAY_BUFFER, sizeof(PointVertex) * update.points.size(), &update.points[0], GL_DYNAMIC_DRAW );
+            chunk.m_uiVertcount = update.points.size();
+            point_map.GetNodeBounds(update.key,chunk.m_vMin,chunk.m_vMax);
+        }
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        m_strPointMapFrame = base_frame;
+    }
+
     /*!
      * \brief RenderControllerAxes
      *
@@ -272,10 +656,11 @@ private:
      */
     void RenderControllerAxes()
     {
-        std::vector<float> vertdataarray;
+        std::vector<PointVertex> vertdataarray;
         m_uiControllerVertcount=0;
         if(show_tf){
             /// Show the 3 axis of every frame in our cache
+            boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
             for(int ii=0;ii<tf_cache.size();ii++){
                 add_frame_to_scene(tf_cache[ii].transform,vertdataarray,0.1/scaling_factor);
             }
@@ -309,31 +694,17 @@ private:
         if ( m_unControllerVAO == 0 )
         {
             glGenVertexArrays( 1, &m_unControllerVAO );
-            glBindVertexArray( m_unControllerVAO );
-
-            glGenBuffers( 1, &m_glControllerVertBuffer );
-            glBindBuffer( GL_ARRAY_BUFFER, m_glControllerVertBuffer );
-
-            GLuint stride = 2 * 3 * sizeof( float );
-            uintptr_t offset = 0;
-
-            glEnableVertexAttribArray( 0 );
-            glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
-
-            offset += sizeof( Vector3 );
-            glEnableVertexAttribArray( 1 );
-            glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
-
-            glBindVertexArray( 0 );
+            gl_object_counts.vertex_arrays++;
         }
 
-        glBindBuffer( GL_ARRAY_BUFFER, m_glControllerVertBuffer );
-
         // set vertex data if we have some
         if( vertdataarray.size() > 0 )
         {
-            //$ TODO: Use glBufferSubData for this...
-            glBufferData( GL_ARRAY_BUFFER, sizeof(float) * vertdataarray.size(), &vertdataarray[0], GL_STREAM_DRAW );
+            if( m_controllerStream.Upload( &vertdataarray[0], vertdataarray.size() ) )
+            {
+                SetupColorVertexArray( m_unControllerVAO, m_controllerStream.GetBuffer() );
+            }
+            m_nControllerFirstVert = m_controllerStream.GetFirstVertex();
         }
 
     }
@@ -444,57 +815,9 @@ private:
         if ( !m_pHMD )
             return;
 
-
-        if(received_image && (manual_image_copy || image_mutex.try_lock())){
-#ifdef USE_VULKAN
-            /// \todo Bind texture
-#else
-            /// Bind texture
-            BindCVMat2GLTexture(textureFromImage);
-            /// Avoid recopying the same data
-            if(!manual_image_copy){
-                received_image = false;
-            }
-            /// Allow the subscriber to change the data
-            image_mutex.unlock();
-            /// Convert to a 'vr' texture
-            vr::Texture_t texture = {(void*)(uintptr_t)textureFromImage, vr::TextureType_OpenGL, vr::ColorSpace_Auto };
-            /// Set this texture to appear on the overlay and enable it. \note this may not need to be done every time?
-            vr::VROverlay()->SetOverlayTexture( m_ulOverlayHandle, &texture );
-
-            /// Only mess with location if it's a camera. If it's a plain image msg, we just put it directly in front of the HMD.
-            if(camera_image_received){
-                /// We should actually use some matrix from cam_model, but this is approximate.
-                /// We use hfov instead of hud_size, since it's a camera so we know the FOV.
-                float hfov = 2*atan(cam_model.cameraInfo().width/(2.0*cam_model.fx()));
-                /// Flip the image 180 about x, to match ROS's camera frame standard
-                /// And put it hud_dist away. This is a param, and may be adjusted.
-                Matrix4 mat1;
-                mat1.set(1,0,0,0,
-                         0,-1,0,0,
-                         0,0,-1,0,
-                         0,0,hud_dist,1);
-    //            cv::Matx34d proj = cam_model.projectionMatrix();
-    //            mat1.set(proj.val[0],proj.val[1],proj.val[2],0,
-    //                     proj.val[3],proj.val[4],proj.val[5],0,
-    //                     proj.val[6],proj.val[7],proj.val[8],0,
-    //                     0,0,hud_dist,1);
-    //            std::cout << "mat1="<< std::endl << mat1<< std::endl;
-                /// Get the location that the "monitor" should be. It'll be hud_dist away from the optical frame of the camera.
-                Matrix4 monitor_loc=GetRobotMatrixPose(camera_frame_id)*mat1;
-                /// Make it a VR matrix
-                OverlayTransform=ConvertMatrix4ToSteamVRMatrix(monitor_loc);
-                /// Set the transform and width. Note that the width probably won't change, as camera params are usually static.
-                vr::VROverlay()->SetOverlayTransformAbsolute(m_ulOverlayHandle, vr::TrackingUniverseStanding, &OverlayTransform);
-                vr::VROverlay()->SetOverlayWidthInMeters(m_ulOverlayHandle, hfov*hud_dist);
-            }
-            /// Set the overlay to visible.
-            vr::VROverlay()->ShowOverlay(m_ulOverlayHandle);
-#endif
-        }else{
-            //ROS_ERROR("no image as of yet");
-        }
-
+        /// Pick up the newest text, if any has arrived since last time
+        bool text_updated = textured_tris_buffer.Update();
+        const std::vector<float>& textured_tris_vertdataarray = textured_tris_buffer.GetReadBuffer();
         m_uiVertcount = textured_tris_vertdataarray.size()/5;
 
 #ifdef USE_VULKAN
@@ -528,62 +851,73 @@ private:
             vkMapMemory( m_pDevice, m_pSceneConstantBufferMemory[ nEye ], 0, VK_WHOLE_SIZE, 0, &m_pSceneConstantBufferData[ nEye ] );
         }
 #else
-        if(textured_tris_vertdataarray.size()>0){
+        if ( m_unSceneVAO == 0 )
+        {
             glGenVertexArrays( 1, &m_unSceneVAO );
-            glBindVertexArray( m_unSceneVAO );
-
-            glGenBuffers( 1, &m_glSceneVertBuffer );
-            glBindBuffer( GL_ARRAY_BUFFER, m_glSceneVertBuffer );
-            glBufferData( GL_ARRAY_BUFFER, sizeof(float) * textured_tris_vertdataarray.size(), &textured_tris_vertdataarray[0], GL_STATIC_DRAW);
+            gl_object_counts.vertex_arrays++;
+        }
 
-            GLsizei stride = sizeof(VertexDataScene);
-            uintptr_t offset = 0;
+        if(text_updated && textured_tris_vertdataarray.size()>0){
+            if( m_sceneStream.Upload( &textured_tris_vertdataarray[0], m_uiVertcount ) )
+            {
+                glBindVertexArray( m_unSceneVAO );
+                glBindBuffer( GL_ARRAY_BUFFER, m_sceneStream.GetBuffer() );
 
-            glEnableVertexAttribArray( 0 );
-            glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride , (const void *)offset);
+                GLsizei stride = sizeof(VertexDataScene);
+                uintptr_t offset = 0;
 
-            offset += sizeof(Vector3);
-            glEnableVertexAttribArray( 1 );
-            glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+                glEnableVertexAttribArray( 0 );
+                glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride , (const void *)offset);
 
+                offset += sizeof(Vector3);
+                glEnableVertexAttribArray( 1 );
+                glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
 
-            glBindVertexArray( 0 );
-            glDisableVertexAttribArray(0);
-            glDisableVertexAttribArray(1);
+                glBindVertexArray( 0 );
+            }
+            m_nSceneFirstVert = m_sceneStream.GetFirstVertex();
         }
 
-
-
-        // Setup the VAO the first time through.
-        if ( m_unPointCloudVAO == 0 )
+        if( accumulate_clouds )
         {
-            glGenVertexArrays( 1, &m_unPointCloudVAO );
-            glBindVertexArray( m_unPointCloudVAO );
-
-            glGenBuffers( 1, &m_glPointCloudVertBuffer );
-            glBindBuffer( GL_ARRAY_BUFFER, m_glPointCloudVertBuffer );
-
-            GLuint stride = 2 * 3 * sizeof( float );
-            uintptr_t offset = 0;
-
-            glEnableVertexAttribArray( 0 );
-            glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
-
-            offset += sizeof( Vector3 );
-            glEnableVertexAttribArray( 1 );
-            glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
-
-            glBindVertexArray( 0 );
+            UpdatePointMapChunks();
         }
 
-        glBindBuffer( GL_ARRAY_BUFFER, m_glPointCloudVertBuffer );
+        // set vertex data for every topic that has a new cloud
+        for( size_t ii=0; ii<cloud_streams.size(); ii++ )
+        {
+            // Setup the layer and its VAO the first time through.
+            if( m_vecPointCloudLayers.size() <= ii )
+            {
+                m_vecPointCloudLayers.push_back( new PointCloudLayer() );
+                glGenVertexArrays( 1, &m_vecPointCloudLayers[ii]->m_unVAO );
+                gl_object_counts.vertex_arrays++;
+            }
+            if( !cloud_streams[ii]->buffer.Update() )
+            {
+                continue;
+            }
+            PointCloudLayer& layer = *m_vecPointCloudLayers[ii];
+            const PointCloudFrame& cloud = cloud_streams[ii]->buffer.GetReadBuffer();
+            layer.m_strFrame = cloud.frame_id;
+            layer.m_uiVertcount = cloud.points.size();
+            layer.m_vecChunks = cloud.chunks;
+            layer.m_unPointSize = cloud_streams[ii]->point_size;
+            ApplyColorScale( layer.m_colorState, cloud.color_scale );
+            if( cloud.points.size() > 0 )
+            {
+                if( layer.m_stream.Upload( &cloud.points[0], cloud.points.size() ) )
+                {
+                    SetupColorVertexArray( layer.m_unVAO, layer.m_stream.GetBuffer() );
+                }
+                layer.m_nFirstVert = layer.m_stream.GetFirstVertex();
+            }
+        }
 
-        // set vertex data if we have some
-        m_uiPointCloudVertcount = color_points_vertdataarray.size()/6;
-        if( color_points_vertdataarray.size() > 0 )
+        // set the depth textures if we have a new depth image
+        if( depth_buffer.Update() )
         {
-            //$ TODO: Use glBufferSubData for this...
-            glBufferData( GL_ARRAY_BUFFER, sizeof(float) * color_points_vertdataarray.size(), &color_points_vertdataarray[0], GL_STREAM_DRAW );
+            UploadDepthFrame( depth_buffer.GetReadBuffer() );
         }
 
         for(int idx=0;idx<robot_meshes.size();idx++){
@@ -592,10 +926,64 @@ private:
                 robot_meshes[idx]->InitMarker(scaling_factor);
             }
         }
+        std::vector<Mesh*> retired_markers;
+        std::vector<Mesh*> model_markers;
+        {
+            boost::mutex::scoped_lock lock(marker_registry.GetMutex());
+            const std::vector<Mesh*>& markers = marker_registry.GetMeshes();
+            for(size_t idx=0;idx<markers.size();idx++){
+                if(!markers[idx]->needs_update){
+                    continue;
+                }
+                if(markers[idx]->marker.type==visualization_msgs::Marker::MESH_RESOURCE && markers[idx]->load_mesh){
+                    /// Loaded below, since assimp would keep the ROS thread out of the registry for the whole file
+                    if(marker_builder){
+                        marker_builder->Forget(markers[idx]);
+                    }
+                    model_markers.push_back(markers[idx]);
+                    continue;
+                }
+                if(marker_builder && Mesh::BuildsOnCpu(markers[idx]->marker.type)){
+                    /// Built on the workers, and uploaded later by RunMainLoop
+                    marker_builder->Submit(markers[idx],scaling_factor);
+                    markers[idx]->needs_update=false;
+                }else{
+                    /// The type may have changed, so don't let older geometry overwrite it
+                    if(marker_builder){
+                        marker_builder->Forget(markers[idx]);
+                    }
+                    markers[idx]->InitMarker(scaling_factor);
+                }
+            }
+            marker_registry.TakeRetired(retired_markers);
+        }
+        /// Only this thread deletes meshes, so they are still there without the lock, unless they were just retired
+        for(size_t idx=0;idx<model_markers.size();idx++){
+            Mesh* mesh = model_markers[idx];
+            if(std::find(retired_markers.begin(),retired_markers.end(),mesh)!=retired_markers.end()){
+                continue;
+            }
+            /// The ROS thread only touches the marker and the flags of a mesh, so the rest can be loaded unlocked
+            bool loaded = mesh->LoadMesh(mesh->filename);
+            boost::mutex::scoped_lock lock(marker_registry.GetMutex());
+            mesh->initialized = loaded;
+            if(loaded){
+                mesh->needs_update = false;
+            }
+            /// Like InitMarker, a model that failed to load is not tried again
+            mesh->load_mesh = false;
+        }
+        /// Deleted and expired markers hand their buffers on to the next new ones
+        for(size_t idx=0;idx<retired_markers.size();idx++){
+            if(marker_builder){
+                marker_builder->Forget(retired_markers[idx]);
+            }
+            retired_markers[idx]->Recycle();
+            delete retired_markers[idx];
+        }
 
 
 #endif
-        scene_update_needed=false;
     }
 
     Vector4 sphere2cart(float azimuth, float elevation, float radius)
@@ -669,17 +1057,21 @@ private:
         }
     }
 
-    void AddColorVertex(Vector4 pt,Vector3 color, std::vector<float> &vertdata){
-        vertdata.push_back(pt.x);
-        vertdata.push_back(pt.y);
-        vertdata.push_back(pt.z);
-        vertdata.push_back(color.x);
-        vertdata.push_back(color.y);
-        vertdata.push_back(color.z);
+    /// Add a line/point vertex, with the RGB color (0->1) packed into bytes as in PointVertex
+    void AddColorVertex(Vector4 pt,Vector3 color, std::vector<PointVertex> &vertdata){
+        PointVertex vert;
+        vert.x = pt.x;
+        vert.y = pt.y;
+        vert.z = pt.z;
+        vert.r = std::min(std::max(color.x,0.0f),1.0f)*255.0f+0.5f;
+        vert.g = std::min(std::max(color.y,0.0f),1.0f)*255.0f+0.5f;
+        vert.b = std::min(std::max(color.z,0.0f),1.0f)*255.0f+0.5f;
+        vert.a = 255;
+        vertdata.push_back(vert);
     }
 
     void add_projectile_to_scene( Matrix4 mat,
-                                  std::vector<float> &vertdataarray,
+                                  std::vector<PointVertex> &vertdataarray,
                                   Vector3 &start_point,
                                   Vector3 &end_point,
                                   float v0=10.0,
@@ -718,26 +1110,14 @@ private:
         while ( y>0.0 )
         {
 
-            vertdataarray.push_back( x );
-            vertdataarray.push_back( y );
-            vertdataarray.push_back( z );
-
-            vertdataarray.push_back( color.x );
-            vertdataarray.push_back( color.y );
-            vertdataarray.push_back( color.z );
+            AddColorVertex( Vector4( x, y, z, 1 ), color, vertdataarray );
 
             v_y-=dt*g;/// Gravity pulling us back to earth
             x+=v_x*dt;
             y+=v_y*dt;
             z+=v_z*dt;
 
-            vertdataarray.push_back( x );
-            vertdataarray.push_back( y );
-            vertdataarray.push_back( z );
-
-            vertdataarray.push_back( color.x );
-            vertdataarray.push_back( color.y );
-            vertdataarray.push_back( color.z );
+            AddColorVertex( Vector4( x, y, z, 1 ), color, vertdataarray );
 
             m_uiControllerVertcount += 2;
         }
@@ -762,30 +1142,18 @@ private:
         for(;theta<2*M_PI;theta+=dr)
         {
 
-            vertdataarray.push_back( nx );
-            vertdataarray.push_back( y );
-            vertdataarray.push_back( nz );
-
-            vertdataarray.push_back( color.x );
-            vertdataarray.push_back( color.y );
-            vertdataarray.push_back( color.z );
+            AddColorVertex( Vector4( nx, y, nz, 1 ), color, vertdataarray );
 
             nx = x+radius*cos(theta);
             nz = z+radius*sin(theta);
 
-            vertdataarray.push_back( nx );
-            vertdataarray.push_back( y );
-            vertdataarray.push_back( nz );
-
-            vertdataarray.push_back( color.x );
-            vertdataarray.push_back( color.y );
-            vertdataarray.push_back( color.z );
+            AddColorVertex( Vector4( nx, y, nz, 1 ), color, vertdataarray );
 
             m_uiControllerVertcount += 2;
         }
     }
 
-    void add_frame_to_scene( Matrix4 mat, std::vector<float> &vertdataarray, float radius, int num_dof=3)
+    void add_frame_to_scene( Matrix4 mat, std::vector<PointVertex> &vertdataarray, float radius, int num_dof=3)
     {
 
         Vector4 center = mat * Vector4( 0, 0, 0, 1 );
@@ -797,21 +1165,8 @@ private:
             point[i] += radius*scaling_factor;  // offset in X, Y, Z
             color[i] = 1.0;  // R, G, B
             point = mat * point;
-            vertdataarray.push_back( center.x );
-            vertdataarray.push_back( center.y );
-            vertdataarray.push_back( center.z );
-
-            vertdataarray.push_back( color.x );
-            vertdataarray.push_back( color.y );
-            vertdataarray.push_back( color.z );
-
-            vertdataarray.push_back( point.x );
-            vertdataarray.push_back( point.y );
-            vertdataarray.push_back( point.z );
-
-            vertdataarray.push_back( color.x );
-            vertdataarray.push_back( color.y );
-            vertdataarray.push_back( color.z );
+            AddColorVertex( center, color, vertdataarray );
+            AddColorVertex( point, color, vertdataarray );
 
             m_uiControllerVertcount += 2;
         }
@@ -825,7 +1180,7 @@ private:
      * \param plane_cell_count   How many cells (in each direction)
      * \param color              What RGB color to apply
      */
-    void add_grid_to_scene( std::vector<float> &vertdataarray, float cell_size=1.0, int plane_cell_count=10, Vector3 color=Vector3(0.627,0.627,0.627) ){
+    void add_grid_to_scene( std::vector<PointVertex> &vertdataarray, float cell_size=1.0, int plane_cell_count=10, Vector3 color=Vector3(0.627,0.627,0.627) ){
         cell_size*=scaling_factor;
         Matrix4 mat=GetRobotMatrixPose(base_frame);
         for(int jj=0;jj<3;jj++){
@@ -838,21 +1193,8 @@ private:
                 point1 = mat*point1;
                 point2 = mat*point2;
 
-                vertdataarray.push_back( point1.x );
-                vertdataarray.push_back( point1.y );
-                vertdataarray.push_back( point1.z );
-
-                vertdataarray.push_back( color.x );
-                vertdataarray.push_back( color.y );
-                vertdataarray.push_back( color.z );
-
-                vertdataarray.push_back( point2.x );
-                vertdataarray.push_back( point2.y );
-                vertdataarray.push_back( point2.z );
-
-                vertdataarray.push_back( color.x );
-                vertdataarray.push_back( color.y );
-                vertdataarray.push_back( color.z );
+                AddColorVertex( point1, color, vertdataarray );
+                AddColorVertex( point2, color, vertdataarray );
 
                 m_uiControllerVertcount += 2;
             }
@@ -864,20 +1206,12 @@ private:
      * \param mat         Transform of the text globally
      * \param vertdata    Where to put the vertices
      * \param pt          point relative to the matrix transform
-     * \param colour      RGB color, or colour if you prefer
+     * \param colour      RGB color (0->1), or colour if you prefer
      */
-    void add_point_to_scene( Matrix4 mat, std::vector<float> &vertdata, Vector4 pt, Vector3 colour)
+    void add_point_to_scene( Matrix4 mat, std::vector<PointVertex> &vertdata, Vector4 pt, Vector3 colour)
     {
 
-        Vector4 point = mat * pt;
-
-        vertdata.push_back( point.x );
-        vertdata.push_back( point.y );
-        vertdata.push_back( point.z );
-
-        vertdata.push_back( colour.x );
-        vertdata.push_back( colour.y );
-        vertdata.push_back( colour.z );
+        AddColorVertex( mat * pt, colour, vertdata );
     }
 
 
@@ -914,10 +1248,17 @@ private:
      */
     void update_tf_cache(const ros::TimerEvent&){
         /// Go through the cache and get updated TF's
-        for(int ii=0;ii<tf_cache.size();ii++){
+        /// The lookups wait on the tf listener, so they are done without the lock, which the render thread takes every eye
+        std::vector<tf_obj> updated;
+        {
+            boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
+            updated = tf_cache;
+        }
+        size_t num_updated=0;
+        for(;num_updated<updated.size();num_updated++){
             tf::StampedTransform transform;
             try{
-              listener->lookupTransform(intermediate_frame, tf_cache[ii].frame_id,
+              listener->lookupTransform(intermediate_frame, updated[num_updated].frame_id,
                                        ros::Time(0), transform);
             }
             catch (tf::TransformException ex){
@@ -925,7 +1266,14 @@ private:
               break;
               /// \todo We should probably remove this TF from the cache
             }
-            tf_cache[ii].transform=VrTransform(transform);
+            updated[num_updated].transform=VrTransform(transform);
+        }
+        {
+            /// Frames are only ever appended, so the first num_updated entries are still the ones we looked up
+            boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
+            for(size_t ii=0;ii<num_updated;ii++){
+                tf_cache[ii].transform=updated[ii].transform;
+            }
         }
 
         /// Also, publish transforms for things like the HMD and the controllers
@@ -1229,12 +1577,12 @@ private:
      * \return VR transform
      */
     Matrix4 GetRobotMatrixPose( std::string frame_name ){
+        Matrix4 cached;
         /// First, look to see if we have it in the cache
-        for(int ii=0;ii<tf_cache.size();ii++){
-            if(tf_cache[ii].frame_id==frame_name){
-                return tf_cache[ii].transform;
-            }
+        if(FindCachedPose(frame_name,cached)){
+            return cached;
         }
+        /// The lookup is done without the lock, so a frame that is not in tf yet doesn't hold up the other threads
         tf::StampedTransform transform;
         try{
           listener->lookupTransform(intermediate_frame, frame_name,
@@ -1245,7 +1593,13 @@ private:
           return Matrix4().identity();
         }
 
-        /// We can't find it in our cache, so let's add it
+        /// We can't find it in our cache, so let's add it, unless another thread beat us to it
+        boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
+        for(size_t ii=0;ii<tf_cache.size();ii++){
+            if(tf_cache[ii].frame_id==frame_name){
+                return tf_cache[ii].transform;
+            }
+        }
         tf_obj trans;
         trans.transform=VrTransform(transform);
         trans.frame_id=frame_name;
@@ -1253,62 +1607,71 @@ private:
         return trans.transform;
     }
 
+    /*!
+     * \brief Copy a pose out of the tf cache
+     * \param frame_name The name of the frame we want
+     * \param pose Set to the cached transform, if there is one
+     * \return False if the frame is not in the cache yet
+     */
+    bool FindCachedPose( const std::string& frame_name, Matrix4& pose ){
+        boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
+        for(size_t ii=0;ii<tf_cache.size();ii++){
+            if(tf_cache[ii].frame_id==frame_name){
+                pose=tf_cache[ii].transform;
+                return true;
+            }
+        }
+        return false;
+    }
+
 #ifndef USE_VULKAN
     /*!
-     * \brief Convert an OpenCV image mat to OpenGL
-     *
-     * \note This was adapted from https://stackoverflow.com/a/16815662 and may not be optimal
+     * \brief Put the newest image of each stream on its overlay once the upload has finished
      *
-     * \param image
-     * \param imageTexture
+     * This runs every frame, since it only polls the uploads that are in flight and never waits on them.
      */
-    void BindCVMat2GLTexture(GLuint& imageTexture)
+    void UpdateImageOverlays()
     {
-       if(image_flipped.empty()){
-          std::cout << "image empty" << std::endl;
-      }else{
-          //glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-          glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-          if(imageTexture==0){
-              /// This allocates memory for the texture, so we do it the first time
-              /// If the image you are subscribing to changes resolution THINGS WILL BREAK
-              glGenTextures(1, &imageTexture);
-              glBindTexture(GL_TEXTURE_2D, imageTexture);
-              glTexImage2D( GL_TEXTURE_2D,          // Type of texture
-                            0,                      // Pyramid level (for mip-mapping) - 0 is the top level
-                            GL_RGBA,                // Internal colour format to convert to
-                            image_flipped.cols,     // Image width  i.e. 640 for Kinect in standard mode
-                            image_flipped.rows,     // Image height i.e. 480 for Kinect in standard mode
-                            0,                      // Border width in pixels (can either be 1 or 0)
-                            GL_RGBA,                // Input image format (i.e. GL_RGB, GL_RGBA, GL_BGR etc.)
-                            GL_UNSIGNED_BYTE,       // Image data type
-                            image_flipped.ptr());   // The actual image data itself
-          }
-
-          glBindTexture(GL_TEXTURE_2D, imageTexture);
-
-          glTexSubImage2D(GL_TEXTURE_2D,        // Type of texture
-                        0,                      // Pyramid level (for mip-mapping) - 0 is the top level
-                        0,0,                    // Internal colour format to convert to
-                        image_flipped.cols,     // Image width  i.e. 640 for Kinect in standard mode
-                        image_flipped.rows,     // Image height i.e. 480 for Kinect in standard mode
-                        GL_RGBA,                // Input image format (i.e. GL_RGB, GL_RGBA, GL_BGR etc.)
-                        GL_UNSIGNED_BYTE,       // Image data type
-                        image_flipped.ptr());   // The actual image data itself
-
-          // If this renders black ask McJohn what's wrong.
-          glGenerateMipmap(GL_TEXTURE_2D);
-
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-
-          GLfloat fLargest;
-          glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest );
-          glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest );
-
-          glBindTexture( GL_TEXTURE_2D, 0 );
+        if ( !m_pHMD )
+            return;
+
+        for(size_t ii=0;ii<image_streams.size();ii++){
+            ImageStream& stream = *image_streams[ii];
+            if(stream.overlay==vr::k_ulOverlayHandleInvalid || !stream.uploader.Update()){
+                continue;
+            }
+            /// Convert to a 'vr' texture
+            vr::Texture_t texture = {(void*)(uintptr_t)stream.uploader.GetTexture(), vr::TextureType_OpenGL, vr::ColorSpace_Auto };
+            /// Set this texture to appear on the overlay and enable it. \note this may not need to be done every time?
+            vr::VROverlay()->SetOverlayTexture( stream.overlay, &texture );
+
+            /// Only mess with location if it's a camera. If it's a plain image msg, we just put it directly in front of the HMD.
+            boost::unique_lock<boost::mutex> camera_lock(stream.camera_mutex);
+            if(stream.camera_received){
+                /// We should actually use some matrix from cam_model, but this is approximate.
+                /// We use hfov instead of hud_size, since it's a camera so we know the FOV.
+                float hfov = 2*atan(stream.cam_model.cameraInfo().width/(2.0*stream.cam_model.fx()));
+                std::string camera_frame_id = stream.camera_frame_id;
+                camera_lock.unlock();
+                /// Flip the image 180 about x, to match ROS's camera frame standard
+                /// And put it hud_dist away. This is a param, and may be adjusted.
+                Matrix4 mat1;
+                mat1.set(1,0,0,0,
+                         0,-1,0,0,
+                         0,0,-1,0,
+                         0,0,stream.hud_dist,1);
+                /// Get the location that the "monitor" should be. It'll be hud_dist away from the optical frame of the camera.
+                Matrix4 monitor_loc=GetRobotMatrixPose(camera_frame_id)*mat1;
+                /// Make it a VR matrix
+                vr::HmdMatrix34_t transform=ConvertMatrix4ToSteamVRMatrix(monitor_loc);
+                /// Set the transform and width. Note that the width probably won't change, as camera params are usually static.
+                vr::VROverlay()->SetOverlayTransformAbsolute(stream.overlay, vr::TrackingUniverseStanding, &transform);
+                vr::VROverlay()->SetOverlayWidthInMeters(stream.overlay, hfov*stream.hud_dist);
+            }else{
+                camera_lock.unlock();
+            }
+            /// Set the overlay to visible.
+            vr::VROverlay()->ShowOverlay(stream.overlay);
         }
     }
 #endif
@@ -1379,324 +1742,427 @@ void showCallback(const std_msgs::Bool::ConstPtr& show_in)
     pVRVizApplication->setDisplayControllers(show_in->data);
 }
 
+void add_diagnostic_value(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, long long value)
+{
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key = key;
+    key_value.value = std::to_string(value);
+    status.values.push_back(key_value);
+}
+
 /*!
- * \brief Callback for a point cloud with color
+ * \brief Timer callback that publishes the GL object counts, and the frame counts of each image stream
  *
- * \param msg ROS PointCloud2 Message
+ * The GL counts should stay flat once the scene has settled, so anything that keeps growing is a leak.
+ * The image latencies are from the stamp of an image to its upload finishing, over the last period.
  */
-void pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud_in)
+void diagnosticsCallback(const ros::TimerEvent&)
 {
-    ROS_INFO_ONCE("Received Point Cloud 2 Message");
+    diagnostic_msgs::DiagnosticStatus status;
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = ros::this_node::getName() + ": GL objects";
+    status.hardware_id = "vrviz";
+    status.message = "OK";
+    add_diagnostic_value(status, "buffers", gl_object_counts.buffers);
+    add_diagnostic_value(status, "vertex_arrays", gl_object_counts.vertex_arrays);
+    add_diagnostic_value(status, "textures", gl_object_counts.textures);
+    add_diagnostic_value(status, "stream_bytes", gl_object_counts.stream_bytes);
+    if(accumulate_clouds){
+        add_diagnostic_value(status, "map_points", point_map.GetNumPoints());
+        add_diagnostic_value(status, "map_nodes", point_map.GetNumNodes());
+    }
 
-    bool rgb = false;
-    bool intensity = false;
-    for(int ii=0;ii<cloud_in->fields.size();ii++)
-    {
-        if(cloud_in->fields[ii].name=="rgb"){
-            rgb = true;
-        }
-        if(cloud_in->fields[ii].name=="intensity"){
-            intensity = true;
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    msg.status.push_back(status);
+#ifndef USE_VULKAN
+    /// One status per image stream, to see where its frames go
+    for(size_t ii=0;ii<image_streams.size();ii++){
+        ImageUploadStats stats = image_streams[ii]->uploader.TakeStats();
+        diagnostic_msgs::DiagnosticStatus image_status;
+        image_status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        image_status.name = ros::this_node::getName() + ": image " + image_streams[ii]->topic;
+        image_status.hardware_id = "vrviz";
+        image_status.message = stats.received>0 ? "OK" : "No images received";
+        add_diagnostic_value(image_status, "received", stats.received);
+        add_diagnostic_value(image_status, "converted", stats.converted);
+        add_diagnostic_value(image_status, "dropped", stats.dropped);
+        add_diagnostic_value(image_status, "displayed", stats.displayed);
+        if(stats.latency_count>0){
+            add_diagnostic_value(image_status, "latency_mean_ms", llround(1000.0*stats.latency_sum/stats.latency_count));
+            add_diagnostic_value(image_status, "latency_max_ms", llround(1000.0*stats.latency_max));
         }
+        msg.status.push_back(image_status);
     }
+#endif
+    diagnostics_pub.publish(msg);
+}
 
-    Matrix4 mat = Matrix4().identity();
-    pVRVizApplication->m_strPointCloudFrame = cloud_in->header.frame_id;
-
-    std::vector<float> vertdataarray;
-
-    if(rgb && !axis_colored_pc) /// We prefer color channel info, if it has it
-    {
-        pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_with_nan(new pcl::PointCloud<pcl::PointXYZRGB>);
-        pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
-        pcl::fromROSMsg(*cloud_in, *cloud_with_nan);
-        std::vector<int> indices;
-        /// Avoid NAN points, since they would not render well
-        pcl::removeNaNFromPointCloud(*cloud_with_nan,*cloud, indices);
-
-        for(size_t i = 0; i<cloud->points.size(); i++)
-        {
-            Vector4 pt;
-            /// We scale up from real world units to 'vr units'
-            pt.x=cloud->points[i].x*scaling_factor;
-            pt.y=cloud->points[i].y*scaling_factor;
-            pt.z=cloud->points[i].z*scaling_factor;
-            pt.w=1.0;
+/*!
+ * \brief Fill in how the shader should color the cloud that was just decoded
+ *
+ * \param decoder Decoder that converted the cloud
+ * \param scale Output
+ */
+void getPointColorScale(const PointCloudDecoder& decoder, PointColorScale& scale)
+{
+    scale.scalars = decoder.HasScalars();
+    if(scale.scalars){
+        decoder.GetScalarRange(scale.min,scale.max);
+        decoder.GetColormap(scale.colormap);
+    }
+}
 
-            Vector3 color;
-            color.x = cloud->points[i].r/255.0;
-            color.y = cloud->points[i].g/255.0;
-            color.z = cloud->points[i].b/255.0;
+/*!
+ * \brief Callback for a point cloud with color
+ *
+ * Runs on the spinner thread of the stream, so clouds of different topics are converted in parallel.
+ *
+ * \param msg ROS PointCloud2 Message
+ * \param stream The topic the cloud arrived on
+ */
+void pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud_in, CloudStream* stream)
+{
+    ROS_INFO_ONCE("Received Point Cloud 2 Message");
 
-            pVRVizApplication->add_point_to_scene(mat,vertdataarray,pt,color);
+    PointCloudDecoder& decoder = stream->decoder;
+    if(!decoder.ParseFields(*cloud_in)){
+        return;
+    }
 
-            //ROS_INFO("Processed Point %f,%f,%f",pt.x,pt.y,pt.z);
+    if(accumulate_clouds){
+        /// Bring the cloud into base_frame, and add it to the map
+        decoder.Decode(*cloud_in,stream->map_input);
+        Matrix4 to_map = pVRVizApplication->GetRobotMatrixPose(base_frame);
+        to_map.invert();
+        to_map = to_map * pVRVizApplication->GetRobotMatrixPose(cloud_in->header.frame_id);
+        point_map.Insert(stream->map_input,to_map,ros::Time::now().toSec());
+        {
+            boost::lock_guard<boost::mutex> lock(point_map_color_mutex);
+            getPointColorScale(decoder,point_map_color_scale.GetWriteBuffer());
+            point_map_color_scale.Publish();
         }
+        scene_update_needed=true;
+        return;
     }
-    else if(intensity && !axis_colored_pc) /// Intensity can be mapped to color
-    {
-        pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_with_nan(new pcl::PointCloud<pcl::PointXYZI>);
-        pcl::PointCloud<pcl::PointXYZI>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZI>);
-        pcl::fromROSMsg(*cloud_in, *cloud_with_nan);
-        std::vector<int> indices;
-        /// Avoid NAN points, since they would not render well
-        pcl::removeNaNFromPointCloud(*cloud_with_nan,*cloud, indices);
-
-        for(size_t i = 0; i<cloud->points.size(); i++)
-        {
-            Vector4 pt;
-            /// We scale up from real world units to 'vr units'
-            pt.x=cloud->points[i].x*scaling_factor;
-            pt.y=cloud->points[i].y*scaling_factor;
-            pt.z=cloud->points[i].z*scaling_factor;
-            pt.w=1.0;
-
-            /// Convert intensity into a color spectrum
-            /// We are going from 0.0=blue to max=white
-            /// This was chosen since black->white doesn't render well on the black background,
-            /// and the rainbow color scheme has repeatedly been proven awful in every way.
-            /// We also keep track of the max intensity seen, same as the default for rviz.
-            float intensity_val = cloud->points[i].intensity;
-            if(intensity_val > intensity_max){
-                intensity_max = intensity_val;
-            }
-            Vector3 color;
-            color.x = 1.0-intensity_val/intensity_max;
-            color.y = 1.0-intensity_val/intensity_max;
-            color.z = 1.0;
 
-            pVRVizApplication->add_point_to_scene(mat,vertdataarray,pt,color);
+    /// Convert straight into the free slot, then hand it over to the VR code
+    PointCloudFrame& frame = stream->buffer.GetWriteBuffer();
+    frame.frame_id = cloud_in->header.frame_id;
+    decoder.Decode(*cloud_in,frame.points);
+    stream->chunker.Split(frame.points,frame.chunks);
+    getPointColorScale(decoder,frame.color_scale);
+    stream->buffer.Publish();
+    scene_update_needed=true;
+}
 
-            //ROS_INFO("Processed Point %f,%f,%f",pt.x,pt.y,pt.z);
-        }
-    }
-    else /// If we have no useful info, we pick a solid color.
-    {
-        pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_with_nan(new pcl::PointCloud<pcl::PointXYZ>);
-        pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
-        pcl::fromROSMsg(*cloud_in, *cloud_with_nan);
-        std::vector<int> indices;
-        /// Avoid NAN points, since they would not render well
-        pcl::removeNaNFromPointCloud(*cloud_with_nan,*cloud, indices);
-
-        float z_max = 0.0;
-        float z_min = 0.0;
-        for(size_t i = 0; i<cloud->points.size(); i++)
-        {
-            float z = cloud->points[i].z*scaling_factor;
-            if(z > z_max){
-                z_max = z;
-            }
-            if(z < z_min){
-                z_min = z;
-            }
-        }
-        for(size_t i = 0; i<cloud->points.size(); i++)
-        {
-            Vector4 pt;
-            /// We scale up from real world units to 'vr units'
-            pt.x=cloud->points[i].x*scaling_factor;
-            pt.y=cloud->points[i].y*scaling_factor;
-            pt.z=cloud->points[i].z*scaling_factor;
-            pt.w=1.0;
-
-            Vector3 color;
-            if(axis_colored_pc){
-                float val = (pt.z-z_min)/(z_max-z_min);
-                if(use_hsv)
-                {
-                    unsigned int region = val * 360 / 43;
-                    float remainder = (val * 360 - (region * 43)) * 6 / 256.0;
-
-                    float p = 0.0;
-                    float q = 1.0 - (remainder);
-                    float t = (remainder);
-
-                    switch (region)
-                    {
-                        case 0:
-                            color.x = 1.0; color.y = t; color.z = 0.0;
-                            break;
-                        case 1:
-                            color.x = q; color.y = 1.0; color.z = 0.0;
-                            break;
-                        case 2:
-                            color.x = 0.0; color.y = 1.0; color.z = t;
-                            break;
-                        case 3:
-                            color.x = 0.0; color.y = q; color.z = 1.0;
-                            break;
-                        case 4:
-                            color.x = t; color.y = 0.0; color.z = 1.0;
-                            break;
-                        default:
-                            color.x = 1.0; color.y = 0.0; color.z = q;
-                            break;
-                    }
+/*!
+ * \brief Read the conversion settings of a point cloud topic
+ *
+ * Only the params that are set are read, so this can be called with the global namespace
+ * first and then with the namespace of the topic, to override the defaults per topic.
+ *
+ * \param nh Namespace to read the params from
+ * \param stream Output; settings of the topic
+ */
+void getCloudParams(const ros::NodeHandle& nh, CloudStream& stream)
+{
+    PointCloudDecoder& decoder = stream.decoder;
+    nh.getParam("intensity_max", decoder.intensity_max);
+    nh.getParam("axis_colored_pc", decoder.axis_colored);
+    nh.getParam("use_hsv", decoder.use_hsv);
+    nh.getParam("gpu_colormap", decoder.gpu_colormap);
+    nh.getParam("scalar_min", decoder.scalar_min);
+    nh.getParam("scalar_max", decoder.scalar_max);
+    nh.getParam("point_size", stream.point_size);
+
+    /// Point budget; 0 leaves the voxel grid off, and clouds unlimited
+    int max_points=decoder.max_points;
+    nh.getParam("voxel_size", decoder.voxel_size);
+    nh.getParam("max_points", max_points);
+    decoder.max_points = std::max(max_points,0);
+}
 
-                }else{
-                    color.x = val*0.95F+0.05F;
-                    color.z = std::max(0.0F, 1.F - 10.0F*val);
-                    if(val>0.5F){
-                        color.y = 2.0F - 2.0F*val;
-                    }else{
-                        color.y = 2.0F*val;
-                    }
-                }
-            }else{
-                /// The color is just solid red. This could be a param.
-                color.x = 1.0;
-                color.y = 0.0;
-                color.z = 0.0;
-            }
+/*!
+ * \brief Read the settings of an image stream from nh, keeping what is already set for anything missing
+ */
+void getImageParams(const ros::NodeHandle& nh, ImageStream& stream)
+{
+    nh.getParam("camera_info", stream.use_camera_info);
+    nh.getParam("compressed_image", stream.compressed);
+    nh.getParam("hud_dist", stream.hud_dist);
+    nh.getParam("hud_size", stream.hud_size);
+    nh.getParam("sbs_image", stream.sbs);
+    nh.getParam("overlay_alpha", stream.alpha);
+    nh.getParam("max_image_rate", stream.max_rate);
+#ifndef USE_VULKAN
+    nh.getParam("overlay_mipmaps", stream.uploader.mipmaps);
+#endif
+}
 
-            pVRVizApplication->add_point_to_scene(mat,vertdataarray,pt,color);
 
-            //ROS_INFO("Processed Point %f,%f,%f",pt.x,pt.y,pt.z);
-        }
 
+/*!
+ * \brief Timer callback that drops points older than decay_time from the point map
+ */
+void pointMapTimerCallback(const ros::TimerEvent&)
+{
+    if(point_map.Expire(ros::Time::now().toSec())){
+        scene_update_needed=true;
     }
-
-    /// Copy the data over to the shared data
-    /// \todo This should be protected with a mutex of sorts!
-    color_points_vertdataarray=vertdataarray;
-    scene_update_needed=true;
 }
 
+/// Timer callback that retires the markers whose lifetime has run out
+void markerExpiryTimerCallback(const ros::TimerEvent&)
+{
+    if(!pVRVizApplication){
+        return;
+    }
+    MarkerRegistry& registry = pVRVizApplication->marker_registry;
+    boost::mutex::scoped_lock lock(registry.GetMutex());
+    if(registry.Expire(ros::Time::now().toSec())>0){
+        /// The VR thread frees them when it updates the scene
+        scene_update_needed=true;
+    }
+}
 
+/// Enforce the max_rate of a stream. Only called from the spinner of the stream.
+bool acceptImage(ImageStream* stream)
+{
+    if(stream->max_rate<=0.0){
+        return true;
+    }
+    ros::WallTime now = ros::WallTime::now();
+    if((now-stream->last_image).toSec() < 1.0/stream->max_rate){
+#ifndef USE_VULKAN
+        stream->uploader.Drop();
+#endif
+        return false;
+    }
+    stream->last_image = now;
+    return true;
+}
 
 /*!
- * \brief rawImageCallback
+ * \brief imageCallback
  *
- * \note This callback converts to OpenCV only to then convert to OpenGL, which is probably inefficient
- * \todo See if there is an easy way to pass the raw_image_msg->data directly into glTexImage2D to avoid OpenCV
+ * The image is written straight into a pixel buffer that the uploader of the stream has mapped, and the render thread
+ * copies it into the overlay texture without waiting for it. Encodings GL can upload as is are simply copied
+ * in, other common encodings are converted to RGBA by the converter of the stream on the way, and anything else goes
+ * through cv_bridge and OpenCV first, which is a lot slower (~30ms for a stereo 1080p image).
+ * None of them are flipped here; the overlay texture bounds take care of that.
  *
  * \param raw_image_msg
+ * \param stream
  */
-void rawImageCallback(const sensor_msgs::Image::ConstPtr& raw_image_msg){
-    if(manual_image_copy)
+void imageCallback(const sensor_msgs::Image::ConstPtr& raw_image_msg, ImageStream* stream){
+    if(!acceptImage(stream)){
+        return;
+    }
+#ifdef USE_VULKAN
+    /// \todo The Vulkan build has no image overlay yet
+#else
+    ImageUploader& uploader = stream->uploader;
+    const sensor_msgs::Image& msg = *raw_image_msg;
+    ImageUploadFormat upload;
+    if(getNativeImageFormat(msg,upload))
     {
-        int x,y,idx,id2;
-        if(!received_first_image)
-        {
-            /// Preallocate with 4 bytes/pixel for RGBA
-            image_flipped = cv::Mat(raw_image_msg->height, raw_image_msg->width, CV_8UC4);
-            for(y=0;y<raw_image_msg->height;y++)
-            {
-                for(x=0;x<raw_image_msg->width;x++)
-                {
-                    /// Set the alpha to non-transparent
-                    /// \todo Could make this a param, to allow people to overlay translucent images
-                    idx=(raw_image_msg->height-1-y)*raw_image_msg->step+x*3;
-                    image_flipped.at<cv::Vec4b>(y,x)[3] = overlay_alpha;
-                }
-            }
-            //ROS_INFO("Set up image. Cols=%d,Rows=%d",image_flipped.cols,image_flipped.rows);
-            received_first_image = true;
+        const size_t bytes = size_t(msg.step)*msg.height;
+        /// Don't bother copying the image if the VR thread hasn't even processed the last one.
+        uint8_t* dst = uploader.BeginWrite(bytes);
+        if(dst){
+            memcpy(dst,msg.data.data(),bytes);
+            uploader.EndWrite(true,upload,msg.width,msg.height,msg.step,msg.header.stamp);
         }
-        if(raw_image_msg->encoding==sensor_msgs::image_encodings::BGR8)
+    }else{
+        ImageUploadFormat rgba = {GL_RGBA8,GL_RGBA,GL_UNSIGNED_BYTE,4,false,false};
+        if(ImageConverter::IsSupported(msg.encoding))
         {
-            /// to go from BGR -> RGBA while also flipping
-            for(y=0;y<raw_image_msg->height;y++)
-            {
-                /// I tried a few different ways of looping through the data, and this is the fastest one I found.
-                uchar* pixel = image_flipped.ptr<uchar>(y);  // point to first color in row
-                pixel+=2;
-                const uchar* pixel2 = &(raw_image_msg->data[(raw_image_msg->height-1-y)*raw_image_msg->step]);  // point to first color in row
-                for(x=0;x<raw_image_msg->width;x++)
+            uint8_t* dst = uploader.BeginWrite(size_t(msg.width)*msg.height*4);
+            if(dst){
+                cv::Mat image(msg.height,msg.width,CV_8UC4,dst);
+                bool converted = stream->converter.Convert(msg,255,image);
+                uploader.EndWrite(converted,rgba,msg.width,msg.height,msg.width*4,msg.header.stamp);
+            }
+        }else{
+            /// Claim the buffer first, so this slow path is skipped too when the image would be dropped anyway
+            uint8_t* dst = uploader.BeginWrite(size_t(msg.width)*msg.height*4);
+            if(dst){
+                bool converted = false;
+                try
                 {
-                    /// Takes ~30ms for 2x1080p
-                    *pixel--=*pixel2++;
-                    *pixel--=*pixel2++;
-                    *pixel=*pixel2++;
-                    pixel+=6;
-                    /// Takes ~60ms for 2x1080p
-//                    idx=(raw_image_msg->height-1-y)*raw_image_msg->step+x*3;
-//                    id2=4*(raw_image_msg->width*y + x);
-//                    image_flipped.data[id2+0]=raw_image_msg->data[idx+2];
-//                    image_flipped.data[id2+1]=raw_image_msg->data[idx+1];
-//                    image_flipped.data[id2+2]=raw_image_msg->data[idx+0];
-                    /// Slowest, takes ~100ms for 2x1080p
-//                    idx=(raw_image_msg->height-1-y)*raw_image_msg->step+x*3;
-//                    image_flipped.at<cv::Vec4b>(y,x)[0] = raw_image_msg->data[idx+2];
-//                    image_flipped.at<cv::Vec4b>(y,x)[1] = raw_image_msg->data[idx+1];
-//                    image_flipped.at<cv::Vec4b>(y,x)[2] = raw_image_msg->data[idx+0];
-//                    image_flipped.at<cv::Vec4b>(y,x)[3] = overlay_alpha;
+                    /// Convert to OpenCV
+                    cv_bridge::CvImagePtr cv_ptr_raw = cv_bridge::toCvCopy(raw_image_msg,sensor_msgs::image_encodings::BGR8);
+
+                    /// Convert to RGB, straight into the buffer
+                    /// \note this is actually pretty slow. For a stereo 1080p image it could be ~30ms
+                    cv::Mat mapped(msg.height,msg.width,CV_8UC4,dst);
+                    cv::cvtColor(cv_ptr_raw->image, mapped, CV_BGR2RGBA);
+                    converted = true;
                 }
-            }
-        }else if(raw_image_msg->encoding==sensor_msgs::image_encodings::RGB8)
-        {
-            /// to go from RGB -> RGBA while also flipping
-            for(y=0;y<raw_image_msg->height;y++)
-            {
-                uchar* pixel = image_flipped.ptr<uchar>(y);  // point to first color in row
-                const uchar* pixel2 = &(raw_image_msg->data[(raw_image_msg->height-1-y)*raw_image_msg->step]);  // point to first color in row
-                for(x=0;x<raw_image_msg->width;x++)
+                catch (cv_bridge::Exception& error)
                 {
-                    /// Should take same time as bgr, which is ~30ms for 2x1080p
-                    *pixel++=*pixel2++;
-                    *pixel++=*pixel2++;
-                    *pixel=*pixel2++;
-                    pixel+=2;/// Add an extra to skip the Alpha
+                    ROS_ERROR("cv_bridge exception: %s", error.what());
                 }
+                uploader.EndWrite(converted,rgba,msg.width,msg.height,msg.width*4,msg.header.stamp);
             }
-        }else{
-            ROS_WARN("Manual image copy only works on BRG8 and RGB8 images, sorry!");
-            /// Try to fall back to the opencv copy
-            manual_image_copy = false;
         }
-        /// tell the VR thread we have data
-        received_image=true;
+    }
+#endif
 
-    }else{
-        try
-        {
-            /// Convert to OpenCV
-            cv_ptr_raw = cv_bridge::toCvCopy(raw_image_msg,sensor_msgs::image_encodings::BGR8);
+    /// We have new data, so trigger a scene update
+    scene_update_needed=true;
+}
 
-            /// Convert to RGB
-            /// \note this is actually pretty slow. For a stereo 1080p image it could be ~30ms
-            cv::cvtColor(cv_ptr_raw->image, cv_ptr_raw->image, CV_BGR2RGBA);
+/// Remember where the camera of a stream is, so its overlay can be placed in front of it
+void setStreamCamera(ImageStream* stream, const sensor_msgs::CameraInfoConstPtr& info_msg, const std::string& frame_id)
+{
+    boost::lock_guard<boost::mutex> lock(stream->camera_mutex);
+    stream->cam_model.fromCameraInfo(info_msg);
+    stream->camera_frame_id = frame_id;
+    stream->camera_received = true;
+}
 
-            /// Don't bother copying the image if the VR thread hasn't even processed the last one.
-            if(!received_image && image_mutex.try_lock()){
+void cameraCallback(const sensor_msgs::ImageConstPtr& image_msg,
+                    const sensor_msgs::CameraInfoConstPtr& info_msg,
+                    ImageStream* stream)
+{
+    setStreamCamera(stream,info_msg,image_msg->header.frame_id);
+    imageCallback(image_msg,stream);
+}
 
-                /// Flip it because OpenCV and OpenGL have a different top/bottom standard
-                /// \note this is actually pretty slow. For a stereo 1080p image it could be ~15ms
-                /// \todo this should not be necessary. In opengl you can just flip the quad, not the texture. But with the overlay we don't have control of the quad?
-                cv::flip(cv_ptr_raw->image, image_flipped, 0);
+/*!
+ * \brief Callback for a depth image, which is handed to the VR code as is to be unprojected on the GPU
+ *
+ * This replaces running depth_image_proc to make a PointCloud2 that would then be converted again.
+ *
+ * \param depth_msg Rectified depth image, 16UC1 (or mono16) in millimeters or 32FC1 in meters
+ * \param info_msg Camera info of the depth image
+ */
+void depthCallback(const sensor_msgs::ImageConstPtr& depth_msg,
+                   const sensor_msgs::CameraInfoConstPtr& info_msg)
+{
+    ROS_INFO_ONCE("Received Depth Image Message");
 
-                /// tell the VR thread we have data
-                received_image=true;
+    if(depth_msg->encoding!=sensor_msgs::image_encodings::TYPE_16UC1 &&
+       depth_msg->encoding!=sensor_msgs::image_encodings::MONO16 &&
+       depth_msg->encoding!=sensor_msgs::image_encodings::TYPE_32FC1){
+        ROS_WARN_THROTTLE(5.0,"Depth images must be 16UC1 or 32FC1, not %s",depth_msg->encoding.c_str());
+        return;
+    }
+    if(!checkImageRows(*depth_msg,sensor_msgs::image_encodings::bitDepth(depth_msg->encoding)/8)){
+        ROS_WARN_THROTTLE(5.0,"Dropping a %dx%d depth image with step %d and %d bytes of data",int(depth_msg->width),
+                          int(depth_msg->height),int(depth_msg->step),int(depth_msg->data.size()));
+        return;
+    }
+    image_geometry::PinholeCameraModel model;
+    model.fromCameraInfo(info_msg);
+
+    DepthFrame& frame = depth_buffer.GetWriteBuffer();
+    frame.depth = depth_msg;
+    frame.fx = model.fx();
+    frame.fy = model.fy();
+    frame.cx = model.cx();
+    frame.cy = model.cy();
+    {
+        boost::lock_guard<boost::mutex> lock(depth_color_mutex);
+        frame.color = depth_color;
+    }
+    if(frame.color && (frame.color->width!=depth_msg->width || frame.color->height!=depth_msg->height)){
+        ROS_WARN_THROTTLE(5.0,"Depth color image is %dx%d, but the depth image is %dx%d; is it registered?",
+                          int(frame.color->width),int(frame.color->height),int(depth_msg->width),int(depth_msg->height));
+        frame.color.reset();
+    }
+    depth_buffer.Publish();
+    scene_update_needed=true;
+}
 
-                /// Release the mutex to allow the VR thread to use the image
-                image_mutex.unlock();
+/*!
+ * \brief Callback for the color image registered to the depth image, which colors the next depth image
+ *
+ * \param color_msg RGB8, BGR8, RGBA8 or BGRA8 image, the same size as the depth image
+ */
+void depthColorCallback(const sensor_msgs::ImageConstPtr& color_msg)
+{
+    if(color_msg->encoding!=sensor_msgs::image_encodings::RGB8 && color_msg->encoding!=sensor_msgs::image_encodings::BGR8 &&
+       color_msg->encoding!=sensor_msgs::image_encodings::RGBA8 && color_msg->encoding!=sensor_msgs::image_encodings::BGRA8){
+        ROS_WARN_THROTTLE(5.0,"Depth color images must be rgb8, bgr8, rgba8 or bgra8, not %s",color_msg->encoding.c_str());
+        return;
+    }
+    if(!checkImageRows(*color_msg,sensor_msgs::image_encodings::numChannels(color_msg->encoding))){
+        ROS_WARN_THROTTLE(5.0,"Dropping a %dx%d depth color image with step %d and %d bytes of data",int(color_msg->width),
+                          int(color_msg->height),int(color_msg->step),int(color_msg->data.size()));
+        return;
+    }
+    boost::lock_guard<boost::mutex> lock(depth_color_mutex);
+    depth_color = color_msg;
+}
 
-            }
+/*!
+ * \brief Camera info that goes with compressed images, which are not synchronized with it like cameraCallback() is
+ */
+void cameraInfoCallback(const sensor_msgs::CameraInfoConstPtr& info_msg, ImageStream* stream)
+{
+    setStreamCamera(stream,info_msg,info_msg->header.frame_id);
+}
 
-        }
-        catch (cv_bridge::Exception& error)
-        {
-            ROS_ERROR("cv_bridge exception: %s", error.what());
-            received_image=false;
-        }
+/*!
+ * \brief Hand a compressed image to the decode thread of its stream, which drops it if a newer one arrives first
+ *
+ * Images are not even queued while the uploader has no buffer free, since they would be decoded for nothing.
+ */
+void compressedImageCallback(const sensor_msgs::CompressedImageConstPtr& image_msg, ImageStream* stream)
+{
+    if(!stream->decoder || !acceptImage(stream)){
+        return;
+    }
+#ifndef USE_VULKAN
+    if(!stream->uploader.CanWrite() || stream->decoder->Push(image_msg)){
+        /// Either this image, or the older one it replaced, will never be shown
+        stream->uploader.Drop();
     }
+#endif
+}
 
-    /// We have new data, so trigger a scene update
-    scene_update_needed=true;
+void compressedDepthColorCallback(const sensor_msgs::CompressedImageConstPtr& color_msg)
+{
+    depth_color_decoder->Push(color_msg);
 }
 
-void cameraCallback(const sensor_msgs::ImageConstPtr& image_msg,
-                    const sensor_msgs::CameraInfoConstPtr& info_msg)
+#ifndef USE_VULKAN
+/// Decoded overlay images go straight into a mapped pixel buffer of the uploader of the stream
+uint8_t* beginOverlayImage(int width, int height, const sensor_msgs::CompressedImage& msg, ImageStream* stream)
 {
-    cam_model.fromCameraInfo(info_msg);
+    return stream->uploader.BeginWrite(size_t(width)*height*4);
+}
 
-    camera_frame_id=image_msg->header.frame_id;
-    //ROS_INFO("Got image callback, frame_id=%s",camera_frame_id.c_str());
+void endOverlayImage(bool decoded, int width, int height, const sensor_msgs::CompressedImage& msg, ImageStream* stream)
+{
+    ImageUploadFormat rgba = {GL_RGBA8,GL_RGBA,GL_UNSIGNED_BYTE,4,false,false};
+    stream->uploader.EndWrite(decoded,rgba,width,height,width*4,msg.header.stamp);
+    scene_update_needed=true;
+}
+#endif
 
-    camera_image_received = true;
+/// Decoded depth colors become a plain rgba8 message for depthColorCallback()
+uint8_t* beginDepthColorImage(int width, int height, const sensor_msgs::CompressedImage& msg)
+{
+    decoded_depth_color.reset(new sensor_msgs::Image());
+    decoded_depth_color->width = width;
+    decoded_depth_color->height = height;
+    decoded_depth_color->step = width*4;
+    decoded_depth_color->encoding = sensor_msgs::image_encodings::RGBA8;
+    decoded_depth_color->data.resize(size_t(width)*height*4);
+    return decoded_depth_color->data.data();
+}
 
-    rawImageCallback(image_msg);
+void endDepthColorImage(bool decoded, int width, int height, const sensor_msgs::CompressedImage& msg)
+{
+    if(decoded){
+        decoded_depth_color->header = msg.header;
+        depthColorCallback(decoded_depth_color);
+    }
+    decoded_depth_color.reset();
 }
 
 bool resolveURI(std::string &mod_url)
@@ -1776,11 +2242,11 @@ float modelScaleAndUp(std::string mod_url,bool &Z_UP)
 
 #ifndef USE_VULKAN
 /*!
- * \brief load a mesh model with assimp
+ * \brief Make the mesh of a model file, loading it with assimp unless initialize is false
  * \param mod_url
- * \return
+ * \return The mesh, or NULL if it could not be loaded
  */
-bool loadModel(std::string mod_url,std::string frame_id,Matrix4 trans,Vector3 scale,int id=0,std::string name="",bool initialize=true)
+Mesh* newModelMesh(std::string mod_url,std::string frame_id,Matrix4 trans,Vector3 scale,int id=0,std::string name="",bool initialize=true)
 {
     resolveURI(mod_url);
 
@@ -1801,21 +2267,32 @@ bool loadModel(std::string mod_url,std::string frame_id,Matrix4 trans,Vector3 sc
 
     ROS_INFO("Loading %s's mesh:%s frame_id=%s",name.c_str(),mod_url.c_str(),myMesh->frame_id.c_str());
     if(!initialize){
+        /// The render thread loads it, since Mesh::MeshEntry::Init can't be called from the callback thread
         myMesh->load_mesh = true;
         myMesh->filename = mod_url;
-        myMesh->initialized=initialize;
-        myMesh->needs_update=!initialize;
-        pVRVizApplication->robot_meshes.push_back(myMesh);
-    }else{
-        if(myMesh->LoadMesh(mod_url))
-        {
-            myMesh->initialized=initialize;
-            myMesh->needs_update=!initialize;
-            pVRVizApplication->robot_meshes.push_back(myMesh);
-        }else{
-            ROS_ERROR("Could not load mesh file %s",mod_url.c_str());
-        }
+    }else if(!myMesh->LoadMesh(mod_url)){
+        ROS_ERROR("Could not load mesh file %s",mod_url.c_str());
+        delete myMesh;
+        return NULL;
     }
+    myMesh->initialized=initialize;
+    myMesh->needs_update=!initialize;
+    return myMesh;
+}
+
+/*!
+ * \brief load a mesh model with assimp, as part of the robot
+ * \param mod_url
+ * \return success
+ */
+bool loadModel(std::string mod_url,std::string frame_id,Matrix4 trans,Vector3 scale)
+{
+    Mesh* myMesh = newModelMesh(mod_url,frame_id,trans,scale);
+    if(!myMesh){
+        return false;
+    }
+    pVRVizApplication->robot_meshes.push_back(myMesh);
+    return true;
 }
 
 /*!
@@ -1951,66 +2428,125 @@ bool loadRobot(float vr_scale=1.f){
 #endif
 
 
-int find_or_add_marker(visualization_msgs::Marker marker){
-    if(!pVRVizApplication){
-        return -1;
-    }
-    for(int idx=0;idx<pVRVizApplication->robot_meshes.size();idx++){
-        if(pVRVizApplication->robot_meshes[idx]->id==marker.id && pVRVizApplication->robot_meshes[idx]->name==marker.ns){
-            /// We already have something with this namespace and ID.
-            /// Check if this marker is different (other than the timestamp)
-            if(!markers_equal(pVRVizApplication->robot_meshes[idx]->marker,marker)){
-                /// Copy over the new data, and raise  flag telling it to be updated
-                pVRVizApplication->robot_meshes[idx]->marker=marker;
-                pVRVizApplication->robot_meshes[idx]->needs_update=true;
-            }else{
-                /// Nothing has changed, but at least update the timestamp so we know it's updated lifetime
-                pVRVizApplication->robot_meshes[idx]->marker.header.stamp=marker.header.stamp;
-            }
-
-            return idx;
-        }
+/*!
+ * \brief Take over a marker that is already in the registry
+ *
+ * Called with the marker registry locked.
+ *
+ * \param mesh The mesh of the marker
+ * \param marker
+ */
+void update_marker_mesh(Mesh* mesh, const visualization_msgs::Marker& marker){
+    /// Check if this marker is different (other than the timestamp)
+    if(!markers_equal(mesh->marker,marker)){
+        /// Copy over the new data, and raise  flag telling it to be updated
+        mesh->marker=marker;
+        mesh->needs_update=true;
+    }else{
+        /// Nothing has changed, but at least update the timestamp so we know it's updated lifetime
+        mesh->marker.header.stamp=marker.header.stamp;
     }
+}
 
-    /// We didn't find it in our existing meshes, so make a new one
-    Mesh* myMesh = new Mesh;
-    myMesh->name=marker.ns;
-    myMesh->id=marker.id;
-    myMesh->frame_id=marker.header.frame_id;
-    Vector3 scale;
-    scale.x=1.0;
-    scale.y=1.0;
-    scale.z=1.0;
-    myMesh->scale=scale;
-
-    Matrix4 ident;
-    ident.identity();
-    myMesh->trans=ident;
-    myMesh->fallback_texture_filename=fallback_texture_filename;
-    myMesh->marker=marker;
-    myMesh->initialized=false;
-    myMesh->needs_update=true;
-
+/*!
+ * \brief Make the mesh of a marker that is not in the registry yet
+ *
+ * Called without the registry locked, since a MESH_RESOURCE reads its model file here.
+ *
+ * \param marker
+ * \return The mesh, or NULL if it could not be made
+ */
+Mesh* new_marker_mesh(const visualization_msgs::Marker& marker){
+    Mesh* myMesh = NULL;
     if(marker.type==visualization_msgs::Marker::MESH_RESOURCE){
-        std::stringstream ss;
-        ss << marker.ns;
-        ss << marker.id;
+        Matrix4 ident;
+        ident.identity();
+        Vector3 scale(scaling_factor,scaling_factor,scaling_factor);
+        /// The mesh is only loaded later by the render thread
+        myMesh = newModelMesh(marker.mesh_resource,marker.header.frame_id,ident,scale,marker.id,marker.ns,false);
+        if(!myMesh){
+            return NULL;
+        }
         /// \todo this needs to come from the marker pose
         Matrix4 trans;
         trans.translate(marker.pose.position.x*scaling_factor,
                         marker.pose.position.y*scaling_factor,
                         marker.pose.position.z*scaling_factor);
-        Matrix4 rot = myMesh->quat2mat(marker.pose.orientation);
-        Matrix4 full = trans*rot;
-        Vector3 scale(scaling_factor,scaling_factor,scaling_factor);
-        /// This doesn't work because Mesh::MeshEntry::Init can't be called from the callback thread.
-        /// \todo we need a way to send the marker to the other thread but tell it to load when it's ready.
-        loadModel(marker.mesh_resource,marker.header.frame_id,full,scale,marker.id,marker.ns,false);
+        myMesh->trans = trans*myMesh->quat2mat(marker.pose.orientation);
     }else{
+        myMesh = new Mesh;
+        myMesh->name=marker.ns;
+        myMesh->id=marker.id;
+        myMesh->frame_id=marker.header.frame_id;
+        Vector3 scale;
+        scale.x=1.0;
+        scale.y=1.0;
+        scale.z=1.0;
+        myMesh->scale=scale;
+
+        Matrix4 ident;
+        ident.identity();
+        myMesh->trans=ident;
+        myMesh->fallback_texture_filename=fallback_texture_filename;
+        myMesh->initialized=false;
+        myMesh->needs_update=true;
+    }
+    myMesh->marker=marker;
+    return myMesh;
+}
+
+/*!
+ * \brief Apply the action of a marker to the registry
+ *
+ * Like rviz, the lifetime of a marker counts from when it was last received, not from its stamp.
+ * Removed markers are only retired here, and freed later by the VR thread.
+ * The render thread takes the registry lock every eye, so it is only held to look up and change the
+ * registry, and never while the mesh of a new marker is made.
+ *
+ * \param marker
+ */
+void update_marker(const visualization_msgs::Marker& marker){
+    if(!pVRVizApplication){
+        return;
+    }
+    MarkerRegistry& registry = pVRVizApplication->marker_registry;
+    const double expiry = marker.lifetime.isZero() ? 0.0 : (ros::Time::now()+marker.lifetime).toSec();
+    if(marker.action==visualization_msgs::Marker::DELETEALL || marker.action==visualization_msgs::Marker::DELETE){
+        boost::mutex::scoped_lock lock(registry.GetMutex());
+        if(marker.action==visualization_msgs::Marker::DELETEALL){
+            registry.RetireAll();
+        }else{
+            MarkerHandle handle = registry.Find(marker.ns,marker.id);
+            if(handle!=INVALID_MARKER_HANDLE){
+                registry.Retire(handle);
+            }
+        }
+        return;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(registry.GetMutex());
+        MarkerHandle handle = registry.Find(marker.ns,marker.id);
+        if(handle!=INVALID_MARKER_HANDLE){
+            update_marker_mesh(registry.Get(handle),marker);
+            registry.SetExpiry(handle,expiry);
+            return;
+        }
+    }
 
-        pVRVizApplication->robot_meshes.push_back(myMesh);
+    /// We didn't find it in our existing meshes, so make a new one
+    Mesh* myMesh = new_marker_mesh(marker);
+    if(!myMesh){
+        return;
+    }
+    boost::mutex::scoped_lock lock(registry.GetMutex());
+    MarkerHandle handle = registry.Add(marker.ns,marker.id,myMesh);
+    if(registry.Get(handle)!=myMesh){
+        /// Added by someone else while the lock was not held; the new mesh has no GL objects yet, so it can go here
+        update_marker_mesh(registry.Get(handle),marker);
+        delete myMesh;
     }
-    return -2;
+    registry.SetExpiry(handle,expiry);
 }
 
 /*!
@@ -2026,12 +2562,14 @@ int find_or_add_marker(visualization_msgs::Marker marker){
  */
 void markers_Callback(const visualization_msgs::MarkerArray::ConstPtr& msg)
 {
-    std::vector<float> texturedvertdataarray;
+    std::vector<float>& texturedvertdataarray = textured_tris_buffer.GetWriteBuffer();
+    texturedvertdataarray.clear();
 
     for(int ii=0;ii<msg->markers.size();ii++)
     {
-        find_or_add_marker(msg->markers[ii]);
-        if(msg->markers[ii].type==visualization_msgs::Marker::TEXT_VIEW_FACING){
+        update_marker(msg->markers[ii]);
+        if(msg->markers[ii].type==visualization_msgs::Marker::TEXT_VIEW_FACING &&
+           msg->markers[ii].action==visualization_msgs::Marker::ADD){
 
             ROS_ERROR_COND(msg->markers[ii].header.frame_id.length()==0, "Empty string???");
             Matrix4 mat = pVRVizApplication->GetRobotMatrixPose(msg->markers[ii].header.frame_id);
@@ -2049,9 +2587,8 @@ void markers_Callback(const visualization_msgs::MarkerArray::ConstPtr& msg)
             pVRVizApplication->AddTextToScene(mat4,texturedvertdataarray,msg->markers[ii].text,height);
         }
     }
-    /// Copy the data over to the shared data
-    /// \todo This should be protected with a mutex of sorts!
-    textured_tris_vertdataarray=texturedvertdataarray;
+    /// Hand the text over to the VR code
+    textured_tris_buffer.Publish();
     scene_update_needed=true;
 }
 
@@ -2074,12 +2611,9 @@ int main(int argc, char *argv[])
 
     image_transporter = new image_transport::ImageTransport(*nh);
 
-    std::string image_topic = nh->resolveName("image");
-    image_transport::CameraSubscriber sub_camera = image_transporter->subscribeCamera(image_topic, 1, cameraCallback);
+    image_transport::CameraSubscriber sub_depth = image_transporter->subscribeCamera(nh->resolveName("depth"), 1, depthCallback);
 
     ros::Subscriber sub_markers = nh->subscribe("/markers", 1, markers_Callback);
-    ros::Subscriber sub_image = nh->subscribe("/rgb/image_raw", 1, rawImageCallback);
-    ros::Subscriber sub_cloud = nh->subscribe("/cloud", 1, pointCloudCallback);
     ros::Subscriber sub_lock = nh->subscribe("/lock", 1, lockCallback);
     ros::Subscriber sub_show = nh->subscribe("/show", 1, showCallback);
 
@@ -2088,6 +2622,7 @@ int main(int argc, char *argv[])
     controller_pub[2] = nh->advertise<sensor_msgs::Joy>("/controller_right",1);
     twist_pub = nh->advertise<geometry_msgs::Twist>("/controller_twist",1);
     navgoal_pub = nh->advertise<geometry_msgs::PoseStamped>("/move_base_simple/goal",1);
+    diagnostics_pub = nh->advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics",1);
     /// The texture file is used for texturing some things
     vrviz_include_path = ros::package::getPath("vrviz")+"/include/vrviz/";
 
@@ -2100,17 +2635,18 @@ int main(int argc, char *argv[])
 
     /// This callback will update the transforms both in and out
     ros::Timer timer = nh->createTimer(ros::Duration(0.033), &VRVizApplication::update_tf_cache,pVRVizApplication);
+    ros::Timer diagnostics_timer = nh->createTimer(ros::Duration(1.0), diagnosticsCallback);
+    ros::Timer point_map_timer = nh->createTimer(ros::Duration(0.5), pointMapTimerCallback);
+    ros::Timer marker_expiry_timer = nh->createTimer(ros::Duration(0.1), markerExpiryTimerCallback);
 
     /// These params should probably be made dynamic?
     pnh->getParam("scaling_factor", scaling_factor);
-    pnh->getParam("hud_dist", hud_dist);
-    pnh->getParam("hud_size", hud_size);
     pnh->getParam("point_size", point_size);
+    pnh->getParam("worker_threads", worker_threads);
     pnh->getParam("load_robot", load_robot);
     pnh->getParam("show_tf", show_tf);
     pnh->getParam("show_grid", show_grid);
     pnh->getParam("show_movement", show_movement);
-    pnh->getParam("sbs_image", sbs_image);
 
     /// Teleport params
     pnh->getParam("teleport_mode", teleport_mode);
@@ -2138,11 +2674,29 @@ int main(int argc, char *argv[])
     pnh->getParam("base_frame", base_frame);
     pnh->getParam("intermediate_frame", intermediate_frame);
     pnh->getParam("frame_prefix", frame_prefix);
-    pnh->getParam("intensity_max", intensity_max);
-    pnh->getParam("manual_image_copy", manual_image_copy);
-    pnh->getParam("overlay_alpha", overlay_alpha);
-    pnh->getParam("axis_colored_pc", axis_colored_pc);
-    pnh->getParam("use_hsv", use_hsv);
+    pnh->getParam("compressed_depth_color", compressed_depth_color);
+    /// Kept so old launch files still start; every encoding ImageConverter knows skips OpenCV now
+    bool manual_image_copy=false;
+    if(pnh->getParam("manual_image_copy", manual_image_copy) && manual_image_copy){
+        ROS_WARN("manual_image_copy is no longer used, rgb8/bgr8 and the other common encodings are always converted without OpenCV");
+    }
+
+    /// Point cloud topics, each with its own settings in the cloud_<index> namespace
+    std::vector<std::string> cloud_topics;
+    pnh->getParam("cloud_topics", cloud_topics);
+    if(cloud_topics.empty()){
+        cloud_topics.push_back("/cloud");
+    }
+
+    /// Point map params
+    int map_max_points=point_map.max_points;
+    pnh->getParam("accumulate_clouds", accumulate_clouds);
+    pnh->getParam("decay_time", point_map.decay_time);
+    pnh->getParam("map_max_points", map_max_points);
+    pnh->getParam("map_node_size", map_node_size);
+    pnh->getParam("cull_chunk_size", cull_chunk_size);
+    pnh->getParam("marker_upload_budget_kb", marker_upload_budget_kb);
+    point_map.max_points = std::max(map_max_points,0);
 
     /// Default to 720p companion window
     int window_width=1280;
@@ -2155,6 +2709,57 @@ int main(int argc, char *argv[])
     /// A value <1.0 would be for large scenes, and a value >1.0 would be for small scenes
     pVRVizApplication->setScale(scaling_factor);
     pVRVizApplication->setPointSize(point_size);
+    point_map.node_size = map_node_size*scaling_factor;
+
+    if(worker_threads<=0){
+        worker_threads = std::max(1u,boost::thread::hardware_concurrency())-1;
+    }
+    worker_pool = new WorkerPool(worker_threads);
+    ROS_INFO("Using %d threads for point cloud, image and marker conversion",int(worker_pool->GetNumThreads()));
+#ifndef USE_VULKAN
+    marker_builder = new MarkerBuilder(worker_pool,size_t(std::max(marker_upload_budget_kb,1))*1024);
+#endif
+
+    /// Image topics; each one gets an overlay of its own, which only shows up once an image arrives
+    /// By default these are the camera on ~image, and /rgb/image_raw that vrviz has always shown without camera info
+    std::vector<std::string> image_topics;
+    bool default_image_topics = !pnh->getParam("image_topics", image_topics) || image_topics.empty();
+    if(default_image_topics){
+        image_topics.push_back("image");
+        image_topics.push_back("/rgb/image_raw");
+    }
+    for(size_t ii=0;ii<image_topics.size();ii++){
+        ImageStream* stream = new ImageStream();
+        stream->topic = nh->resolveName(image_topics[ii]);
+        getImageParams(*pnh,*stream);
+        if(default_image_topics && ii==1){
+            stream->use_camera_info = false;
+        }
+        getImageParams(ros::NodeHandle(*pnh,"image_"+std::to_string(ii)),*stream);
+        stream->converter.worker_pool = worker_pool;
+        image_streams.push_back(stream);
+    }
+
+    image_transport::Subscriber sub_depth_color;
+    ros::Subscriber sub_compressed_depth_color;
+    std::string depth_color_topic = nh->resolveName("depth_color");
+    if(compressed_depth_color){
+        depth_color_decoder = new CompressedImageDecoder(beginDepthColorImage,endDepthColorImage);
+        sub_compressed_depth_color = nh->subscribe<sensor_msgs::CompressedImage>(depth_color_topic+"/compressed", 1, compressedDepthColorCallback);
+    }else{
+        sub_depth_color = image_transporter->subscribe(depth_color_topic, 1, depthColorCallback);
+    }
+    for(size_t ii=0;ii<cloud_topics.size();ii++){
+        CloudStream* stream = new CloudStream();
+        stream->topic = cloud_topics[ii];
+        stream->point_size = point_size;
+        getCloudParams(*pnh,*stream);
+        getCloudParams(ros::NodeHandle(*pnh,"cloud_"+std::to_string(ii)),*stream);
+        stream->decoder.scaling_factor = scaling_factor;
+        stream->decoder.worker_pool = worker_pool;
+        stream->chunker.cell_size = cull_chunk_size*scaling_factor;
+        cloud_streams.push_back(stream);
+    }
     pVRVizApplication->setTextPath(vrviz_include_path + texture_filename);
     pVRVizApplication->setActionManifestPath(vrviz_include_path + "/vrviz_actions.json");
     pVRVizApplication->setCompanionResolution(window_width,window_height);
@@ -2172,6 +2777,41 @@ int main(int argc, char *argv[])
     ros::AsyncSpinner spinner(1); // Use 1 threads
     spinner.start();
 
+    /// Each cloud topic gets a queue and a spinner of its own
+    for(size_t ii=0;ii<cloud_streams.size();ii++){
+        CloudStream* stream = cloud_streams[ii];
+        stream->nh.setCallbackQueue(&stream->queue);
+        stream->subscriber = stream->nh.subscribe<sensor_msgs::PointCloud2>(stream->topic, 1, boost::bind(pointCloudCallback,_1,stream));
+        stream->spinner = new ros::AsyncSpinner(1,&stream->queue);
+        stream->spinner->start();
+        ROS_INFO("Subscribed to point cloud topic %s",stream->topic.c_str());
+    }
+
+    /// And so does each image topic
+    for(size_t ii=0;ii<image_streams.size();ii++){
+        ImageStream* stream = image_streams[ii];
+        stream->nh.setCallbackQueue(&stream->queue);
+        image_transport::ImageTransport transport(stream->nh);
+        if(stream->compressed){
+            /// Compressed images skip image_transport, which would decode them on the spinner thread into BGR first
+#ifndef USE_VULKAN
+            stream->decoder = new CompressedImageDecoder(boost::bind(beginOverlayImage,_1,_2,_3,stream),
+                                                         boost::bind(endOverlayImage,_1,_2,_3,_4,stream));
+#endif
+            stream->compressed_subscriber = stream->nh.subscribe<sensor_msgs::CompressedImage>(stream->topic+"/compressed", 1, boost::bind(compressedImageCallback,_1,stream));
+            if(stream->use_camera_info){
+                stream->info_subscriber = stream->nh.subscribe<sensor_msgs::CameraInfo>(image_transport::getCameraInfoTopic(stream->topic), 1, boost::bind(cameraInfoCallback,_1,stream));
+            }
+        }else if(stream->use_camera_info){
+            stream->camera_subscriber = transport.subscribeCamera(stream->topic, 1, boost::bind(cameraCallback,_1,_2,stream));
+        }else{
+            stream->image_subscriber = transport.subscribe(stream->topic, 1, boost::bind(imageCallback,_1,stream));
+        }
+        stream->spinner = new ros::AsyncSpinner(1,&stream->queue);
+        stream->spinner->start();
+        ROS_INFO("Subscribed to image topic %s",stream->topic.c_str());
+    }
+
 #ifndef USE_VULKAN
     /// If desired, load a robot model from the parameter server
     if(load_robot){
@@ -2183,6 +2823,21 @@ int main(int argc, char *argv[])
     pVRVizApplication->RunMainLoop();
 
     /// Cleanup
+    /// Stop every callback before any GL object they hand data to is released
+    spinner.stop();
+    for(size_t ii=0;ii<cloud_streams.size();ii++){
+        cloud_streams[ii]->spinner->stop();
+    }
+    for(size_t ii=0;ii<image_streams.size();ii++){
+        image_streams[ii]->spinner->stop();
+        delete image_streams[ii]->decoder;
+    }
+    delete depth_color_decoder;
+    delete marker_builder;
+    marker_builder = NULL;
+#ifndef USE_VULKAN
+    pVRVizApplication->ReleaseStreams();
+#endif
     pVRVizApplication->Shutdown();
 
 	return 0;
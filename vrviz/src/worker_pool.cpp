@@ -0,0 +1,104 @@
+#include "worker_pool.h"
+
+/*!
+ * \brief Start the pool
+ *
+ * \param num_threads Threads to spawn. The thread calling ParallelFor() also runs tasks,
+ *                    so 0 is valid and simply runs everything on the caller.
+ */
+WorkerPool::WorkerPool(unsigned int num_threads)
+    : m_task(NULL)
+    , m_numTasks(0)
+    , m_nextTask(0)
+    , m_pendingTasks(0)
+    , m_stop(false)
+{
+    for(unsigned int ii=0;ii<num_threads;ii++)
+    {
+        m_threads.push_back(new boost::thread(&WorkerPool::WorkerLoop,this));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeCondition.notify_all();
+    for(size_t ii=0;ii<m_threads.size();ii++)
+    {
+        m_threads[ii]->join();
+        delete m_threads[ii];
+    }
+}
+
+/*!
+ * \brief Run task(0) ... task(num_tasks-1) spread over the pool, and wait for all of them
+ *
+ * Tasks may run in any order and on any thread, so they must only write to their own
+ * part of any shared output.
+ */
+void WorkerPool::ParallelFor(size_t num_tasks, const boost::function<void(size_t)>& task)
+{
+    if(num_tasks==0){
+        return;
+    }
+    if(num_tasks==1 || m_threads.empty()){
+        for(size_t ii=0;ii<num_tasks;ii++){
+            task(ii);
+        }
+        return;
+    }
+
+    boost::unique_lock<boost::mutex> batch_lock(m_batchMutex,boost::try_to_lock);
+    if(!batch_lock.owns_lock()){
+        /// The pool is busy with another caller's batch
+        for(size_t ii=0;ii<num_tasks;ii++){
+            task(ii);
+        }
+        return;
+    }
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_task = &task;
+    m_numTasks = num_tasks;
+    m_nextTask = 0;
+    m_pendingTasks = num_tasks;
+    m_wakeCondition.notify_all();
+
+    /// Help out rather than sit idle
+    RunTasks(lock);
+    while(m_pendingTasks>0){
+        m_doneCondition.wait(lock);
+    }
+    m_task = NULL;
+}
+
+void WorkerPool::WorkerLoop()
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while(!m_stop)
+    {
+        if(m_task && m_nextTask<m_numTasks){
+            RunTasks(lock);
+        }else{
+            m_wakeCondition.wait(lock);
+        }
+    }
+}
+
+/// Take tasks from the current batch until there are none left. Called with m_mutex locked.
+void WorkerPool::RunTasks(boost::unique_lock<boost::mutex>& lock)
+{
+    while(m_task && m_nextTask<m_numTasks)
+    {
+        const boost::function<void(size_t)>& task = *m_task;
+        size_t index = m_nextTask++;
+        lock.unlock();
+        task(index);
+        lock.lock();
+        if(--m_pendingTasks==0){
+            m_doneCondition.notify_all();
+        }
+    }
+}
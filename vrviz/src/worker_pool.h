@@ -0,0 +1,47 @@
+#ifndef WORKER_POOL_H
+#define	WORKER_POOL_H
+
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/*!
+ * \brief A fixed set of threads for splitting heavy ROS callbacks into parallel pieces
+ *
+ * The ROS spinner thread hands a batch of independent tasks to ParallelFor(), which runs
+ * them on the pool and on the calling thread, and returns once every task is done.
+ * Only one batch runs on the pool at a time. Other callers run their batch on their own
+ * thread rather than wait, so a big batch from one topic never holds up a small one from another.
+ */
+class WorkerPool
+{
+public:
+    explicit WorkerPool(unsigned int num_threads);
+    ~WorkerPool();
+
+    void ParallelFor(size_t num_tasks, const boost::function<void(size_t)>& task);
+
+    /// Number of threads that work on a batch, including the one that calls ParallelFor()
+    unsigned int GetNumThreads() const { return m_threads.size()+1; }
+
+private:
+    void WorkerLoop();
+    void RunTasks(boost::unique_lock<boost::mutex>& lock);
+
+    std::vector<boost::thread*> m_threads;
+
+    boost::mutex m_batchMutex;///!< Held for the whole of a ParallelFor() call that uses the pool
+    boost::mutex m_mutex;///!< Protects everything below
+    boost::condition_variable m_wakeCondition;
+    boost::condition_variable m_doneCondition;
+    const boost::function<void(size_t)>* m_task;
+    size_t m_numTasks;
+    size_t m_nextTask;
+    size_t m_pendingTasks;
+    bool m_stop;
+};
+
+
+#endif	/* WORKER_POOL_H */